@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+# stream / msg / udp 数据面对比：两者都经过 lossy_relay.py 的有损本地链路
+#
+# 用法: bench/compare_transports.sh [hruft 可执行文件] [文件大小MB] [丢包率] [单向延迟ms] [udp 速率]
+set -euo pipefail
+
+HRUFT=${1:-./build/hruft}
+SIZE_MB=${2:-512}
+LOSS=${3:-0.001}
+DELAY_MS=${4:-25}
+UDP_RATE=${5:-1G}
+
+RECV_PORT=9000
+RELAY_PORT=9100
+WORK=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf "$WORK"' EXIT
+
+dd if=/dev/urandom of="$WORK/src.bin" bs=1M count="$SIZE_MB" status=none
+mkdir -p "$WORK/out"
+
+# 控制端口和数据端口（+1）都要经过中继
+python3 "$(dirname "$0")/lossy_relay.py" \
+    --map $RELAY_PORT:$RECV_PORT --map $((RELAY_PORT + 1)):$((RECV_PORT + 1)) \
+    --loss "$LOSS" --delay-ms "$DELAY_MS" --seed 1 > "$WORK/relay.log" &
+sleep 1
+
+printf "%-8s %12s %14s %10s\n" transport duration_s goodput_mbps retrans
+for transport in stream msg udp; do
+    rm -f "$WORK/out/"*
+    "$HRUFT" recv $RECV_PORT "$WORK/out/" > "$WORK/recv_$transport.log" 2>&1 &
+    RECV_PID=$!
+    sleep 0.5
+    "$HRUFT" send 127.0.0.1 $RELAY_PORT "$WORK/src.bin" --transport "$transport" \
+        --rate "$UDP_RATE" > "$WORK/send_$transport.log" 2>&1
+    wait $RECV_PID || true
+
+    python3 - "$WORK/recv_$transport.log" "$transport" <<'PY'
+import json, sys
+text = open(sys.argv[1], encoding="utf-8", errors="replace").read()
+report = json.loads(text.split("=== Transfer Summary ===", 1)[1])
+meta = report["meta"]
+# udp 数据面的重传不经过 UDT，取接收端回报的丢包位图次数
+retrans = meta["udp"]["loss_reports"] if "udp" in meta else report["reliability"]["retrans_total"]
+print("%-8s %12.2f %14.1f %10d" % (sys.argv[2], meta["duration_sec"], meta["avg_speed_mbps"],
+                                   retrans))
+PY
+done
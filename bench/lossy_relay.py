@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""
+HRUFT 基准测试用的本地有损 UDP 中继。
+
+每个 --map LISTEN:TARGET 在 LISTEN 端口接收客户端数据报并转发到 127.0.0.1:TARGET，
+回程数据报转发回最近一个客户端地址。两个方向都按 --loss 概率随机丢包，并附加 --delay-ms 单向延迟。
+
+示例（接收端监听 9000/9001，发送端连接 9100）:
+    python3 lossy_relay.py --map 9100:9000 --map 9101:9001 --loss 0.001 --delay-ms 25
+"""
+
+import argparse
+import asyncio
+import random
+import signal
+
+
+class Relay(asyncio.DatagramProtocol):
+    def __init__(self, target, loss, delay, stats):
+        self.target = target
+        self.loss = loss
+        self.delay = delay
+        self.stats = stats
+        self.client = None
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        # 来自目标端的是回程，其余视为客户端
+        if addr == self.target:
+            dest = self.client
+        else:
+            self.client = addr
+            dest = self.target
+        if dest is None:
+            return
+
+        self.stats["total"] += 1
+        if random.random() < self.loss:
+            self.stats["dropped"] += 1
+            return
+
+        if self.delay > 0:
+            asyncio.get_running_loop().call_later(self.delay, self.transport.sendto, data, dest)
+        else:
+            self.transport.sendto(data, dest)
+
+
+async def main():
+    ap = argparse.ArgumentParser(description="Lossy localhost UDP relay for HRUFT benchmarks")
+    ap.add_argument("--map", action="append", required=True, help="LISTEN:TARGET port pair")
+    ap.add_argument("--loss", type=float, default=0.001, help="drop probability per datagram")
+    ap.add_argument("--delay-ms", type=float, default=0.0, help="one-way added delay")
+    ap.add_argument("--seed", type=int, default=None)
+    args = ap.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    loop = asyncio.get_running_loop()
+    stats = {"total": 0, "dropped": 0}
+    for m in args.map:
+        listen, target = (int(x) for x in m.split(":"))
+        await loop.create_datagram_endpoint(
+            lambda t=target: Relay(("127.0.0.1", t), args.loss, args.delay_ms / 1000.0, stats),
+            local_addr=("127.0.0.1", listen))
+        print(f"[relay] 127.0.0.1:{listen} -> 127.0.0.1:{target} loss={args.loss} delay={args.delay_ms}ms",
+              flush=True)
+
+    stop = asyncio.Event()
+    for sig in (signal.SIGINT, signal.SIGTERM):
+        loop.add_signal_handler(sig, stop.set)
+    await stop.wait()
+    print(f"[relay] datagrams={stats['total']} dropped={stats['dropped']}", flush=True)
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+# udp 数据面 GSO/GRO 卸载前后对比：本地回环（或 veth）上测每核每秒数据报数
+#
+# 用法: bench/udp_offload.sh [hruft 可执行文件] [文件大小MB] [速率] [MSS]
+set -euo pipefail
+
+HRUFT=${1:-./build/hruft}
+SIZE_MB=${2:-1024}
+RATE=${3:-10G}
+MSS=${4:-1500}
+
+RECV_PORT=9200
+WORK=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf "$WORK"' EXIT
+
+dd if=/dev/urandom of="$WORK/src.bin" bs=1M count="$SIZE_MB" status=none
+mkdir -p "$WORK/out"
+
+printf "%-8s %10s %12s %14s %14s %10s\n" offload duration_s goodput_mbps snd_pps_core rcv_pps_core syscalls
+for mode in off on; do
+    opts=()
+    [ "$mode" = off ] && opts=(--no-gso)
+    rm -f "$WORK/out/"*
+
+    # 以 bash 内建 time 记录两端各自的 user + sys CPU 时间
+    ( TIMEFORMAT='%U %S'; time "$HRUFT" recv $RECV_PORT "$WORK/out/" "${opts[@]}" \
+        > "$WORK/recv_$mode.log" 2>&1 ) 2> "$WORK/recv_cpu_$mode" &
+    RECV_PID=$!
+    sleep 0.5
+    ( TIMEFORMAT='%U %S'; time "$HRUFT" send 127.0.0.1 $RECV_PORT "$WORK/src.bin" --transport udp \
+        --rate "$RATE" --mss "$MSS" "${opts[@]}" > "$WORK/send_$mode.log" 2>&1 ) 2> "$WORK/send_cpu_$mode"
+    wait $RECV_PID || true
+
+    python3 - "$WORK" "$mode" <<'PY'
+import json, sys
+work, mode = sys.argv[1], sys.argv[2]
+def cpu(name):
+    user, sys_ = open("%s/%s_cpu_%s" % (work, name, mode)).read().split()
+    return float(user) + float(sys_)
+text = open("%s/recv_%s.log" % (work, mode), encoding="utf-8", errors="replace").read()
+report = json.loads(text.split("=== Transfer Summary ===", 1)[1])
+meta = report["meta"]
+for line in open("%s/send_%s.log" % (work, mode), encoding="utf-8", errors="replace"):
+    if "UDP data plane:" in line:
+        sender = json.loads(line.split("UDP data plane:", 1)[1])
+dgrams = sender["datagrams_sent"]
+print("%-8s %10.2f %12.1f %14.0f %14.0f %10d" % (
+    mode, meta["duration_sec"], meta["avg_speed_mbps"],
+    dgrams / max(cpu("send"), 1e-6), meta["udp"]["datagrams_total"] / max(cpu("recv"), 1e-6),
+    sender["send_syscalls"] + meta["udp"]["recv_syscalls"]))
+PY
+done
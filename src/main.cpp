@@ -20,6 +20,18 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <memory>
+#include <list>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <tuple>
+#include <limits>
+#include <ctime>
+#include <cstdlib>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -30,6 +42,52 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/select.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+// 旧版 glibc 头文件可能缺少 GSO/GRO 选项定义（内核 4.18+ / 5.0+）
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sys/auxv.h>
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// CPU 特性检测（报告 BLAKE3 的 SIMD 路径）
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
 #endif
 
 #include <udt.h>
@@ -82,14 +140,209 @@ public:
 #define ntohll be64toh
 #endif
 
+// 线程安全的本地时间转换：std::localtime 返回共享的静态缓冲，而截止时间与作业日志在多个线程中格式化时间
+inline std::tm localTime(std::time_t t) {
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    return tm;
+}
+
 // --- 高性能配置常量 ---
-const uint32_t MAGIC_ID = 0x48525032; // "HRP2" in ASCII
-const int APP_BLOCK_SIZE = 4 * 1024 * 1024; // 4MB 应用层分块
+// 协议版本随魔数递增：HRP4 起流模式分块上限为 MAX_BLOCK_SIZE（HRP3 为 4MB），旧版本两端在握手时拒绝
+const uint32_t MAGIC_ID = 0x48525034; // "HRP4" in ASCII
+const int APP_BLOCK_SIZE = 4 * 1024 * 1024; // 4MB 协议分块单位（msg/udp 定位、serve 块缓存）
 const int UDT_MAX_BUF = 256 * 1024 * 1024; // 256MB 最大缓冲
+const int MIN_WINDOW = 64 * 1024; // 窗口下限（--window 与协商结果）
 const std::string TRANSFER_COMPLETE = "TRANSFER_COMPLETE";
 const std::string ACK_TRANSFER = "ACK_TRANSFER";
 const int DEFAULT_MSS = 1500;
+const int MIN_MSS = 536;
+const int MAX_MSS = 8900;
 const int DEFAULT_WINDOW = 10 * 1024 * 1024; // 10MB default
+const uint32_t FETCH_MAGIC = 0x48524652; // "HRFR" 拉取请求
+const int DEFAULT_CACHE_MB = 1024; // serve 模式块缓存上限
+const std::string STDIO_PATH = "-"; // 以 "-" 表示 stdin / stdout
+const size_t REPORT_MAX_BYTES = 16 * 1024 * 1024; // 接收端报告上限
+
+// ProtocolHeader::flags
+const uint32_t FLAG_STREAM = 0x1; // 长度未知：数据按 [uint32 长度][数据] 分块，长度 0 表示流结束
+const uint32_t FLAG_MSG = 0x2;    // 数据走独立的 UDT SOCK_DGRAM 连接（控制端口 + 1），乱序交付
+const uint32_t FLAG_UDP = 0x4;    // 数据走原生 UDP（控制端口 + 1），接收端通过控制连接回报丢包位图
+const uint32_t FLAG_PROBE = 0x8;  // 预探测连接：测量 RTT 与带宽、协商窗口后关闭，不传文件
+const uint32_t FLAG_DISK_HINT = 0x10; // 接收端经控制连接周期回报持续写盘速率，发送端按 min(网络, 磁盘) 定速
+
+const int MSG_CHUNK_SIZE = 64 * 1024; // 消息模式单条消息的数据量
+const std::string DATA_READY = "DATA_READY";
+
+// 传输前探测：往返 PROBE_PINGS 次测 RTT，再发 PROBE_TRAIN_BYTES 测带宽，窗口取 2×BDP
+const int PROBE_PINGS = 8;
+const uint32_t PROBE_TRAIN_BYTES = 4 * 1024 * 1024;
+const int PROBE_MIN_WINDOW = 1 * 1024 * 1024;
+const int PROBE_RELISTEN_MS = 200;    // 等待接收端按新窗口重新监听
+const int PROBE_CONNECT_TRIES = 20;
+
+// 路径 MTU 探测
+const int PMTU_PROBE_ROUNDS = 4;              // 每轮按内核最新 PMTU 缩小探测包
+const int PMTU_PROBE_WAIT_MS = 200;           // 每轮等待 ICMP "需要分片" 的时间
+const int64_t PMTU_CACHE_TTL_SEC = 7 * 24 * 3600;
+
+// 原生 UDP 数据面参数
+const int UDP_BATCH = 32;                     // sendmmsg / recvmmsg 每批数据报数
+const int UDP_IP_OVERHEAD = 28;               // IPv4 + UDP 头
+const int UDP_GSO_BATCH = 8;                  // GSO 时每次 sendmmsg 的超级数据报数
+const int UDP_MAX_GSO_SEGS = 64;              // 内核 UDP_MAX_SEGMENTS
+const int UDP_MAX_SUPER_DGRAM = 65507;        // 单个 UDP 数据报（含 GSO/GRO 合并后）上限
+const int LOSS_REPORT_INTERVAL_MS = 20;       // 接收端丢包位图上报周期
+const uint32_t MAX_REPORT_BITS = 64 * 1024;   // 单次位图最多覆盖的数据报数
+const int UDP_IDLE_TIMEOUT_MS = 30000;        // 数据面无数据超时
+const double DEFAULT_UDP_RATE_BPS = 1e9;      // 未指定 --rate 时的发送速率
+
+// RateCC（--cc rate）参数
+const int DEFAULT_BURST_KB = 256;             // 令牌桶突发容量
+const double RATE_CC_BURST_SPEEDUP = 4.0;     // 突发时相对目标速率的最大倍数
+const double RATE_CC_LOSS_THRESHOLD = 0.02;   // 评估周期内丢包率超过此值才降速
+const double RATE_CC_BACKOFF = 0.9;           // 每次降速的系数
+const double RATE_CC_RECOVER_STEP = 0.05;     // 每个干净周期恢复目标速率的比例
+const double RATE_CC_MIN_FRACTION = 0.5;      // 降速下限（目标速率的比例）
+const int RATE_CC_EPOCH_MS = 100;             // 丢包评估周期下限
+const double RATE_CC_MIN_CWND = 1000.0;       // 最小拥塞窗口（包）
+
+// BBRCC（--cc bbr）参数
+const double BBR_HIGH_GAIN = 2.885;           // STARTUP 增益 2/ln2
+const double BBR_CWND_GAIN = 2.0;             // PROBE_BW 窗口增益
+const int BBR_CYCLE_LEN = 8;
+const double BBR_CYCLE_GAINS[BBR_CYCLE_LEN] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+const uint64_t BBR_BW_WINDOW_ROUNDS = 10;     // 带宽最大值滤波窗口（轮）
+const int BBR_MIN_RTT_WINDOW_MS = 10000;      // min RTT 有效期
+const int BBR_PROBE_RTT_MS = 200;             // PROBE_RTT 持续时间
+const double BBR_FULL_BW_GROWTH = 1.25;       // 满管道判定：每轮增长不足 25%
+const int BBR_FULL_BW_ROUNDS = 3;
+const double BBR_MIN_CWND = 4.0;
+const double BBR_INITIAL_CWND = 16.0;
+
+// ScavengerCC（--cc scavenger）参数，参照 RFC 6817
+const double DEFAULT_TARGET_DELAY_MS = 25.0;  // 允许额外占用的排队时延
+const double LEDBAT_GAIN = 1.0;
+const double LEDBAT_MIN_CWND = 2.0;
+const double LEDBAT_INITIAL_CWND = 16.0;
+const double LEDBAT_ALLOWED_INCREASE = 16.0;  // 窗口至多超出在途量的包数
+const size_t LEDBAT_CURRENT_FILTER = 4;
+const size_t LEDBAT_BASE_HISTORY = 10;        // 基础时延保留的分钟桶数
+const double LEDBAT_SLOW_START_EXIT = 0.75;   // 排队时延达到目标的该比例即退出慢启动
+
+// 发送端读流水线与在线调优（--tune）参数
+const int PIPELINE_DEFAULT_DEPTH = 2;         // 默认双缓冲：读一块的同时发送上一块
+const int PIPELINE_MAX_DEPTH = 8;
+const int TUNE_INITIAL_BLOCK = 1 * 1024 * 1024; // 调优时的起始读块大小，读盘受限时逐步加倍
+const int DEFAULT_TUNE_INTERVAL_MS = 250;
+const int MIN_TUNE_INTERVAL_MS = 100;
+const int MAX_TUNE_INTERVAL_MS = 500;
+const double TUNE_LOSS_BURST = 0.02;          // 采样周期内丢包率超过此值视为丢包突发
+const double TUNE_LOSS_BACKOFF = 0.85;        // 丢包突发时速率上限 = 周期发送速率 × 该系数
+const double TUNE_FLOW_STARVED = 0.1;         // 对端通告窗口低于峰值的该比例视为接收缓冲饥饿
+const double TUNE_SOURCE_WAIT = 0.3;          // 发送线程等待读盘超过周期的该比例视为读盘受限
+const int TUNE_CLEAN_SAMPLES = 4;             // 连续干净周期数达到后开始放宽速率上限
+const double TUNE_RECOVER_STEP = 1.1;         // 每个干净周期放宽速率上限的倍数
+const double TUNE_RELEASE_RATIO = 1.25;       // 上限超过峰值发送速率该倍数即解除
+const double TUNE_MIN_RATE_BPS = 1e6;
+const size_t TUNE_MAX_DECISIONS = 256;        // 报告中保留的决策条数
+
+// 截止时间调度（--deadline）
+const int DEADLINE_REPLAN_MS = 1000;
+const double DEADLINE_HEADROOM = 0.1;         // 按所需速率的 1.1 倍发送
+const double DEADLINE_SMOOTHING = 0.5;        // 实际速率 EWMA 系数
+const size_t DEADLINE_MAX_POINTS = 512;       // 报告中曲线点上限，超过后抽稀
+
+// 接收端写盘速率提示（FLAG_DISK_HINT）
+const uint32_t DISK_HINT_MAGIC = 0x48524448;  // "HRDH"
+const uint32_t DISK_HINT_FINAL = 0x1;         // 数据已收齐，此后控制连接上不再有提示
+// 接收端读完文件名后对 FLAG_DISK_HINT 的应答（等长），发送端收到 ACCEPT 才启动提示读线程
+const std::string DISK_HINT_ACCEPT = "DISK_HINT_ON";
+const std::string DISK_HINT_DECLINE = "DISK_HINT_NO";
+const int DISK_HINT_INTERVAL_MS = 500;
+const double DISK_HINT_BUSY = 0.5;            // 周期内写盘耗时占比达到此值才视为磁盘受限
+const double DISK_HINT_EWMA = 0.3;            // 持续写速率的平滑系数
+
+// 读写块大小（--block-size / --mem-limit）
+#if defined(__arm__) && !defined(__aarch64__)
+const int DEFAULT_BLOCK_SIZE = 1 * 1024 * 1024; // arm32 网关内存小，默认 1MB 块
+const int DEFAULT_MEM_LIMIT_MB = 32;
+#else
+const int DEFAULT_BLOCK_SIZE = APP_BLOCK_SIZE;
+const int DEFAULT_MEM_LIMIT_MB = 256;
+#endif
+const int MIN_BLOCK_SIZE = 64 * 1024;
+const int MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+const int MIN_MEM_LIMIT_MB = 4;
+const int BLOCK_TUNE_INTERVAL_MS = 500;
+const int BLOCK_PROBE_SPAN_MS = 10;           // 起始块 ≈ 探测带宽下 10ms 的数据量
+const double BLOCK_OVERHEAD_HIGH = 0.05;      // 调用固定开销占周期的比例超过此值加大块
+const double BLOCK_OVERHEAD_LOW = 0.01;       // 低于此值且块在队列中闲置时减小块
+const double BLOCK_BACKLOG = 0.3;             // 本端是瓶颈（等读盘 / 接收缓冲积压）的比例
+const double BLOCK_IDLE = 0.5;                // 对端是瓶颈（块等待发出 / 接收缓冲空闲）的比例
+const size_t BLOCK_MAX_CHANGES = 64;          // 报告中保留的调整记录条数
+
+// 时间序列采样（--stats-out）
+const int DEFAULT_STATS_INTERVAL_MS = 250;
+const int MIN_STATS_INTERVAL_MS = 10;
+const int MAX_STATS_INTERVAL_MS = 60000;
+
+// 进度输出（--progress）
+const int DEFAULT_PROGRESS_INTERVAL_MS = 1000;
+const int MIN_PROGRESS_INTERVAL_MS = 50;
+
+// 作业模式带宽分配（send --jobs）
+const int SCHED_REBALANCE_MS = 250;
+const double SCHED_BURST_BYTES = 1024 * 1024; // 每会话令牌桶容量
+const double SCHED_HUNGRY = 0.9;              // 实际速率达到授予速率的该比例视为还想要更多
+const double SCHED_THROTTLED = 0.1;           // 周期内等令牌超过该比例同样视为受分配限制
+const double SCHED_DEMAND_MARGIN = 1.2;       // 未用满时的需求 = 实际速率 × 该系数，余量留给爬升
+const double SCHED_MIN_RATE_BPS = 1e6;        // 每个活跃会话的保底速率，保证能表现出需求
+
+// 分阶段耗时直方图（读盘 / 哈希 / 发送 / 接收 / 写盘）
+const int STAGE_SUB_BITS = 4;                 // 每个 2 的幂区间再分 16 个子桶，相对误差 < 6.25%
+const int STAGE_MAX_EXP = 40;                 // 最大可记录约 2^41 ns（约 36 分钟），更长的计入最后一桶
+const double STAGE_BOTTLENECK_BUSY = 0.5;     // 单个读写 / 哈希阶段占墙钟时间超过此比例即为瓶颈
+const double STAGE_THREAD_SATURATED = 0.8;    // 同一线程上读写与哈希合计超过此比例也视为本端瓶颈
+
+// Chrome 轨迹（--trace）
+const int TRACE_COUNTER_MS = 100;             // 速率 / RTT / 缓冲占用计数器的采样周期
+const size_t TRACE_MAX_SPANS = 1 << 20;       // 每线程最多记录的阶段事件数（约 40MB），超出只计数
+
+// 硬件性能计数器（--perf-counters）
+const double PERF_MEMORY_BOUND_IPC = 1.0;     // 哈希 IPC 低于此值视为访存受限，否则为计算受限
+
+// 拥塞控制事件录制（--cc-trace）
+const int CC_TRACE_EVENTS = 1 << 14;          // 环形缓冲容量（2 的幂），每 10ms 一次 ACK 约可保留 160 秒
+const double CC_JITTER_RATIO = 3.0;           // RTT p99 超过 p50 的该倍数时提示时延抖动
+const uint64_t CC_JITTER_MIN_SAMPLES = 100;   // 样本太少时不判断抖动
+
+// CPU 与内存统计
+const size_t RESOURCE_MAX_FINISHED = 4096;    // 保留的已退出线程记录数
+const double RESOURCE_THREAD_SATURATED = 90;  // 单个线程 CPU 占墙钟时间超过此百分比视为占满一个核
+
+// 本地传输历史（hruft history）
+const uint32_t HISTORY_MAGIC = 0x48524853;    // "HRHS"
+const uint32_t HISTORY_VERSION = 1;
+const uint32_t HISTORY_FLAG_SUCCESS = 0x1;    // 校验通过且对端确认
+const size_t HISTORY_WINDOW = 10;             // 基线取该对端此前最近若干次合格传输的中位数
+const size_t HISTORY_MIN_SAMPLES = 3;         // 基线样本少于此数时不判断回退
+const double HISTORY_REGRESSION = 0.7;        // 有效吞吐低于基线的该比例（慢 30%）视为回退
+const uint64_t HISTORY_MIN_BYTES = 16 * 1024 * 1024; // 更小的传输由握手与慢启动主导，不计入基线
+const double HISTORY_RTT_RISE = 1.5;          // RTT 超过基线的该倍数时归因于路径
+const double HISTORY_RETRANS_RISE = 0.005;    // 重传率比基线高出该值（且翻倍）时归因于丢包
+
+// 发送端视角合并
+const double ACCOUNTING_LOW_EFFICIENCY = 0.9;  // 文件字节 / 线路字节低于此值时提示线路开销
+
+// Prometheus 指标端点（--metrics）
+const int METRICS_POLL_MS = 1000;             // 轮询 perfmon、计算速率的周期（抓取本身不调用 perfmon）
+const int METRICS_CLIENT_TIMEOUT_MS = 1000;   // 单个抓取连接的读写超时
+const size_t METRICS_MAX_REQUEST = 8192;
 
 // --- 协议头 ---
 #pragma pack(push, 1)
@@ -97,10 +350,61 @@ struct ProtocolHeader {
     uint32_t magic;
     uint32_t mss;
     uint32_t window_size;
-    uint64_t file_size;
+    uint64_t file_size;   // FLAG_STREAM 时为 0
+    uint32_t flags;
     uint16_t filename_len;
     // 紧接着是 filename_len 长度的文件名（无终止符）
 };
+
+// 消息模式下每条 UDT 消息的头部，接收端据此直接定位写入
+struct MsgHeader {
+    uint64_t block_index;
+    uint32_t offset;      // 块内偏移
+};
+
+// 原生 UDP 数据报头：块号 + 块内序号，定位 = block * APP_BLOCK_SIZE + seq * payload
+struct UdpHeader {
+    uint64_t block_index;
+    uint32_t seq;
+};
+
+// 接收端 -> 发送端的丢包位图（控制连接上发送），后接 (nbits + 7) / 8 字节位图，1 表示缺失
+// base == highest == 总数据报数 且 nbits == 0 表示已全部收齐
+struct LossReport {
+    uint64_t base;      // 位图第 0 位对应的全局数据报序号
+    uint64_t highest;   // 已收到的最大序号 + 1
+    uint32_t nbits;
+};
+
+// 探测结果：接收端 -> 发送端（列车字节数、首末字节间隔、UDT 包对估计的链路带宽）
+struct ProbeResult {
+    uint64_t bytes;
+    uint64_t usec;
+    uint64_t est_bw_kbps;
+};
+
+// 探测结论：发送端 -> 接收端，双方按同一窗口重建连接
+struct ProbeDecision {
+    uint32_t window;
+    uint32_t rtt_us;
+    uint64_t bw_bps;
+};
+
+// 写盘速率提示：接收端 -> 发送端，bits_per_sec 为 0 表示磁盘不构成瓶颈
+struct DiskHint {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t bits_per_sec;
+};
+
+// fetch 客户端 -> serve 服务端的拉取请求
+struct FetchRequest {
+    uint32_t magic;
+    uint32_t mss;
+    uint32_t window_size;
+    uint16_t name_len;
+    // 紧接着是 name_len 长度的相对路径（无终止符）
+};
 #pragma pack(pop)
 
 // --- 简单的拥塞控制类（用于关闭拥塞控制） ---
@@ -145,32 +449,562 @@ public:
     }
 };
 
-// 简单的拥塞控制工厂类
-class SimpleCCFactory : public CCCVirtualFactory {
+// 自定义拥塞控制的公共基类：回调在低频路径（onACK 等）更新内部状态快照，
+// 主线程通过 UDT_CC 取回 CCC 指针后读取，写入报告的 congestion 段
+class ReportingCC : public CCC {
+protected:
+    mutable std::mutex stateMutex;
+    json state;
+
+    // 在线调优设置的速率上限（bit/s，0 表示不限），在控制器下次计算发送间隔时生效
+    std::atomic<double> rateCapBps{0};
+
+    void publish(json s) {
+        std::lock_guard<std::mutex> lk(stateMutex);
+        state = std::move(s);
+    }
+
+    double capPeriod(double period) const {
+        double cap = rateCapBps.load(std::memory_order_relaxed);
+        return cap > 0 ? std::max(period, m_iMSS * 8.0 / cap * 1e6) : period;
+    }
+
 public:
-    virtual ~SimpleCCFactory() {}
+    json report() const {
+        std::lock_guard<std::mutex> lk(stateMutex);
+        return state;
+    }
 
-    virtual CCC* create() override {
-        return new SimpleCC;
+    void setRateCap(double bps) {
+        rateCapBps.store(bps, std::memory_order_relaxed);
+    }
+};
+
+// UDT 序列号为 31 位循环计数，返回 a - b（考虑回绕）
+static int32_t seqDiff(int32_t a, int32_t b) {
+    int64_t d = static_cast<int64_t>(a) - b;
+    if (d > 0x3FFFFFFF) d -= 0x80000000LL;
+    if (d < -0x3FFFFFFF) d += 0x80000000LL;
+    return static_cast<int32_t>(d);
+}
+
+// 固定速率拥塞控制：令牌桶按目标速率补充，允许至多 burstBytes 的突发；
+// 丢包率超过阈值时温和降速（×RATE_CC_BACKOFF），恢复后逐步回到目标速率
+//
+// UDT 只在 ACK/NAK/超时后读取 m_dPktSndPeriod，因此令牌桶以 ACK 周期为粒度结算：
+// 每次 onACK 按桶内余量决定下一周期的发送间隔
+class RateCC : public ReportingCC {
+    double targetBps;
+    double currentBps;
+    double burstBytes;
+    double tokens = 0;  // 字节，负值表示超发
+
+    std::atomic<uint64_t> sentPkts{0};  // onPktSent 在发送线程，onACK 在接收线程
+    uint64_t lastSent = 0;
+    uint64_t epochSent = 0;
+    uint64_t epochLost = 0;
+    uint64_t totalLost = 0;
+    uint64_t backoffs = 0;
+    uint64_t timeouts = 0;
+    double lastEpochLoss = 0;
+
+    std::chrono::steady_clock::time_point lastTick;
+    std::chrono::steady_clock::time_point epochStart;
+
+    double steadyPeriod() const {
+        return m_iMSS * 8.0 / currentBps * 1e6;
     }
 
-    virtual CCCVirtualFactory* clone() override {
-        return new SimpleCCFactory;
+    void backoff() {
+        currentBps = std::max(targetBps * RATE_CC_MIN_FRACTION, currentBps * RATE_CC_BACKOFF);
+        backoffs++;
+    }
+
+public:
+    RateCC(double bps, double burst)
+        : targetBps(bps), currentBps(bps), burstBytes(burst) {
+    }
+
+    virtual void init() override {
+        lastTick = epochStart = std::chrono::steady_clock::now();
+        tokens = burstBytes;
+        m_dPktSndPeriod = steadyPeriod() / RATE_CC_BURST_SPEEDUP;
+        m_dCWndSize = RATE_CC_MIN_CWND;
+    }
+
+    virtual void onPktSent(const CPacket *) override {
+        sentPkts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    virtual void onLoss(const int32_t *losslist, int size) override {
+        // 丢包列表中最高位置 1 的项表示区间起点，后随区间终点
+        uint64_t lost = 0;
+        for (int i = 0; i < size; ++i) {
+            if ((losslist[i] & 0x80000000) && i + 1 < size) {
+                lost += seqDiff(losslist[i + 1], losslist[i] & 0x7FFFFFFF) + 1;
+                ++i;
+            } else {
+                lost++;
+            }
+        }
+        epochLost += lost;
+        totalLost += lost;
+    }
+
+    virtual void onTimeout() override {
+        timeouts++;
+        backoff();
+        m_dPktSndPeriod = capPeriod(steadyPeriod());
+    }
+
+    virtual void onACK(int32_t) override {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - lastTick).count();
+        lastTick = now;
+
+        uint64_t sent = sentPkts.load(std::memory_order_relaxed);
+        uint64_t delta = sent - lastSent;
+        lastSent = sent;
+        epochSent += delta;
+
+        // 令牌桶结算：补充 dt 内的配额，扣除实际发送量，上限为突发容量
+        tokens = std::min(burstBytes, tokens + currentBps / 8.0 * dt - static_cast<double>(delta) * m_iMSS);
+        tokens = std::max(tokens, -burstBytes);
+
+        // 丢包评估周期：至少 RATE_CC_EPOCH_MS，且覆盖若干个 RTT
+        double rttSec = m_iRTT > 0 ? m_iRTT / 1e6 : 0.0;
+        double epochSec = std::max(RATE_CC_EPOCH_MS / 1000.0, 4 * rttSec);
+        if (std::chrono::duration<double>(now - epochStart).count() >= epochSec && epochSent > 0) {
+            lastEpochLoss = static_cast<double>(epochLost) / epochSent;
+            if (lastEpochLoss > RATE_CC_LOSS_THRESHOLD) {
+                backoff();
+            } else if (currentBps < targetBps) {
+                currentBps = std::min(targetBps, currentBps + targetBps * RATE_CC_RECOVER_STEP);
+            }
+            epochSent = epochLost = 0;
+            epochStart = now;
+        }
+
+        // 下一周期：桶内有余量时加速发送（至多 RATE_CC_BURST_SPEEDUP 倍），超发时放慢
+        double tick = std::max(dt, 0.001);
+        double bytesNext = std::max(currentBps / 8.0 * tick + tokens, currentBps / 8.0 * tick * 0.5);
+        double ratePkts = bytesNext / m_iMSS / tick;
+        m_dPktSndPeriod = capPeriod(std::max(1e6 / ratePkts, steadyPeriod() / RATE_CC_BURST_SPEEDUP));
+
+        // 窗口只需覆盖 2×BDP 加突发量，不作为限速手段
+        double bdpPkts = currentBps / 8.0 * rttSec / m_iMSS;
+        m_dCWndSize = std::max(RATE_CC_MIN_CWND, 2 * bdpPkts + burstBytes / m_iMSS);
+
+        publish(json::object({
+            {"algorithm", "rate"},
+            {"target_mbps", targetBps / 1e6},
+            {"current_mbps", currentBps / 1e6},
+            {"burst_bytes", burstBytes},
+            {"tokens_bytes", tokens},
+            {"pkt_snd_period_us", m_dPktSndPeriod},
+            {"cwnd_pkts", m_dCWndSize},
+            {"loss_threshold", RATE_CC_LOSS_THRESHOLD},
+            {"last_epoch_loss", lastEpochLoss},
+            {"lost_pkts", totalLost},
+            {"backoffs", backoffs},
+            {"timeouts", timeouts}
+        }));
+    }
+};
+
+// BBR 风格的基于模型的拥塞控制：用交付速率的窗口最大值估计瓶颈带宽，
+// 用 RTT 的窗口最小值估计传播时延，按 pacing_gain × 带宽定速、按 cwnd_gain × BDP 限制在途量。
+// 随机丢包不作为拥塞信号，只做统计
+//
+// 状态机：STARTUP（带宽连续 3 轮增长不足 25% 即认为管道已满）→ DRAIN（在途量降到 BDP）
+// → PROBE_BW（每个 min RTT 轮换 1.25/0.75/1×6 增益）；min RTT 10 秒未刷新时进入 PROBE_RTT
+class BBRCC : public ReportingCC {
+    enum Mode { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+    Mode mode = STARTUP;
+    double pacingGain = BBR_HIGH_GAIN;
+    double cwndGain = BBR_HIGH_GAIN;
+
+    // 瓶颈带宽（包/秒）的窗口最大值：按轮次记录样本，保留最近 BBR_BW_WINDOW_ROUNDS 轮
+    std::list<std::pair<uint64_t, double>> bwSamples;
+    double btlBw = 0;
+    double lastDeliveryRate = 0;
+
+    // 最小 RTT（微秒）及其刷新时间
+    double minRtt = 0;
+    std::chrono::steady_clock::time_point minRttStamp;
+
+    // 轮次：当累计确认越过本轮开始时的发送序号，即过去了一个 RTT
+    uint64_t rounds = 0;
+    int32_t roundEndSeq = 0;
+    int32_t lastAck = 0;
+    bool haveAck = false;
+    std::chrono::steady_clock::time_point lastAckTime;
+
+    // STARTUP 满管道检测
+    double fullBw = 0;
+    int fullBwRounds = 0;
+    bool fullBwReached = false;
+
+    // PROBE_BW 增益轮换与 PROBE_RTT
+    int cycleIndex = 0;
+    std::chrono::steady_clock::time_point cycleStamp;
+    std::chrono::steady_clock::time_point probeRttDone;
+    Mode modeBeforeProbeRtt = PROBE_BW;
+    uint64_t probeRttCount = 0;
+
+    std::atomic<uint64_t> sentPkts{0};
+    uint64_t lostPkts = 0;
+    uint64_t timeouts = 0;
+
+    static const char *modeName(Mode m) {
+        switch (m) {
+            case STARTUP: return "startup";
+            case DRAIN: return "drain";
+            case PROBE_BW: return "probe_bw";
+            default: return "probe_rtt";
+        }
+    }
+
+    double bdpPkts() const {
+        return btlBw * minRtt / 1e6;
+    }
+
+    void updateBw(double sample) {
+        bwSamples.emplace_back(rounds, sample);
+        while (!bwSamples.empty() && bwSamples.front().first + BBR_BW_WINDOW_ROUNDS < rounds) {
+            bwSamples.pop_front();
+        }
+        btlBw = 0;
+        for (const auto &s : bwSamples) btlBw = std::max(btlBw, s.second);
+    }
+
+    void enterProbeBw(std::chrono::steady_clock::time_point now) {
+        mode = PROBE_BW;
+        cwndGain = BBR_CWND_GAIN;
+        // 从非 0.75 的相位随机起步，避免多条流同步探测
+        cycleIndex = static_cast<int>(sentPkts.load(std::memory_order_relaxed) % 7);
+        if (cycleIndex >= 1) cycleIndex++;
+        pacingGain = BBR_CYCLE_GAINS[cycleIndex];
+        cycleStamp = now;
+    }
+
+    void applyControls() {
+        if (btlBw <= 0 || minRtt <= 0) {
+            return;
+        }
+        m_dPktSndPeriod = capPeriod(1e6 / (pacingGain * btlBw));
+        double cwnd = (mode == PROBE_RTT) ? BBR_MIN_CWND : std::max(BBR_MIN_CWND, cwndGain * bdpPkts());
+        m_dCWndSize = cwnd;
+    }
+
+public:
+    virtual void init() override {
+        auto now = std::chrono::steady_clock::now();
+        minRttStamp = cycleStamp = lastAckTime = probeRttDone = now;
+        roundEndSeq = m_iSndCurrSeqNo;
+        // 尚无带宽样本：以初始窗口起步，发送间隔交给 UDT 默认值
+        m_dCWndSize = BBR_INITIAL_CWND;
+        m_dPktSndPeriod = 1.0;
+    }
+
+    virtual void onPktSent(const CPacket *) override {
+        sentPkts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    virtual void onLoss(const int32_t *losslist, int size) override {
+        for (int i = 0; i < size; ++i) {
+            if ((losslist[i] & 0x80000000) && i + 1 < size) {
+                lostPkts += seqDiff(losslist[i + 1], losslist[i] & 0x7FFFFFFF) + 1;
+                ++i;
+            } else {
+                lostPkts++;
+            }
+        }
+    }
+
+    virtual void onTimeout() override {
+        // 超时说明模型失效：保留带宽估计，但收缩窗口，等待新的 ACK 重建
+        timeouts++;
+        m_dCWndSize = BBR_MIN_CWND;
+    }
+
+    virtual void onACK(int32_t ack) override {
+        auto now = std::chrono::steady_clock::now();
+
+        // 1. RTT：UDT 通过 ACK/ACK2 测得的 RTT，取 10 秒窗口最小值
+        if (m_iRTT > 0 && (minRtt <= 0 || m_iRTT <= minRtt ||
+                           now - minRttStamp > std::chrono::milliseconds(BBR_MIN_RTT_WINDOW_MS))) {
+            if (mode != PROBE_RTT && minRtt > 0 && m_iRTT > minRtt) {
+                // min RTT 过期：进入 PROBE_RTT，短暂排空队列以重新测量
+                modeBeforeProbeRtt = mode;
+                mode = PROBE_RTT;
+                pacingGain = 1.0;
+                probeRttDone = now + std::chrono::milliseconds(BBR_PROBE_RTT_MS);
+                probeRttCount++;
+            }
+            minRtt = m_iRTT;
+            minRttStamp = now;
+        }
+
+        // 2. 交付速率：两次累计确认之间新确认的包数 / 时间
+        if (!haveAck) {
+            haveAck = true;
+            lastAck = ack;
+            lastAckTime = now;
+            return;
+        }
+        int32_t delivered = seqDiff(ack, lastAck);
+        double dt = std::chrono::duration<double>(now - lastAckTime).count();
+        if (delivered <= 0 || dt <= 0) {
+            return;
+        }
+        lastAck = ack;
+        lastAckTime = now;
+        lastDeliveryRate = delivered / dt;
+
+        bool roundStart = false;
+        if (seqDiff(ack, roundEndSeq) > 0) {
+            rounds++;
+            roundEndSeq = m_iSndCurrSeqNo;
+            roundStart = true;
+        }
+        updateBw(lastDeliveryRate);
+
+        // 3. 状态机
+        if (mode == STARTUP && roundStart) {
+            if (btlBw >= fullBw * BBR_FULL_BW_GROWTH) {
+                fullBw = btlBw;
+                fullBwRounds = 0;
+            } else if (++fullBwRounds >= BBR_FULL_BW_ROUNDS) {
+                fullBwReached = true;
+                mode = DRAIN;
+                pacingGain = 1.0 / BBR_HIGH_GAIN;
+                cwndGain = BBR_HIGH_GAIN;
+            }
+        }
+
+        int32_t inflight = seqDiff(m_iSndCurrSeqNo, ack);
+        if (mode == DRAIN && inflight <= bdpPkts()) {
+            enterProbeBw(now);
+        }
+
+        if (mode == PROBE_BW && minRtt > 0 &&
+            now - cycleStamp > std::chrono::microseconds(static_cast<int64_t>(minRtt))) {
+            cycleIndex = (cycleIndex + 1) % BBR_CYCLE_LEN;
+            pacingGain = BBR_CYCLE_GAINS[cycleIndex];
+            cycleStamp = now;
+        }
+
+        if (mode == PROBE_RTT && now >= probeRttDone) {
+            if (fullBwReached) {
+                enterProbeBw(now);
+            } else {
+                mode = modeBeforeProbeRtt;
+                pacingGain = cwndGain = BBR_HIGH_GAIN;
+            }
+        }
+
+        applyControls();
+
+        publish(json::object({
+            {"algorithm", "bbr"},
+            {"mode", modeName(mode)},
+            {"btl_bw_mbps", btlBw * m_iMSS * 8 / 1e6},
+            {"delivery_rate_mbps", lastDeliveryRate * m_iMSS * 8 / 1e6},
+            {"min_rtt_ms", minRtt / 1000.0},
+            {"bdp_pkts", bdpPkts()},
+            {"inflight_pkts", inflight},
+            {"pacing_gain", pacingGain},
+            {"cwnd_gain", cwndGain},
+            {"pkt_snd_period_us", m_dPktSndPeriod},
+            {"cwnd_pkts", m_dCWndSize},
+            {"rounds", rounds},
+            {"full_bw_reached", fullBwReached},
+            {"probe_rtt_count", probeRttCount},
+            {"lost_pkts", lostPkts},
+            {"timeouts", timeouts}
+        }));
+    }
+};
+
+// LEDBAT 风格的让路型（scavenger）拥塞控制：以 RTT 窗口最小值为基础时延，
+// 排队时延 = 当前 RTT - 基础时延，目标是只额外占用 targetMs 的排队；
+// 超过目标时按偏离比例乘性收缩窗口，交互流量一排队就主动让出带宽，空闲时再占满
+class ScavengerCC : public ReportingCC {
+    double targetUs;
+
+    // 基础时延：每分钟一个最小值桶，保留 LEDBAT_BASE_HISTORY 个
+    std::list<double> baseHistory;
+    std::chrono::steady_clock::time_point bucketStart;
+    // 当前时延：最近 LEDBAT_CURRENT_FILTER 个样本取最小，滤掉单次抖动
+    std::list<double> currentSamples;
+
+    double cwnd = LEDBAT_MIN_CWND;
+    double queuingUs = 0;
+    bool slowStart = true;  // 参照 LEDBAT++：起步阶段按确认量翻倍，排队或丢包即退出
+    int32_t lastAck = 0;
+    bool haveAck = false;
+    std::chrono::steady_clock::time_point lastLossCut;
+
+    // 让出比例统计与链路容量估计
+    uint64_t ackEvents = 0;
+    uint64_t yieldEvents = 0;
+    uint64_t deliveredPkts = 0;
+    double maxCapacity = 0;  // 接收端报告的链路容量（包/秒）最大值
+    std::chrono::steady_clock::time_point startTime;
+
+    std::atomic<uint64_t> sentPkts{0};
+    uint64_t lossEvents = 0;
+    uint64_t timeouts = 0;
+
+    double baseDelay() const {
+        double base = 0;
+        for (double d : baseHistory) {
+            if (base <= 0 || d < base) base = d;
+        }
+        return base;
+    }
+
+    double currentDelay() const {
+        double cur = 0;
+        for (double d : currentSamples) {
+            if (cur <= 0 || d < cur) cur = d;
+        }
+        return cur;
+    }
+
+    void addDelaySample(double rttUs, std::chrono::steady_clock::time_point now) {
+        currentSamples.push_back(rttUs);
+        if (currentSamples.size() > LEDBAT_CURRENT_FILTER) currentSamples.pop_front();
+
+        if (baseHistory.empty() || now - bucketStart > std::chrono::seconds(60)) {
+            baseHistory.push_back(rttUs);
+            bucketStart = now;
+            if (baseHistory.size() > LEDBAT_BASE_HISTORY) baseHistory.pop_front();
+        } else if (rttUs < baseHistory.back()) {
+            baseHistory.back() = rttUs;
+        }
+    }
+
+    void applyControls() {
+        // UDT 需要发送间隔：按 cwnd / RTT 匀速发出，避免整窗突发自己制造排队
+        double rtt = std::max(currentDelay(), 1000.0);
+        m_dCWndSize = cwnd;
+        m_dPktSndPeriod = capPeriod(std::max(1.0, rtt / cwnd));
+    }
+
+public:
+    explicit ScavengerCC(double targetMs) : targetUs(targetMs * 1000.0) {
+    }
+
+    virtual void init() override {
+        auto now = std::chrono::steady_clock::now();
+        bucketStart = lastLossCut = startTime = now;
+        cwnd = LEDBAT_INITIAL_CWND;
+        m_dCWndSize = cwnd;
+        m_dPktSndPeriod = 1.0;
+    }
+
+    virtual void onPktSent(const CPacket *) override {
+        sentPkts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    virtual void onLoss(const int32_t *, int) override {
+        // 每个 RTT 至多减半一次
+        auto now = std::chrono::steady_clock::now();
+        double rtt = std::max(currentDelay(), 1000.0);
+        if (now - lastLossCut > std::chrono::microseconds(static_cast<int64_t>(rtt))) {
+            slowStart = false;
+            cwnd = std::max(LEDBAT_MIN_CWND, cwnd / 2);
+            lastLossCut = now;
+            lossEvents++;
+            applyControls();
+        }
+    }
+
+    virtual void onTimeout() override {
+        timeouts++;
+        slowStart = false;
+        cwnd = LEDBAT_MIN_CWND;
+        applyControls();
+    }
+
+    virtual void onACK(int32_t ack) override {
+        auto now = std::chrono::steady_clock::now();
+        if (!haveAck) {
+            haveAck = true;
+            lastAck = ack;
+            return;
+        }
+        int32_t acked = seqDiff(ack, lastAck);
+        if (acked <= 0) {
+            return;
+        }
+        lastAck = ack;
+        deliveredPkts += acked;
+        if (m_iBandwidth > 0) maxCapacity = std::max(maxCapacity, static_cast<double>(m_iBandwidth));
+
+        // UDT 提供的 RTT 即时延样本（单向时延不可得，以 RTT 代替）
+        if (m_iRTT > 0) {
+            addDelaySample(m_iRTT, now);
+        }
+        queuingUs = std::max(0.0, currentDelay() - baseDelay());
+
+        // 低于目标：cwnd += GAIN × off_target × acked / cwnd（每 RTT 约 +1 包）
+        double offTarget = (targetUs - queuingUs) / targetUs;
+        ackEvents++;
+        if (offTarget < 0) yieldEvents++;
+        if (slowStart && queuingUs > targetUs * LEDBAT_SLOW_START_EXIT) {
+            slowStart = false;
+        }
+        if (slowStart) {
+            cwnd += acked;
+        } else if (offTarget >= 0) {
+            cwnd += LEDBAT_GAIN * offTarget * acked / cwnd;
+        } else {
+            // 超出目标时按 LEDBAT++ 乘性收缩：每个 RTT 约缩小 off_target × cwnd，至多减半
+            cwnd += std::max(offTarget, -0.5) * acked;
+        }
+
+        // 不允许窗口远超实际在途量（应用受限时不虚增）
+        int32_t inflight = seqDiff(m_iSndCurrSeqNo, ack);
+        cwnd = std::min(cwnd, inflight + LEDBAT_ALLOWED_INCREASE + acked);
+        cwnd = std::max(cwnd, LEDBAT_MIN_CWND);
+        applyControls();
+
+        double elapsed = std::chrono::duration<double>(now - startTime).count();
+        double avgRate = elapsed > 0 ? deliveredPkts / elapsed : 0.0;
+        publish(json::object({
+            {"algorithm", "scavenger"},
+            {"slow_start", slowStart},
+            {"target_delay_ms", targetUs / 1000.0},
+            {"base_delay_ms", baseDelay() / 1000.0},
+            {"current_delay_ms", currentDelay() / 1000.0},
+            {"queuing_delay_ms", queuingUs / 1000.0},
+            {"cwnd_pkts", cwnd},
+            {"pkt_snd_period_us", m_dPktSndPeriod},
+            {"yield_ratio", ackEvents > 0 ? static_cast<double>(yieldEvents) / ackEvents : 0.0},
+            {"avg_rate_mbps", avgRate * m_iMSS * 8 / 1e6},
+            {"link_capacity_mbps", maxCapacity * m_iMSS * 8 / 1e6},
+            {"loss_events", lossEvents},
+            {"timeouts", timeouts}
+        }));
     }
 };
 
 // --- 网络分析工具类 ---
 class NetworkStats {
 public:
-    // 将 UDT TRACEINFO 转换为详细 JSON
-    static json snapshot(UDT::TRACEINFO &perf, double duration, uint64_t totalBytes) {
+    // 将 UDT TRACEINFO 转换为详细 JSON（sending 为发送端视角：瞬时速率取发送速率）
+    static json snapshot(UDT::TRACEINFO &perf, double duration, uint64_t totalBytes, bool sending = false) {
         json j;
 
         // 1. 速率统计
         double avgSpeedMbps = duration > 0 ? (totalBytes * 8.0 / 1000000.0) / duration : 0.0;
         j["throughput"] = json::object({
             {"avg_mbps", avgSpeedMbps},
-            {"inst_mbps", perf.mbpsRecvRate},
+            {"inst_mbps", sending ? perf.mbpsSendRate : perf.mbpsRecvRate},
             {"est_bandwidth_mbps", perf.mbpsBandwidth}
         });
 
@@ -241,10 +1075,41 @@ public:
             health = "suboptimal";
         }
 
-        // 2. 瓶颈识别
-        if (availRcvBuf < (configWin * 0.1) && configWin > 0) {
+        // 1b. 内核截断了 UDP 缓冲（rmem_max / wmem_max 过小）
+        if (stats.contains("buffers")) {
+            for (auto &side : stats["buffers"].items()) {
+                const json &b = side.value();
+                if (!b.is_object() || !b.value("clamped", false)) continue;
+                advice.push_back("配置警告: " + side.key() + " 端 UDP 缓冲被内核截断 (请求 " +
+                                 std::to_string(b.value("requested_bytes", 0)) + "，实际接收 " +
+                                 std::to_string(b.value("udp_rcv_effective_bytes", 0)) +
+                                 ")。执行 sysctl -w net.core.rmem_max=" +
+                                 std::to_string(b.value("requested_bytes", 0)) + " 及 wmem_max。");
+                health = "suboptimal";
+            }
+        }
+
+        // 2. 瓶颈识别：有分阶段耗时时按各阶段占用定位，否则按接收缓冲余量推测
+        if (stats.contains("stages") && stats["stages"].is_object()) {
+            json bottleneck = stageBottleneck(stats["stages"]);
+            report["stages"]["bottleneck"] = bottleneck;
+            advice.push_back(stageAdvice(bottleneck, stats["stages"]));
+        } else if (availRcvBuf < (configWin * 0.1) && configWin > 0) {
             advice.push_back("可能瓶颈: 接收缓冲区快满了。考虑增大窗口大小或检查磁盘IO。");
         }
+        if (stats.contains("disk") && stats["disk"].value("windows", 0) > 0) {
+            const json &disk = stats["disk"];
+            uint64_t windows = disk.value("windows", 0);
+            uint64_t limited = disk.value("disk_limited_windows", 0);
+            if (limited * 2 > windows) {
+                std::ostringstream oss;
+                oss << std::fixed << std::setprecision(0) << "磁盘瓶颈: 接收端持续写速率约 "
+                        << disk.value("sustained_mbps", 0.0) << " Mbps，慢于网络。"
+                        << (disk.value("hints_enabled", false) ? "发送端已按写盘速率定速。"
+                                                               : "可去掉 --no-disk-hint 让发送端按写盘速率定速。");
+                advice.push_back(oss.str());
+            }
+        }
 
         // 3. 链路质量
         if (lossRate > 0.01) {
@@ -259,6 +1124,32 @@ public:
             advice.push_back("网络质量: 优秀。如果支持巨型帧，可尝试 --mss 8900。");
         }
 
+        // 4. 线路开销（发送端并入后才有 accounting）
+        if (stats.contains("accounting")) {
+            const json &acc = stats["accounting"];
+            double eff = acc.value("efficiency", 1.0);
+            if (eff > 0 && eff < ACCOUNTING_LOW_EFFICIENCY) {
+                std::ostringstream oss;
+                oss << std::fixed << std::setprecision(1) << "线路开销: 文件字节只占线路字节的 " << eff * 100
+                        << "%（重传占发送包 " << acc.value("retrans_overhead", 0.0) * 100
+                        << "%），有效吞吐 " << acc.value("goodput_mbps", 0.0) << " Mbps / 线路 "
+                        << acc.value("wire_mbps", 0.0) << " Mbps。";
+                advice.push_back(oss.str());
+            }
+        }
+
+        // 5. CPU 开销：某个线程占满一个核
+        if (stats.contains("resources")) {
+            std::string cpu = resourceAdvice(stats["resources"]);
+            if (!cpu.empty()) advice.push_back(cpu);
+        }
+
+        // 6. 与该对端的历史基线相比是否回退（本地传输历史并入后才有 history）
+        if (stats.contains("history")) {
+            std::string regression = historyAdvice(stats["history"]);
+            if (!regression.empty()) advice.push_back(regression);
+        }
+
         report["analysis"] = json::object({
             {"network_health", health},
             {"bdp_bytes_est", bdp},
@@ -267,195 +1158,6882 @@ public:
 
         return report;
     }
-};
 
-// --- 配置参数 ---
-struct Config {
-    std::string mode;
-    std::string ip;
-    int port;
-    std::string path;
-    int mss = DEFAULT_MSS;
-    int window = DEFAULT_WINDOW;
-    bool detailed = false;
-    bool no_cc = false;  // 新增：是否关闭拥塞控制
+    // 阶段归属的资源：读写盘与哈希是本端工作，send / recv 的阻塞时间是在等网络（或对端）
+    static std::string stageResource(const std::string &side, const std::string &stage) {
+        if (stage == "read") return "source_disk";
+        if (stage == "write") return "destination_disk";
+        if (stage == "hash") return side + "_cpu";
+        return "network";
+    }
 
-    static Config parse(int argc, char *argv[]) {
-        Config c;
-        if (argc < 2) {
-            printUsage();
-            throw std::runtime_error("No command provided");
+    // 按各阶段 busy_pct 定位瓶颈：单个读写 / 哈希阶段占用过半即为瓶颈；
+    // 否则同一线程上的读写与哈希合计接近饱和（发送端读线程：read + hash；接收线程：hash + write）也算本端瓶颈；
+    // 都有余量时时间主要花在 send / recv 阻塞上，瓶颈在网络路径或拥塞控制速率
+    static json stageBottleneck(const json &stages) {
+        std::string stageSide, stage, threadSide, threadTop, waitSide, waitStage;
+        double stageBusy = 0, threadBusy = 0, waitBusy = 0;
+
+        for (auto &side : stages.items()) {
+            if (side.key() == "bottleneck" || !side.value().is_object()) continue;
+            double work = 0, top = 0;
+            std::string topStage;
+            for (auto &st : side.value().items()) {
+                if (!st.value().is_object()) continue;
+                double busy = st.value().value("busy_pct", 0.0) / 100;
+                if (st.key() == "send" || st.key() == "recv") {
+                    if (busy > waitBusy) {
+                        waitBusy = busy;
+                        waitSide = side.key();
+                        waitStage = st.key();
+                    }
+                    continue;
+                }
+                work += busy;
+                if (busy > top) {
+                    top = busy;
+                    topStage = st.key();
+                }
+                if (busy > stageBusy) {
+                    stageBusy = busy;
+                    stageSide = side.key();
+                    stage = st.key();
+                }
+            }
+            if (work > threadBusy) {
+                threadBusy = work;
+                threadSide = side.key();
+                threadTop = topStage;
+            }
         }
 
-        c.mode = argv[1];
+        auto verdict = [](const std::string &side, const std::string &name, double busy, const char *basis) {
+            return json::object({
+                {"side", side},
+                {"stage", name},
+                {"resource", stageResource(side, name)},
+                {"busy_pct", busy * 100},
+                {"basis", basis}
+            });
+        };
+        if (stageBusy >= STAGE_BOTTLENECK_BUSY) {
+            return verdict(stageSide, stage, stageBusy, "stage");
+        }
+        if (threadBusy >= STAGE_THREAD_SATURATED) {
+            return verdict(threadSide, threadTop, threadBusy, "thread");
+        }
+        return verdict(waitSide, waitStage.empty() ? "network" : waitStage, waitBusy, "wait");
+    }
 
-        int idx = 2;
-        if (c.mode == "send") {
-            if (argc < 5) {
-                printUsage();
-                throw std::runtime_error("Invalid send arguments");
-            }
-            c.ip = argv[idx++];
-            c.port = std::stoi(argv[idx++]);
-            c.path = argv[idx++];
-        } else if (c.mode == "recv") {
-            if (argc < 4) {
-                printUsage();
-                throw std::runtime_error("Invalid recv arguments");
-            }
-            c.port = std::stoi(argv[idx++]);
-            c.path = argv[idx++];
+    static std::string stageLabel(const std::string &stage) {
+        if (stage == "read") return "读盘";
+        if (stage == "write") return "写盘";
+        if (stage == "hash") return "哈希";
+        if (stage == "send") return "UDT::send";
+        if (stage == "recv") return "UDT::recv";
+        return stage;
+    }
+
+    static std::string stageAdvice(const json &bottleneck, const json &stages) {
+        std::string side = bottleneck.value("side", "");
+        std::string stage = bottleneck.value("stage", "");
+        std::string sideName = side == "sender" ? "发送端" : "接收端";
+        json st = stages.contains(side) && stages[side].contains(stage) ? stages[side][stage] : json::object();
+
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(0) << "阶段瓶颈: ";
+        std::string basis = bottleneck.value("basis", "");
+        if (basis == "wait") {
+            oss << "读写盘与哈希均有余量，" << sideName << " " << bottleneck.value("busy_pct", 0.0)
+                    << "% 的时间阻塞在 " << stageLabel(stage) << " 上，瓶颈在"
+                    << (stages.contains("sender") && stages.contains("receiver") ? "网络路径或拥塞控制速率。"
+                                                                                 : "网络路径或对端。");
+            return oss.str();
+        }
+        if (basis == "thread") {
+            oss << sideName << "处理线程上读写盘与哈希合计占 " << bottleneck.value("busy_pct", 0.0)
+                    << "%（" << stageLabel(stage) << "最多），本端处理能力是瓶颈。";
+            return oss.str();
+        }
+        oss << sideName << stageLabel(stage) << "占墙钟时间 " << bottleneck.value("busy_pct", 0.0) << "%（p99 "
+                << std::setprecision(1) << st.value("p99_us", 0.0) / 1000 << " ms，忙时 "
+                << std::setprecision(0) << st.value("busy_mbps", 0.0) << " Mbps），";
+        if (stage == "read") {
+            oss << "源端存储是瓶颈，网络仍有余量。";
+        } else if (stage == "write") {
+            oss << "目标端存储是瓶颈。可换更快的磁盘，或保留写盘提示让发送端按写盘速率定速。";
         } else {
-            printUsage();
-            throw std::runtime_error("Unknown mode: " + c.mode);
+            oss << "BLAKE3 哈希占满 CPU，是瓶颈。" << hashDetail(stages[side], st);
         }
+        return oss.str();
+    }
 
-        // Parse optional flags
-        for (; idx < argc; ++idx) {
-            std::string arg = argv[idx];
-            if (arg == "--mss" && idx + 1 < argc) {
-                c.mss = std::stoi(argv[++idx]);
-                if (c.mss < 536 || c.mss > 8900) {
-                    throw std::runtime_error("MSS must be between 536 and 8900");
-                }
-            } else if (arg == "--window" && idx + 1 < argc) {
-                c.window = std::stoi(argv[++idx]);
-                if (c.window < 65536) {
-                    throw std::runtime_error("Window size must be at least 65536 bytes");
-                }
-                if (c.window > UDT_MAX_BUF) {
-                    c.window = UDT_MAX_BUF;
-                }
-            } else if (arg == "--detailed") {
-                c.detailed = true;
-            } else if (arg == "--no-cc") {  // 新增：关闭拥塞控制
-                c.no_cc = true;
+    // 哈希瓶颈的补充说明：有硬件计数器时按 IPC 区分计算 / 访存受限，并指出 BLAKE3 未用上宽 SIMD 的情况
+    static std::string hashDetail(const json &side, const json &hash) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(2);
+        if (hash.contains("counters") && hash["counters"].contains("ipc")) {
+            const json &c = hash["counters"];
+            double ipc = c.value("ipc", 0.0);
+            oss << "IPC " << ipc << "，每周期 " << c.value("bytes_per_cycle", 0.0) << " 字节，";
+            if (ipc < PERF_MEMORY_BOUND_IPC) {
+                oss << "偏访存受限（每 MB LLC 未命中 " << std::setprecision(0) << c.value("llc_misses_per_mb", 0.0)
+                        << "），读块大小不宜超过末级缓存。";
             } else {
-                throw std::runtime_error("Unknown option: " + arg);
+                oss << "偏计算受限，需要更快的 CPU 或更宽的 SIMD。";
             }
         }
+        std::string isa = side.contains("blake3") ? side["blake3"].value("isa", "") : "";
+        if (isa == "sse" || isa == "portable") {
+            oss << "BLAKE3 只用到 " << isa << " 路径，未用上 AVX2 / AVX-512。";
+        }
+        return oss.str();
+    }
 
-        return c;
+    // 各端线程中 CPU 占用最高的一个若占满一个核，给出建议；UDT 内部线程（收发包、ACK、定时器）单独说明
+    static std::string resourceAdvice(const json &resources) {
+        std::string side, role;
+        double top = 0;
+        for (auto &s : resources.items()) {
+            // 与其他传输并发时线程统计含别的会话，不据此归因
+            if (!s.value().is_object() || !s.value().contains("threads") ||
+                s.value().value("scope", "session") == "process") continue;
+            for (auto &t : s.value()["threads"].items()) {
+                double pct = t.value().value("max_thread_pct", 0.0);
+                if (pct > top) {
+                    top = pct;
+                    side = s.key();
+                    role = t.key();
+                }
+            }
+        }
+        if (top < RESOURCE_THREAD_SATURATED) {
+            return "";
+        }
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(0) << "CPU 开销: " << (side == "sender" ? "发送端" : "接收端");
+        if (role == "udt") {
+            oss << " UDT 内部线程占满一个核（" << top << "%），协议处理（收发包、ACK、定时器）是瓶颈；"
+                    << "可增大 --mss 减少每字节的包数。";
+        } else {
+            oss << " " << role << " 线程占满一个核（" << top << "%），本端处理线程是瓶颈。";
+        }
+        return oss.str();
     }
 
-    static void printUsage() {
-        std::cerr << "Usage:\n"
-                << "  hruft send <ip> <port> <filepath> [options]\n"
-                << "  hruft recv <port> <savepath> [options]\n\n"
-                << "Options:\n"
-                << "  --mss <value>      Maximum Segment Size (default: 1500)\n"
-                << "  --window <value>   Window size in bytes (default: "
-                << DEFAULT_WINDOW / (1024 * 1024) << "MB)\n"
-                << "  --detailed         Show detailed statistics\n"
-                << "  --no-cc            Disable congestion control (for direct connections)\n";  // 新增
+    // 把发送端 CPU / 内存开销并入 resources 段，按两端数据重新给出 CPU 开销建议
+    static bool mergeResources(json &report, const json &senderResources) {
+        if (!report.is_object() || !report.contains("meta") || senderResources.is_null()) {
+            return false;
+        }
+        report["resources"]["sender"] = senderResources;
+        if (report.contains("analysis") && report["analysis"].contains("advice")) {
+            json kept = json::array();
+            for (const auto &a : report["analysis"]["advice"]) {
+                if (!a.is_string() || a.get<std::string>().rfind("CPU 开销", 0) != 0) {
+                    kept.push_back(a);
+                }
+            }
+            std::string cpu = resourceAdvice(report["resources"]);
+            if (!cpu.empty()) kept.push_back(cpu);
+            report["analysis"]["advice"] = kept;
+        }
+        return true;
     }
-};
 
-// --- 辅助函数 ---
+    // 两端各自对照本地历史基线，取回退最多的一端给出建议；RTT 或重传率明显高于基线时指出变化所在，
+    // 都与以往相当时变化多半在主机一侧
+    static std::string historyAdvice(const json &history) {
+        std::string side;
+        double worst = 0;
+        for (auto &h : history.items()) {
+            if (!h.value().is_object() || !h.value().value("regression", false)) continue;
+            double change = h.value().value("change_pct", 0.0);
+            if (side.empty() || change < worst) {
+                worst = change;
+                side = h.key();
+            }
+        }
+        if (side.empty()) {
+            return "";
+        }
+
+        const json &base = history[side]["baseline"];
+        const json &cur = history[side]["current"];
+        double baseRtt = base.value("rtt_ms", 0.0), rtt = cur.value("rtt_ms", 0.0);
+        double baseRetrans = base.value("retrans_ratio", 0.0), retrans = cur.value("retrans_ratio", 0.0);
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << "历史基线: " << (side == "sender" ? "发送端" : "接收端")
+                << "本次有效吞吐 " << cur.value("goodput_mbps", 0.0) << " Mbps，比与该对端最近 "
+                << base.value("samples", 0) << " 次传输的中位数 " << base.value("goodput_mbps", 0.0) << " Mbps 慢 "
+                << std::setprecision(0) << -worst << "%。" << std::setprecision(2);
+        if (baseRtt > 0 && rtt > baseRtt * HISTORY_RTT_RISE) {
+            oss << "RTT 由 " << baseRtt << " ms 升到 " << rtt << " ms，路径变化或出现排队。";
+        } else if (retrans > baseRetrans * 2 && retrans - baseRetrans > HISTORY_RETRANS_RISE) {
+            oss << "重传率由 " << baseRetrans * 100 << "% 升到 " << retrans * 100 << "%，链路质量变差。";
+        } else {
+            oss << "RTT 与重传率与以往相当，变化多半在两端主机（对照阶段瓶颈与 CPU 开销）。";
+        }
+        return oss.str();
+    }
+
+    // 把一端对照本地传输历史的结果并入 history 段，按两端数据重新给出历史基线建议
+    static bool mergeHistory(json &report, const std::string &side, const json &comparison) {
+        if (!report.is_object() || !report.contains("analysis") || comparison.is_null()) {
+            return false;
+        }
+        report["history"][side] = comparison;
+        if (report["analysis"].contains("advice")) {
+            json kept = json::array();
+            for (const auto &a : report["analysis"]["advice"]) {
+                if (!a.is_string() || a.get<std::string>().rfind("历史基线", 0) != 0) {
+                    kept.push_back(a);
+                }
+            }
+            std::string regression = historyAdvice(report["history"]);
+            if (!regression.empty()) kept.push_back(regression);
+            report["analysis"]["advice"] = kept;
+        }
+        return true;
+    }
+
+    // 把发送端各阶段耗时并入 stages 段，按两端合并后的数据重新定位瓶颈并替换对应建议
+    static bool mergeStages(json &report, const json &senderStages) {
+        if (!report.is_object() || !report.contains("meta") || senderStages.is_null()) {
+            return false;
+        }
+        json &stages = report["stages"];
+        stages["sender"] = senderStages;
+        stages.erase("bottleneck");
+        json bottleneck = stageBottleneck(stages);
+        stages["bottleneck"] = bottleneck;
+
+        if (report.contains("analysis") && report["analysis"].contains("advice")) {
+            json kept = json::array();
+            for (const auto &a : report["analysis"]["advice"]) {
+                if (!a.is_string() || a.get<std::string>().rfind("阶段瓶颈", 0) != 0) {
+                    kept.push_back(a);
+                }
+            }
+            kept.push_back(stageAdvice(bottleneck, stages));
+            report["analysis"]["advice"] = kept;
+        }
+        return true;
+    }
+
+    // 发送端视角：本端快照加上发送阻塞（UDT::send 等待发送缓冲的时间）与 UDT 实际忙于发送的时间
+    static json senderView(UDT::TRACEINFO &perf, double duration, uint64_t totalBytes, const json &stages) {
+        json j = snapshot(perf, duration, totalBytes, true);
+        double blocked = 0;
+        if (stages.is_object() && stages.contains("send")) {
+            blocked = stages["send"].value("busy_pct", 0.0) / 100 * stages.value("wall_sec", 0.0);
+        }
+        j["stalls"] = json::object({
+            {"send_blocked_sec", blocked},
+            {"send_blocked_pct", duration > 0 ? std::min(100.0, blocked / duration * 100) : 0.0},
+            {"udt_sending_sec", perf.usSndDurationTotal / 1e6}
+        });
+        return j;
+    }
+
+    // 把发送端视角并入接收端报告：两端快照各自保留在 views 段；reliability 改用发送端的发送 / 丢包 / 重传计数
+    // （接收端看不到重传），新增 accounting 段对比有效吞吐（文件字节）与线路吞吐（含重传与包头），
+    // 然后按合并后的数据重新分析。mss 为 UDT 包大小（含 IP/UDP 头）
+    static bool mergeSender(json &report, const json &sender, int configMss, int configWin) {
+        if (!report.is_object() || !report.contains("meta") || sender.is_null()) {
+            return false;
+        }
+        json receiver = json::object();
+        for (const char *k : {"throughput", "latency", "reliability", "congestion", "buffer_health"}) {
+            if (report.contains(k)) receiver[k] = report[k];
+        }
+        report["views"] = json::object({{"sender", sender}, {"receiver", receiver}});
+
+        const json &sr = sender["reliability"];
+        int64_t sentPkts = sr.value("pkt_sent", static_cast<int64_t>(0));
+        int64_t retrans = sr.value("retrans_total", static_cast<int64_t>(0));
+        json &rel = report["reliability"];
+        rel["pkt_sent"] = sentPkts;
+        rel["pkt_loss_sent"] = sr.value("pkt_loss_sent", 0);
+        rel["retrans_total"] = retrans;
+        rel["retrans_ratio"] = sentPkts > 0 ? static_cast<double>(retrans) / sentPkts : 0.0;
+        report["throughput"]["send_inst_mbps"] = sender["throughput"].value("inst_mbps", 0.0);
+        report["latency"]["rtt_ms_sender"] = sender["latency"].value("rtt_ms", 0.0);
+
+        double duration = report["meta"].value("duration_sec", 0.0);
+        uint64_t payload = report["meta"].value("filesize", static_cast<uint64_t>(0));
+        uint64_t wire = static_cast<uint64_t>(sentPkts) * static_cast<uint64_t>(configMss);
+        report["accounting"] = json::object({
+            {"payload_bytes", payload},
+            {"wire_packets", sentPkts},
+            {"wire_bytes_est", wire},
+            {"retrans_packets", retrans},
+            {"goodput_mbps", duration > 0 ? payload * 8.0 / 1e6 / duration : 0.0},
+            {"wire_mbps", duration > 0 ? wire * 8.0 / 1e6 / duration : 0.0},
+            {"efficiency", wire > 0 ? std::min(1.0, static_cast<double>(payload) / wire) : 0.0},
+            {"retrans_overhead", sentPkts > 0 ? static_cast<double>(retrans) / sentPkts : 0.0}
+        });
+
+        report = analyze(report, configMss, configWin);
+        return true;
+    }
+
+    // 把发送端拥塞控制器状态并入报告的 congestion 段；让路型控制器另外给出实际占用份额：
+    // 平均吞吐 / 估计链路容量（优先用接收端报告，缺失时用控制器自己的估计）
+    static bool mergeController(json &report, const json &ccState) {
+        if (!report.is_object() || !report.contains("congestion") || ccState.is_null()) {
+            return false;
+        }
+        json &cong = report["congestion"];
+        cong["controller"] = ccState;
+
+        if (ccState.value("algorithm", "") != "scavenger") {
+            return true;
+        }
+
+        double achieved = 0, capacity = 0;
+        std::string source = "receiver";
+        if (report.contains("throughput")) {
+            achieved = report["throughput"].value("avg_mbps", 0.0);
+            capacity = report["throughput"].value("est_bandwidth_mbps", 0.0);
+        }
+        if (achieved <= 0 || capacity <= 0) {
+            achieved = ccState.value("avg_rate_mbps", 0.0);
+            capacity = ccState.value("link_capacity_mbps", 0.0);
+            source = "controller";
+        }
+        double share = capacity > 0 ? std::min(1.0, achieved / capacity) : 0.0;
+        cong["effective_share"] = json::object({
+            {"share", share},
+            {"achieved_mbps", achieved},
+            {"capacity_mbps", capacity},
+            {"yield_ratio", ccState.value("yield_ratio", 0.0)},
+            {"source", source}
+        });
+
+        if (report.contains("analysis") && report["analysis"].contains("advice")) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << "后台传输: 占用链路容量的 " << share * 100
+                    << "%，" << ccState.value("yield_ratio", 0.0) * 100 << "% 的时间因排队时延超标而让路。";
+            report["analysis"]["advice"].push_back(oss.str());
+        }
+        return true;
+    }
+
+    // 把发送端拥塞控制回调事件并入报告：RTT / 抖动分布写入 latency 段，ACK / 丢包 / 超时计数写入
+    // congestion 段；RTT 长尾明显或发生超时时给出建议
+    static bool mergeCcEvents(json &report, const json &cc) {
+        if (!report.is_object() || !report.contains("latency") || !report.contains("congestion") || cc.is_null()) {
+            return false;
+        }
+        const json &dist = cc["rtt_distribution"];
+        report["latency"]["rtt_distribution"] = dist;
+        report["latency"]["jitter"] = cc["jitter"];
+        report["congestion"]["events"] = cc["events"];
+        if (!report.contains("analysis") || !report["analysis"].contains("advice")) {
+            return true;
+        }
+
+        json &advice = report["analysis"]["advice"];
+        double p50 = dist.value("p50_ms", 0.0);
+        double p99 = dist.value("p99_ms", 0.0);
+        if (dist.value("samples", static_cast<uint64_t>(0)) >= CC_JITTER_MIN_SAMPLES && p50 > 0 &&
+            p99 > p50 * CC_JITTER_RATIO) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << "时延抖动: RTT p99 " << p99 << " ms 是 p50 " << p50
+                    << " ms 的 " << p99 / p50 << " 倍，路径上存在间歇性排队；需要让出带宽给交互流量时可用 --cc scavenger。";
+            advice.push_back(oss.str());
+        }
+        uint64_t timeouts = cc["events"].value("timeouts", static_cast<uint64_t>(0));
+        if (timeouts > 0) {
+            advice.push_back("拥塞控制: 发生 " + std::to_string(timeouts) +
+                             " 次重传超时，期间发送停顿；多见于突发丢包或路径短暂中断。");
+        }
+        return true;
+    }
+
+    // 把截止时间调度的计划 / 实际曲线并入报告；未按时完成时给出建议
+    static bool mergeDeadline(json &report, const json &schedule) {
+        if (!report.is_object() || schedule.is_null()) {
+            return false;
+        }
+        report["deadline"] = schedule;
+        if (!schedule.value("met", false) && report.contains("analysis") && report["analysis"].contains("advice")) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << "截止时间: 未能在 " << schedule.value("deadline", "")
+                    << " 前完成（" << -schedule.value("finish_margin_sec", 0.0) << " 秒超时，全速升级 "
+                    << schedule.value("escalations", 0) << " 次）。所需速率超出链路能力，需提前启动或放宽截止时间。";
+            report["analysis"]["advice"].push_back(oss.str());
+        }
+        return true;
+    }
+
+    // 把发送端在线调优的决策日志并入报告，并就结束时仍生效的调整给出建议
+    static bool mergeTuning(json &report, const json &tuning) {
+        if (!report.is_object() || tuning.is_null()) {
+            return false;
+        }
+        report["tuning"] = tuning;
+        if (!report.contains("analysis") || !report["analysis"].contains("advice")) {
+            return true;
+        }
+
+        json &advice = report["analysis"]["advice"];
+        const json &fin = tuning["final"];
+        double cap = fin.value("rate_cap_mbps", 0.0);
+        if (cap > 0) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(0) << "在线调优: 结束时速率上限为 " << cap
+                    << " Mbps（丢包突发或接收端缓冲饥饿），可考虑直接指定 --rate " << cap << "M。";
+            advice.push_back(oss.str());
+        }
+
+        uint64_t total = tuning.value("samples", 0);
+        uint64_t source = tuning["regimes"].value("source_backpressure", 0);
+        if (total > 0 && source * 2 > total) {
+            advice.push_back("在线调优: 超过一半的采样周期发送端在等待读盘，瓶颈在源端存储而非网络。");
+        }
+        return true;
+    }
+};
+
+// --- 配置参数 ---
+struct Config {
+    std::string mode;
+    std::string ip;
+    int port;
+    std::string path;
+    int mss = DEFAULT_MSS;
+    int window = DEFAULT_WINDOW;
+    bool detailed = false;
+    std::string cc;  // 拥塞控制: udt（默认）| rate | bbr | scavenger | none（SimpleCC，即 --no-cc）
+    int burst_kb = DEFAULT_BURST_KB;  // --cc rate 的令牌桶突发容量
+    double target_delay_ms = DEFAULT_TARGET_DELAY_MS;  // --cc scavenger 的目标排队时延
+    std::string remote_name;  // fetch: 服务端上的相对路径
+    int cache_mb = DEFAULT_CACHE_MB;  // serve: 块缓存上限 (MB)
+    std::string transport = "stream";  // 数据面: stream (SOCK_STREAM) | msg (SOCK_DGRAM 乱序消息) | udp (原生 UDP)
+    double rate_bps = 0;  // --rate，0 表示未指定
+    bool no_gso = false;  // udp 数据面：关闭 GSO/GRO 卸载
+    bool window_set = false;  // 显式给出 --window 时不做传输前探测
+    bool mss_set = false;  // 显式给出 --mss 时不做路径 MTU 探测
+    bool pmtu = true;  // --no-pmtu 关闭路径 MTU 探测
+    bool probe = false;  // --probe 开启传输前探测（多一次连接与 4MB 数据列车，适合大文件）
+    bool tune = false;  // --tune 开启发送端在线调优
+    bool disk_hint = true;  // --no-disk-hint 关闭接收端写盘速率提示
+    int tune_interval_ms = DEFAULT_TUNE_INTERVAL_MS;
+    std::time_t deadline = 0;  // --deadline，0 表示尽快传完
+    std::string jobs_file;  // send --jobs：同一进程内并发执行的作业清单
+    int block_size = DEFAULT_BLOCK_SIZE;  // --block-size：发送端读块 / 接收端写块大小
+    bool block_auto = false;  // --block-size auto：按调用开销与队列占用自适应
+    int mem_limit_mb = DEFAULT_MEM_LIMIT_MB;  // --mem-limit：块缓冲总内存上限
+    std::string stats_out;  // --stats-out：按周期写 JSONL 时间序列
+    int stats_interval_ms = DEFAULT_STATS_INTERVAL_MS;
+    std::string progress = "human";  // --progress：human（单行刷新）| json（JSON 行）| none；作业模式下各会话为 none
+    int progress_fd = -1;  // --progress-fd：进度写到该文件描述符，默认标准输出
+    int progress_interval_ms = DEFAULT_PROGRESS_INTERVAL_MS;
+    bool perf_counters = false;  // --perf-counters：各阶段累计 cycles / instructions / LLC 未命中 / 上下文切换
+    std::string trace;  // --trace：数据面各阶段调用与速率 / RTT / 缓冲占用写成 Chrome 轨迹 JSON
+    std::string cc_trace;  // --cc-trace：发送端拥塞控制事件（ACK / 丢包 / 超时）写成 JSONL
+    int metrics_port = 0;  // --metrics：在 127.0.0.1 上提供 Prometheus 抓取端点，0 表示关闭
+    std::string history_file;  // --history：本地传输历史文件，默认 TransferHistory::defaultFile()
+    bool record_history = true;  // --no-history：不记录本次传输，也不对照历史基线
+
+    static Config parse(int argc, char *argv[]) {
+        Config c;
+        if (argc < 2) {
+            printUsage();
+            throw std::runtime_error("No command provided");
+        }
+
+        c.mode = argv[1];
+
+        int idx = 2;
+        if (c.mode == "send" && argc >= 4 && std::string(argv[2]) == "--jobs") {
+            c.jobs_file = argv[3];
+            idx = 4;
+        } else if (c.mode == "send") {
+            if (argc < 5) {
+                printUsage();
+                throw std::runtime_error("Invalid send arguments");
+            }
+            c.ip = argv[idx++];
+            c.port = std::stoi(argv[idx++]);
+            c.path = argv[idx++];
+        } else if (c.mode == "recv") {
+            if (argc < 4) {
+                printUsage();
+                throw std::runtime_error("Invalid recv arguments");
+            }
+            c.port = std::stoi(argv[idx++]);
+            c.path = argv[idx++];
+        } else if (c.mode == "serve") {
+            if (argc < 4) {
+                printUsage();
+                throw std::runtime_error("Invalid serve arguments");
+            }
+            c.port = std::stoi(argv[idx++]);
+            c.path = argv[idx++];
+        } else if (c.mode == "fetch") {
+            if (argc < 6) {
+                printUsage();
+                throw std::runtime_error("Invalid fetch arguments");
+            }
+            c.ip = argv[idx++];
+            c.port = std::stoi(argv[idx++]);
+            c.remote_name = argv[idx++];
+            c.path = argv[idx++];
+        } else if (c.mode == "history") {
+            // 可选的对端主机：只看该对端
+            if (idx < argc && argv[idx][0] != '-') {
+                c.ip = argv[idx++];
+            }
+        } else {
+            printUsage();
+            throw std::runtime_error("Unknown mode: " + c.mode);
+        }
+
+        // Parse optional flags
+        for (; idx < argc; ++idx) {
+            std::string arg = argv[idx];
+            if (arg == "--mss" && idx + 1 < argc) {
+                c.mss = std::stoi(argv[++idx]);
+                c.mss_set = true;
+                if (c.mss < MIN_MSS || c.mss > MAX_MSS) {
+                    throw std::runtime_error("MSS must be between 536 and 8900");
+                }
+            } else if (arg == "--window" && idx + 1 < argc) {
+                c.window = std::stoi(argv[++idx]);
+                c.window_set = true;
+                if (c.window < MIN_WINDOW) {
+                    throw std::runtime_error("Window size must be at least 65536 bytes");
+                }
+                c.window = clampWindow(c.window);
+            } else if (arg == "--detailed") {
+                c.detailed = true;
+            } else if (arg == "--no-cc") {  // 新增：关闭拥塞控制
+                c.cc = "none";
+            } else if (arg == "--cc" && idx + 1 < argc) {
+                c.cc = argv[++idx];
+                if (c.cc != "udt" && c.cc != "rate" && c.cc != "bbr" && c.cc != "scavenger" && c.cc != "none") {
+                    throw std::runtime_error("Congestion control must be udt, rate, bbr, scavenger or none");
+                }
+            } else if (arg == "--target-delay" && idx + 1 < argc) {
+                c.target_delay_ms = std::stod(argv[++idx]);
+                if (c.target_delay_ms <= 0) {
+                    throw std::runtime_error("Target delay must be positive");
+                }
+            } else if (arg == "--burst" && idx + 1 < argc) {
+                c.burst_kb = std::stoi(argv[++idx]);
+                if (c.burst_kb < 16) {
+                    throw std::runtime_error("Burst must be at least 16 KB");
+                }
+            } else if (arg == "--transport" && idx + 1 < argc) {
+                c.transport = argv[++idx];
+                if (c.transport != "stream" && c.transport != "msg" && c.transport != "udp") {
+                    throw std::runtime_error("Transport must be stream, msg or udp");
+                }
+            } else if (arg == "--rate" && idx + 1 < argc) {
+                c.rate_bps = parseRate(argv[++idx]);
+                if (c.rate_bps <= 0) {
+                    throw std::runtime_error("Rate must be positive");
+                }
+            } else if (arg == "--no-pmtu") {
+                c.pmtu = false;
+            } else if (arg == "--probe") {
+                c.probe = true;
+            } else if (arg == "--no-probe") {
+                c.probe = false;
+            } else if (arg == "--deadline" && idx + 1 < argc) {
+                c.deadline = parseDeadline(argv[++idx]);
+            } else if (arg == "--no-disk-hint") {
+                c.disk_hint = false;
+            } else if (arg == "--tune") {
+                c.tune = true;
+            } else if (arg == "--tune-interval" && idx + 1 < argc) {
+                c.tune = true;
+                c.tune_interval_ms = std::stoi(argv[++idx]);
+                if (c.tune_interval_ms < MIN_TUNE_INTERVAL_MS || c.tune_interval_ms > MAX_TUNE_INTERVAL_MS) {
+                    throw std::runtime_error("Tune interval must be between 100 and 500 ms");
+                }
+            } else if (arg == "--block-size" && idx + 1 < argc) {
+                std::string v = argv[++idx];
+                c.block_auto = (v == "auto");
+                if (!c.block_auto) {
+                    uint64_t bytes = parseSize(v);
+                    if (bytes < static_cast<uint64_t>(MIN_BLOCK_SIZE) || bytes > static_cast<uint64_t>(MAX_BLOCK_SIZE)) {
+                        throw std::runtime_error("Block size must be between 64K and 64M, or auto");
+                    }
+                    c.block_size = static_cast<int>(bytes);
+                }
+            } else if (arg == "--mem-limit" && idx + 1 < argc) {
+                c.mem_limit_mb = std::stoi(argv[++idx]);
+                if (c.mem_limit_mb < MIN_MEM_LIMIT_MB) {
+                    throw std::runtime_error("Memory limit must be at least 4 MB");
+                }
+            } else if (arg == "--stats-out" && idx + 1 < argc) {
+                c.stats_out = argv[++idx];
+            } else if (arg == "--perf-counters") {
+                c.perf_counters = true;
+            } else if (arg == "--trace" && idx + 1 < argc) {
+                c.trace = argv[++idx];
+            } else if (arg == "--cc-trace" && idx + 1 < argc) {
+                c.cc_trace = argv[++idx];
+            } else if (arg == "--stats-interval" && idx + 1 < argc) {
+                c.stats_interval_ms = parseInterval(argv[++idx]);
+                if (c.stats_interval_ms < MIN_STATS_INTERVAL_MS || c.stats_interval_ms > MAX_STATS_INTERVAL_MS) {
+                    throw std::runtime_error("Stats interval must be between 10ms and 60s");
+                }
+            } else if (arg == "--progress" && idx + 1 < argc) {
+                c.progress = argv[++idx];
+                if (c.progress != "human" && c.progress != "json" && c.progress != "none") {
+                    throw std::runtime_error("Unknown progress format: " + c.progress + " (use human, json or none)");
+                }
+            } else if (arg == "--progress-fd" && idx + 1 < argc) {
+                c.progress_fd = std::stoi(argv[++idx]);
+                if (c.progress_fd < 0) {
+                    throw std::runtime_error("Progress fd must be non-negative");
+                }
+            } else if (arg == "--progress-interval" && idx + 1 < argc) {
+                c.progress_interval_ms = parseInterval(argv[++idx]);
+                if (c.progress_interval_ms < MIN_PROGRESS_INTERVAL_MS || c.progress_interval_ms > MAX_STATS_INTERVAL_MS) {
+                    throw std::runtime_error("Progress interval must be between 50ms and 60s");
+                }
+            } else if (arg == "--metrics" && idx + 1 < argc) {
+                c.metrics_port = std::stoi(argv[++idx]);
+                if (c.metrics_port <= 0 || c.metrics_port > 65535) {
+                    throw std::runtime_error("Metrics port must be between 1 and 65535");
+                }
+            } else if (arg == "--history" && idx + 1 < argc) {
+                c.history_file = argv[++idx];
+            } else if (arg == "--no-history") {
+                c.record_history = false;
+            } else if (arg == "--no-gso") {
+                c.no_gso = true;
+            } else if (arg == "--cache-mb" && idx + 1 < argc) {
+                c.cache_mb = std::stoi(argv[++idx]);
+                if (c.cache_mb < 16) {
+                    throw std::runtime_error("Cache size must be at least 16 MB");
+                }
+            } else {
+                throw std::runtime_error("Unknown option: " + arg);
+            }
+        }
+
+        // serve / fetch 只走 stream 数据面（块缓存按流顺序发送），不接受其他数据面
+        if ((c.mode == "serve" || c.mode == "fetch") && c.transport != "stream") {
+            throw std::runtime_error("--transport " + c.transport + " is not supported by serve/fetch");
+        }
+
+        // 作业模式下 --rate 是各会话共享的总带宽，由分配器切分，不启用单会话的 RateCC
+        if (!c.jobs_file.empty()) {
+            if (c.cc == "rate") {
+                throw std::runtime_error("--cc rate is per transfer; with --jobs, --rate is the shared total");
+            }
+            if (c.transport == "udp") {
+                throw std::runtime_error("--jobs schedules UDT data planes; use stream or msg transport");
+            }
+            if (c.cc.empty()) {
+                c.cc = "udt";
+            }
+        }
+
+        // 未指定 --cc 时，UDT 数据面上给出 --rate 即启用 RateCC（udp 数据面由 Pacer 限速）
+        if (c.cc.empty()) {
+            c.cc = (c.rate_bps > 0 && c.transport != "udp") ? "rate" : "udt";
+        }
+        if (c.cc == "rate" && c.rate_bps <= 0) {
+            throw std::runtime_error("--cc rate requires --rate");
+        }
+
+        return c;
+    }
+
+    // 对端给出的窗口（协议头、探测结论）同样限制在 [MIN_WINDOW, UDT_MAX_BUF]
+    static int clampWindow(int64_t window) {
+        return static_cast<int>(std::min<int64_t>(UDT_MAX_BUF, std::max<int64_t>(MIN_WINDOW, window)));
+    }
+
+    // 解析速率：支持 K/M/G 后缀（十进制，bit/s），如 "3.5G"、"800M"、"1000000"
+    static double parseRate(const std::string &text) {
+        size_t pos = 0;
+        double value = std::stod(text, &pos);
+        std::string suffix = text.substr(pos);
+        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::toupper);
+        if (suffix.size() >= 3 && suffix.compare(suffix.size() - 3, 3, "BPS") == 0) {
+            suffix.erase(suffix.size() - 3);
+        }
+
+        if (suffix.empty()) return value;
+        if (suffix == "K") return value * 1e3;
+        if (suffix == "M") return value * 1e6;
+        if (suffix == "G") return value * 1e9;
+        throw std::runtime_error("Invalid rate: " + text);
+    }
+
+    // 解析时间间隔：支持 ms / s 后缀，无后缀按毫秒，如 "250ms"、"1s"、"500"
+    static int parseInterval(const std::string &text) {
+        size_t pos = 0;
+        double value = std::stod(text, &pos);
+        std::string unit = text.substr(pos);
+        double mult = (unit.empty() || unit == "ms") ? 1 : (unit == "s" ? 1000 : 0);
+        if (mult <= 0 || value <= 0) {
+            throw std::runtime_error("Invalid interval: " + text);
+        }
+        return static_cast<int>(value * mult);
+    }
+
+    // 解析字节数：支持 K/M/G 后缀（二进制，KiB/MiB/GiB），如 "512K"、"8M"
+    static uint64_t parseSize(const std::string &text) {
+        size_t pos = 0;
+        double value = std::stod(text, &pos);
+        std::string suffix = text.substr(pos);
+        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::toupper);
+        if (!suffix.empty() && suffix.back() == 'B') {
+            suffix.pop_back();
+        }
+
+        double mult = 0;
+        if (suffix.empty()) mult = 1;
+        else if (suffix == "K") mult = 1024.0;
+        else if (suffix == "M") mult = 1024.0 * 1024;
+        else if (suffix == "G") mult = 1024.0 * 1024 * 1024;
+        if (mult <= 0 || value <= 0) {
+            throw std::runtime_error("Invalid size: " + text);
+        }
+        return static_cast<uint64_t>(value * mult);
+    }
+
+    // 解析截止时间：+90m / +2h / +3600s（相对现在）、HH:MM[:SS]（今天，已过则为明天）、
+    // YYYY-MM-DDTHH:MM[:SS] 或 "YYYY-MM-DD HH:MM[:SS]"（本地时间），纯数字为 Unix 时间戳
+    static std::time_t parseDeadline(const std::string &text) {
+        std::time_t now = std::time(nullptr);
+        if (!text.empty() && text[0] == '+') {
+            size_t pos = 0;
+            double value = std::stod(text.substr(1), &pos);
+            std::string unit = text.substr(1 + pos);
+            double mult = (unit.empty() || unit == "s") ? 1 : (unit == "m" ? 60 : (unit == "h" ? 3600 : 0));
+            if (mult <= 0 || value <= 0) {
+                throw std::runtime_error("Invalid deadline: " + text);
+            }
+            return now + static_cast<std::time_t>(value * mult);
+        }
+        if (!text.empty() && text.find_first_not_of("0123456789") == std::string::npos) {
+            return static_cast<std::time_t>(std::stoll(text));
+        }
+
+        std::string t = text;
+        std::replace(t.begin(), t.end(), 'T', ' ');
+        bool dateGiven = t.find('-') != std::string::npos;
+        std::tm tm = localTime(now);
+        tm.tm_sec = 0;
+
+        // %n 记录已消费的字符数，用于拒绝尾部多余内容；秒可省略
+        int used = -1, usedSec = -1;
+        int fields;
+        if (dateGiven) {
+            fields = sscanf(t.c_str(), "%d-%d-%d %d:%d%n:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                            &tm.tm_hour, &tm.tm_min, &used, &tm.tm_sec, &usedSec);
+            fields -= 3;
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+        } else {
+            fields = sscanf(t.c_str(), "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min, &used, &tm.tm_sec, &usedSec);
+        }
+        int consumed = (fields == 3) ? usedSec : used;
+        if (fields < 2 || consumed != static_cast<int>(t.size())) {
+            throw std::runtime_error("Invalid deadline: " + text);
+        }
+        tm.tm_isdst = -1;
+        std::time_t when = std::mktime(&tm);
+        if (!dateGiven && when <= now) {
+            tm.tm_mday += 1;
+            tm.tm_isdst = -1;
+            when = std::mktime(&tm);
+        }
+        return when;
+    }
+
+    static void printUsage() {
+        std::cerr << "Usage:\n"
+                << "  hruft send <ip> <port> <filepath> [options]\n"
+                << "  hruft send --jobs <jobs.json> [options]\n"
+                << "  hruft recv <port> <savepath> [options]\n"
+                << "  hruft serve <port> <rootdir> [options]\n"
+                << "  hruft fetch <ip> <port> <remote_name> <savepath> [options]\n"
+                << "  hruft history [peer] [--history <file>] [--detailed]\n\n"
+                << "Options:\n"
+                << "  --mss <value>      Maximum Segment Size (default: 1500)\n"
+                << "  --window <value>   Window size in bytes (default: "
+                << DEFAULT_WINDOW / (1024 * 1024) << "MB)\n"
+                << "  --detailed         Show detailed statistics\n"
+                << "  --no-cc            Disable congestion control (for direct connections)\n"  // 新增
+                << "  --cc <name>        Congestion control: udt | rate (fixed --rate, token bucket)\n"
+                << "                     | bbr (model-based, bandwidth x min RTT)\n"
+                << "                     | scavenger (LEDBAT, yields to other traffic) | none\n"
+                << "  --target-delay <ms> scavenger: extra queuing delay allowed (default: "
+                << DEFAULT_TARGET_DELAY_MS << ")\n"
+                << "  --burst <KB>       rate: token bucket burst size (default: " << DEFAULT_BURST_KB << "KB)\n"
+                << "  --transport <t>    Data plane: stream | msg (out-of-order UDT messages on port+1)\n"
+                << "                     | udp (rate-paced native UDP blast on port+1)\n"
+                << "  --rate <bps>       Send rate, e.g. 800M, 3.5G (udp default: 1G; enables --cc rate)\n"
+                << "  --no-gso           udp: disable UDP GSO/GRO segmentation offload\n"
+                << "  --no-pmtu          send/fetch: skip path MTU discovery (used when --mss is not given)\n"
+                << "  --probe            send: probe RTT/bandwidth first and size buffers to 2xBDP\n"
+                << "                     (one extra connection and a 4MB train; ignored when --window is given)\n"
+                << "  --no-disk-hint     do not pace to the receiver's disk write rate (either side)\n"
+                << "  --deadline <time>  send: finish just in time, e.g. 06:00, 2026-10-19T06:00, +2h\n"
+                << "                     (paces to the required rate +10%, full speed when behind)\n"
+                << "  --jobs <file>      send: run a JSON job list concurrently; --rate (or total_rate)\n"
+                << "                     is shared by weighted fair queueing with priorities and caps\n"
+                << "  --tune             send: live tuning of rate cap, read-ahead depth and block size\n"
+                << "  --tune-interval <ms> Sampling interval for --tune, 100-500 (default: "
+                << DEFAULT_TUNE_INTERVAL_MS << ")\n"
+                << "  --block-size <n>   send/recv: read/write block size, e.g. 512K, 8M, or auto\n"
+                << "                     (auto: start from the probe, adapt to per-call cost and queueing;\n"
+                << "                     default: " << DEFAULT_BLOCK_SIZE / (1024 * 1024) << "M)\n"
+                << "  --mem-limit <MB>   send/recv: ceiling for block buffers (default: " << DEFAULT_MEM_LIMIT_MB << ")\n"
+                << "  --stats-out <file> send/recv: write a JSONL perfmon time series (one line per interval)\n"
+                << "  --stats-interval <t> Sampling interval for --stats-out, e.g. 250ms, 1s (default: "
+                << DEFAULT_STATS_INTERVAL_MS << "ms)\n"
+                << "  --perf-counters    send/recv: per-stage cycles, instructions, LLC misses and context\n"
+                << "                     switches via perf_event_open (IPC and bytes/cycle in the report)\n"
+                << "  --trace <file>     send/recv: write a Chrome/Perfetto trace of every read, hash, send,\n"
+                << "                     recv and write call plus rate, RTT and buffer-fill counters\n"
+                << "  --cc-trace <file>  send: write congestion-control events (ACK/loss/timeout) as JSONL\n"
+                << "  --progress <fmt>   Progress output: human | json ({\"type\":\"progress\",...} lines) | none\n"
+                << "  --progress-fd <n>  Write progress to file descriptor n instead of stdout\n"
+                << "  --progress-interval <t> Progress update period, e.g. 500ms, 2s (default: 1s)\n"
+                << "  --metrics <port>   Serve Prometheus metrics on http://127.0.0.1:<port>/metrics\n"
+                << "  --history <file>   Transfer history store (default: ~/.local/share/hruft/history.bin);\n"
+                << "                     each transfer is compared with the peer's trailing median, then appended\n"
+                << "  --no-history       Neither record this transfer nor compare it with the history\n"
+                << "  --cache-mb <value> serve: shared block cache limit in MB (default: "
+                << DEFAULT_CACHE_MB << ")\n";
+    }
+};
+
+// --- 辅助函数 ---
 class Utils {
 public:
     static bool waitForAck(UDTSOCKET sock, const std::string &expected, int timeout_ms = 10000) {
-        char buf[256];
+        // 只读取 expected 的长度，避免吞掉紧随其后的报告或控制帧
+        std::vector<char> buf(expected.size());
         int original_timeout = 0;
         int timeout_len = sizeof(int);
 
-        // 保存原始超时设置
-        UDT::getsockopt(sock, 0, UDT_RCVTIMEO, &original_timeout, &timeout_len);
+        // 保存原始超时设置
+        UDT::getsockopt(sock, 0, UDT_RCVTIMEO, &original_timeout, &timeout_len);
+
+        // 设置新超时
+        UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &timeout_ms, sizeof(int));
+
+        bool ok = recvAll(sock, buf.data(), static_cast<int>(buf.size()));
+
+        // 恢复原始超时
+        UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &original_timeout, sizeof(int));
+
+        return ok && std::string(buf.begin(), buf.end()) == expected;
+    }
+
+    // 阻塞发送全部数据，失败返回 false
+    static bool sendAll(UDTSOCKET sock, const char *data, int len) {
+        int offset = 0;
+        while (offset < len) {
+            int s = UDT::send(sock, data + offset, len - offset, 0);
+            if (s == UDT::ERROR) {
+                return false;
+            }
+            offset += s;
+        }
+        return true;
+    }
+
+    // 阻塞接收指定长度数据，失败返回 false
+    static bool recvAll(UDTSOCKET sock, char *data, int len) {
+        int offset = 0;
+        while (offset < len) {
+            int r = UDT::recv(sock, data + offset, len - offset, 0);
+            if (r <= 0) {
+                return false;
+            }
+            offset += r;
+        }
+        return true;
+    }
+
+    // IPv4 地址的规范文本形式（与 peerToString 一致）；不是 IPv4 地址时原样返回
+    static std::string canonicalIp(const std::string &text) {
+        in_addr addr;
+        char ip[INET_ADDRSTRLEN] = {0};
+        if (inet_pton(AF_INET, text.c_str(), &addr) != 1 || !inet_ntop(AF_INET, &addr, ip, sizeof(ip))) {
+            return text;
+        }
+        return ip;
+    }
+
+    static std::string peerToString(UDTSOCKET sock) {
+        sockaddr_in addr;
+        int len = sizeof(addr);
+        if (UDT::getpeername(sock, (sockaddr *) &addr, &len) == UDT::ERROR) {
+            return "unknown";
+        }
+        char ip[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+    }
+
+    static std::string hashToString(const uint8_t *hash, size_t len) {
+        std::stringstream ss;
+        for (size_t i = 0; i < len; ++i) {
+            ss << std::hex << std::setw(2) << std::setfill('0')
+                    << static_cast<int>(hash[i]);
+        }
+        return ss.str();
+    }
+
+    // 分布摘要：min / p50 / p99 / max / mean（最近秩百分位）
+    static json distribution(std::vector<double> v) {
+        if (v.empty()) {
+            return json::object({{"count", 0}});
+        }
+        std::sort(v.begin(), v.end());
+        auto pct = [&](double p) {
+            size_t rank = static_cast<size_t>(std::ceil(p * v.size()));
+            return v[std::min(v.size() - 1, rank > 0 ? rank - 1 : 0)];
+        };
+        double sum = 0;
+        for (double x : v) sum += x;
+        return json::object({
+            {"count", v.size()},
+            {"min", v.front()},
+            {"p50", pct(0.5)},
+            {"p99", pct(0.99)},
+            {"max", v.back()},
+            {"mean", sum / v.size()}
+        });
+    }
+
+    static std::string formatLocalTime(std::time_t t) {
+        std::tm tm = localTime(t);
+        std::stringstream ss;
+        ss << std::put_time(&tm, "%Y-%m-%dT%H:%M:%S");
+        return ss.str();
+    }
+
+    static std::string formatSize(uint64_t bytes) {
+        const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+        int unit = 0;
+        double size = static_cast<double>(bytes);
+
+        while (size >= 1024.0 && unit < 4) {
+            size /= 1024.0;
+            unit++;
+        }
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << size << " " << units[unit];
+        return ss.str();
+    }
+};
+
+// stdout 作为数据输出时：std::cout 日志临时改走 stderr，析构时恢复
+class StdoutRedirect {
+    std::streambuf *orig = nullptr;
+    bool active;
+
+public:
+    explicit StdoutRedirect(bool enable) : active(enable) {
+        if (!active) return;
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        orig = std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
+    ~StdoutRedirect() {
+        if (active) {
+            std::cout.rdbuf(orig);
+        }
+    }
+
+    // 原始 stdout 缓冲区，用于写入数据
+    std::streambuf *dataBuf() const { return orig; }
+};
+
+// 乱序到达的数据按文件偏移重新排序，连续部分按顺序交给 consume（用于哈希或不可定位的输出）。
+// 暂存的数据不超过 limit（按窗口设定），超前太多的发送端不能无限撑大接收端内存
+class ReorderBuffer {
+    std::map<uint64_t, std::vector<char> > pending;
+    uint64_t frontier = 0;
+    uint64_t pendingBytes = 0;
+    uint64_t limit;
+
+public:
+    uint64_t peakBytes = 0;
+    uint64_t outOfOrder = 0;
+
+    explicit ReorderBuffer(uint64_t limitBytes) : limit(limitBytes) {
+    }
+
+    // 不在前沿上的数据暂存后是否仍不超过上限（前沿上的数据直接交出，不占缓冲）
+    bool admits(int len) const {
+        return pendingBytes + static_cast<uint64_t>(len) <= limit;
+    }
+
+    template<typename Consume>
+    void push(uint64_t offset, const char *data, int len, Consume consume) {
+        if (offset != frontier) {
+            if (!admits(len)) {
+                throw std::runtime_error("Reorder buffer exceeded " + std::to_string(limit) +
+                                         " bytes; sender is too far ahead");
+            }
+            pending.emplace(offset, std::vector<char>(data, data + len));
+            pendingBytes += len;
+            peakBytes = std::max(peakBytes, pendingBytes);
+            outOfOrder++;
+            return;
+        }
+
+        consume(data, len);
+        frontier += len;
+
+        auto it = pending.begin();
+        while (it != pending.end() && it->first == frontier) {
+            consume(it->second.data(), static_cast<int>(it->second.size()));
+            frontier += it->second.size();
+            pendingBytes -= it->second.size();
+            it = pending.erase(it);
+        }
+    }
+
+    uint64_t contiguous() const { return frontier; }
+
+    uint64_t capacity() const { return limit; }
+};
+
+// --- 原生 UDP 数据通道（--transport udp） ---
+// Linux 下用 sendmmsg / recvmmsg 批量收发，其他平台逐个收发
+class UdpChannel {
+#ifdef _WIN32
+    SOCKET fd = INVALID_SOCKET;
+#else
+    int fd = -1;
+#endif
+    bool gso = false;      // 发送端 UDP_SEGMENT
+    bool gro = false;      // 接收端 UDP_GRO
+    int gsoSize = 0;       // 每个分段的长度（= 数据报步长）
+    int gsoSegs = 1;       // 每个超级数据报的分段数
+
+    // 接收缓冲：UDP_BATCH 个槽位，开启 GRO 时每槽 64KB
+    std::vector<char> rxBuf;
+    int rxSlot = 0;
+
+public:
+    std::string gsoFallback;  // 非空表示 GSO 被关闭的原因
+    uint64_t sendCalls = 0;
+    uint64_t recvCalls = 0;
+
+    UdpChannel() {
+        fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef _WIN32
+        if (fd == INVALID_SOCKET) {
+#else
+        if (fd < 0) {
+#endif
+            throw std::runtime_error("Failed to create UDP socket");
+        }
+    }
+
+    ~UdpChannel() {
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    UdpChannel(const UdpChannel &) = delete;
+    UdpChannel &operator=(const UdpChannel &) = delete;
+
+    void bindLocal(int port) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (::bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            throw std::runtime_error("UDP bind failed on port " + std::to_string(port));
+        }
+    }
+
+    void connectTo(const std::string &ip, int port) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0) {
+            throw std::runtime_error("Invalid IP address: " + ip);
+        }
+        if (::connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            throw std::runtime_error("UDP connect failed");
+        }
+    }
+
+    void setBuffers(int bytes) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *) &bytes, sizeof(bytes));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *) &bytes, sizeof(bytes));
+    }
+
+    void setRecvTimeout(int ms) {
+#ifdef _WIN32
+        DWORD tv = ms;
+#else
+        timeval tv;
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+#endif
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+    }
+
+    // 开启 UDP_SEGMENT：内核（或网卡）把一次写入的超级数据报按 segSize 切分。
+    // 选项设在套接字上，长度不超过 segSize 的写入仍是普通数据报
+    bool enableGso(int segSize) {
+#ifdef __linux__
+        if (::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segSize, sizeof(segSize)) != 0) {
+            gsoFallback = std::string("UDP_SEGMENT unsupported: ") + strerror(errno);
+            return false;
+        }
+        gso = true;
+        gsoSize = segSize;
+        gsoSegs = std::max(1, std::min(UDP_MAX_GSO_SEGS, UDP_MAX_SUPER_DGRAM / segSize));
+        return true;
+#else
+        (void) segSize;
+        gsoFallback = "UDP GSO is Linux-only";
+        return false;
+#endif
+    }
+
+    // 开启 UDP_GRO：接收端一次读到合并后的超级数据报，分段长度由控制消息给出
+    bool enableGro() {
+#ifdef __linux__
+        int on = 1;
+        gro = ::setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+#endif
+        return gro;
+    }
+
+    bool gsoActive() const { return gso; }
+    bool groActive() const { return gro; }
+
+    // 每批最多交给 sendBatch 的数据报数
+    int sendCapacity() const {
+        return gso ? UDP_GSO_BATCH * gsoSegs : UDP_BATCH;
+    }
+
+    // 每批 recvBatch 最多拆出的数据报数；maxDatagram 为单个数据报上限
+    int prepareRecv(int maxDatagram) {
+        rxSlot = gro ? UDP_MAX_SUPER_DGRAM : maxDatagram;
+        rxBuf.assign(static_cast<size_t>(UDP_BATCH) * rxSlot, 0);
+        return gro ? UDP_BATCH * std::max(1, UDP_MAX_SUPER_DGRAM / maxDatagram + 1) : UDP_BATCH;
+    }
+
+    // 发送 count 个数据报：第 i 个位于 buf + i * stride，长度 lens[i]；返回成功发送的个数。
+    // GSO 开启时，连续的满长数据报（最后一个可以较短）合并成一次写入
+    int sendBatch(const char *buf, int stride, const int *lens, int count) {
+#ifdef __linux__
+        const int maxMsgs = UDP_GSO_BATCH > UDP_BATCH ? UDP_GSO_BATCH : UDP_BATCH;
+        mmsghdr msgs[maxMsgs];
+        iovec iovs[maxMsgs];
+        int segs[maxMsgs];
+        int sentTotal = 0;
+        while (sentTotal < count) {
+            bool grouped = gso && stride == gsoSize;
+            int n = 0;
+            int idx = sentTotal;
+            while (idx < count && n < maxMsgs) {
+                int k = 1;
+                size_t len = lens[idx];
+                // 只有满长数据报后面才能继续拼接
+                while (grouped && k < gsoSegs && idx + k < count && lens[idx + k - 1] == stride) {
+                    len += lens[idx + k];
+                    k++;
+                }
+                iovs[n].iov_base = const_cast<char *>(buf + idx * stride);
+                iovs[n].iov_len = len;
+                memset(&msgs[n], 0, sizeof(mmsghdr));
+                msgs[n].msg_hdr.msg_iov = &iovs[n];
+                msgs[n].msg_hdr.msg_iovlen = 1;
+                segs[n] = k;
+                idx += k;
+                n++;
+            }
+
+            int r = sendmmsg(fd, msgs, n, 0);
+            sendCalls++;
+            if (r < 0) {
+                if (errno == EINTR || errno == ENOBUFS || errno == EAGAIN) continue;
+                // 出口设备不支持分段（如缺少校验和卸载）时返回 EIO，退回逐数据报发送
+                if (gso && (errno == EIO || errno == EINVAL || errno == EMSGSIZE)) {
+                    gsoFallback = std::string("UDP_SEGMENT send failed: ") + strerror(errno);
+                    disableGso();
+                    continue;
+                }
+                return sentTotal;
+            }
+            for (int i = 0; i < r; ++i) sentTotal += segs[i];
+        }
+        return sentTotal;
+#else
+        for (int i = 0; i < count; ++i) {
+            sendCalls++;
+            if (::send(fd, buf + i * stride, lens[i], 0) < 0) {
+                return i;
+            }
+        }
+        return count;
+#endif
+    }
+
+    // 接收一批数据报，超时返回 0。dgrams[i] 指向内部缓冲中的第 i 个数据报，
+    // 在下一次调用前有效；GRO 合并的超级数据报在这里按分段长度拆开
+    int recvBatch(const char **dgrams, int *lens, int maxCount) {
+        if (rxBuf.empty()) {
+            prepareRecv(UDP_MAX_SUPER_DGRAM);
+        }
+#ifdef __linux__
+        mmsghdr msgs[UDP_BATCH];
+        iovec iovs[UDP_BATCH];
+        char ctrl[UDP_BATCH][CMSG_SPACE(sizeof(int))];
+        for (int i = 0; i < UDP_BATCH; ++i) {
+            iovs[i].iov_base = rxBuf.data() + static_cast<size_t>(i) * rxSlot;
+            iovs[i].iov_len = rxSlot;
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (gro) {
+                msgs[i].msg_hdr.msg_control = ctrl[i];
+                msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+            }
+        }
+        // 第一个数据报阻塞等待（受 SO_RCVTIMEO 限制），其余只取已到达的
+        int r = recvmmsg(fd, msgs, UDP_BATCH, MSG_WAITFORONE, nullptr);
+        recvCalls++;
+        if (r <= 0) {
+            return 0;
+        }
+
+        int out = 0;
+        for (int i = 0; i < r && out < maxCount; ++i) {
+            const char *base = static_cast<const char *>(iovs[i].iov_base);
+            int total = static_cast<int>(msgs[i].msg_len);
+            int seg = total;
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); gro && cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    memcpy(&seg, CMSG_DATA(cm), sizeof(int));
+                }
+            }
+            if (seg <= 0) seg = total;
+            for (int off = 0; off < total && out < maxCount; off += seg) {
+                dgrams[out] = base + off;
+                lens[out] = std::min(seg, total - off);
+                out++;
+            }
+        }
+        return out;
+#else
+        (void) maxCount;
+        int r = ::recv(fd, rxBuf.data(), rxSlot, 0);
+        recvCalls++;
+        if (r <= 0) {
+            return 0;
+        }
+        dgrams[0] = rxBuf.data();
+        lens[0] = r;
+        return 1;
+#endif
+    }
+
+private:
+    void disableGso() {
+#ifdef __linux__
+        int off = 0;
+        ::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &off, sizeof(off));
+#endif
+        gso = false;
+        gsoSegs = 1;
+    }
+};
+
+// 发送速率整形：按字节数推进下一次允许发送的时间点
+class Pacer {
+    double bytesPerSec;
+    std::chrono::steady_clock::time_point next;
+
+public:
+    explicit Pacer(double bitsPerSec)
+        : bytesPerSec(bitsPerSec / 8.0), next(std::chrono::steady_clock::now()) {
+    }
+
+    void wait(size_t bytes) {
+        if (bytesPerSec <= 0) return;
+
+        auto now = std::chrono::steady_clock::now();
+        // 空闲后不累积发送额度，避免突发
+        if (next < now - std::chrono::milliseconds(1)) {
+            next = now;
+        }
+
+        // 长等待用 sleep，剩余的短间隔自旋，保证微秒级精度
+        auto remain = next - now;
+        if (remain > std::chrono::microseconds(200)) {
+            std::this_thread::sleep_for(remain - std::chrono::microseconds(100));
+        }
+        while (std::chrono::steady_clock::now() < next) {
+            std::this_thread::yield();
+        }
+
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(bytes / bytesPerSec));
+    }
+};
+
+// 接收端写盘速率测量：累计 write 的字节数与耗时，每 DISK_HINT_INTERVAL_MS 结算一次。
+// 写盘耗时占比高时，字节数 / 写盘耗时即磁盘（或 stdout 下游）的持续写速率
+class DiskRateMeter {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point windowStart;
+    uint64_t windowBytes = 0;
+    double windowBusy = 0;
+    uint64_t totalBytes = 0;
+    double totalBusy = 0;
+
+    double sustainedBps = 0;
+    double lastHintBps = 0;
+    uint64_t windows = 0;
+    uint64_t limitedWindows = 0;
+
+public:
+    DiskRateMeter() : start(std::chrono::steady_clock::now()), windowStart(start) {
+    }
+
+    template <class Write>
+    void write(uint64_t bytes, Write fn) {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        windowBytes += bytes;
+        windowBusy += sec;
+        totalBytes += bytes;
+        totalBusy += sec;
+    }
+
+    // 周期到达时返回 true 并给出提示值（bit/s，0 表示磁盘不构成瓶颈）
+    bool poll(double &hintBps) {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - windowStart).count();
+        if (dt * 1000 < DISK_HINT_INTERVAL_MS) {
+            return false;
+        }
+
+        if (windowBusy > 0 && windowBytes > 0) {
+            double rate = windowBytes * 8.0 / windowBusy;
+            sustainedBps = sustainedBps > 0 ? sustainedBps + DISK_HINT_EWMA * (rate - sustainedBps) : rate;
+        }
+        bool limited = windowBusy / dt >= DISK_HINT_BUSY;
+        windows++;
+        if (limited) limitedWindows++;
+
+        hintBps = limited ? sustainedBps : 0.0;
+        lastHintBps = hintBps;
+        windowStart = now;
+        windowBytes = 0;
+        windowBusy = 0;
+        return true;
+    }
+
+    json report() const {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return json::object({
+            {"write_mbps", totalBusy > 0 ? totalBytes * 8.0 / totalBusy / 1e6 : 0.0},
+            {"sustained_mbps", sustainedBps / 1e6},
+            {"busy_ratio", elapsed > 0 ? totalBusy / elapsed : 0.0},
+            {"windows", windows},
+            {"disk_limited_windows", limitedWindows},
+            {"last_hint_mbps", lastHintBps / 1e6}
+        });
+    }
+};
+
+// 原生 UDP 数据面的分片几何：每个应用块切成 perBlock 个数据报，全局序号 = block * perBlock + seq
+struct UdpLayout {
+    int payload;
+    uint64_t perBlock;
+    uint64_t fileSize;
+    uint64_t total;
+
+    UdpLayout(int mss, uint64_t size)
+        : payload(mss - UDP_IP_OVERHEAD - static_cast<int>(sizeof(UdpHeader))), fileSize(size) {
+        perBlock = (APP_BLOCK_SIZE + payload - 1) / payload;
+        uint64_t blocks = (size + APP_BLOCK_SIZE - 1) / APP_BLOCK_SIZE;
+        total = 0;
+        if (blocks > 0) {
+            uint64_t lastLen = size - (blocks - 1) * APP_BLOCK_SIZE;
+            total = (blocks - 1) * perBlock + (lastLen + payload - 1) / payload;
+        }
+    }
+
+    uint64_t offsetOf(uint64_t g) const {
+        return (g / perBlock) * APP_BLOCK_SIZE + (g % perBlock) * payload;
+    }
+
+    int lengthOf(uint64_t g) const {
+        uint64_t block = g / perBlock;
+        uint64_t blockLen = std::min<uint64_t>(APP_BLOCK_SIZE, fileSize - block * APP_BLOCK_SIZE);
+        uint64_t inBlock = (g % perBlock) * payload;
+        return static_cast<int>(std::min<uint64_t>(payload, blockLen - inBlock));
+    }
+};
+
+// --- 热点文件块缓存（serve 模式多会话共享） ---
+// 按 (file id, block index) 分片的 LRU，块以 shared_ptr 引用计数，
+// 被会话持有的块不会被淘汰；同一块的并发读者共享一次磁盘读取。
+class BlockCache {
+public:
+    struct Block {
+        std::vector<char> data;
+        bool ready = false;
+        bool failed = false;
+    };
+
+    using BlockRef = std::shared_ptr<const Block>;
+    // 读取回调：把块内容填入 dst，返回实际读取字节数
+    using Loader = std::function<int(char *dst, int len)>;
+
+    BlockCache(uint64_t capBytes, int shardCount = 16)
+        : shards(shardCount), shardCap(capBytes / shardCount) {
+    }
+
+    BlockRef acquire(uint64_t fileId, uint64_t index, int len, const Loader &loader) {
+        Key key{fileId, index};
+        Shard &sh = shards[KeyHash()(key) % shards.size()];
+
+        std::shared_ptr<Block> blk;
+        {
+            std::unique_lock<std::mutex> lk(sh.mtx);
+            auto it = sh.index.find(key);
+            if (it != sh.index.end()) {
+                // 命中：移到 LRU 头部
+                sh.lru.splice(sh.lru.begin(), sh.lru, it->second);
+                blk = it->second->block;
+                if (blk->ready) {
+                    hits++;
+                    return blk;
+                }
+                // 其他会话正在读盘，等待同一次读取完成
+                sharedLoads++;
+                sh.cv.wait(lk, [&] { return blk->ready || blk->failed; });
+                if (blk->failed) {
+                    throw std::runtime_error("Block load failed (shared)");
+                }
+                return blk;
+            }
+
+            misses++;
+            blk = std::make_shared<Block>();
+            if (!makeRoom(sh, len)) {
+                // 所有块都被会话持有，超出内存上限：本次读取不进缓存
+                bypass++;
+                lk.unlock();
+                return loadPrivate(blk, len, loader);
+            }
+            sh.lru.push_front(Entry{key, blk});
+            sh.index[key] = sh.lru.begin();
+            sh.bytes += len;
+            cachedBytes += len;
+        }
+
+        // 在锁外读盘
+        bool ok = true;
+        try {
+            blk->data.resize(len);
+            ok = loader(blk->data.data(), len) == len;
+        } catch (...) {
+            ok = false;
+        }
+        diskBytes += len;
+
+        std::lock_guard<std::mutex> lk(sh.mtx);
+        if (ok) {
+            blk->ready = true;
+        } else {
+            blk->failed = true;
+            auto it = sh.index.find(key);
+            if (it != sh.index.end() && it->second->block == blk) {
+                sh.lru.erase(it->second);
+                sh.index.erase(it);
+                sh.bytes -= len;
+                cachedBytes -= len;
+            }
+        }
+        sh.cv.notify_all();
+        if (!ok) {
+            throw std::runtime_error("Block load failed");
+        }
+        return blk;
+    }
+
+    json stats() const {
+        uint64_t h = hits, m = misses, w = sharedLoads;
+        uint64_t lookups = h + m + w;
+        return json::object({
+            {"capacity_bytes", shardCap * shards.size()},
+            {"cached_bytes", cachedBytes.load()},
+            {"hits", h},
+            {"misses", m},
+            {"shared_loads", w},
+            {"evictions", evictions.load()},
+            {"bypass", bypass.load()},
+            {"disk_read_bytes", diskBytes.load()},
+            {"hit_rate", lookups > 0 ? static_cast<double>(h + w) / lookups : 0.0}
+        });
+    }
+
+private:
+    struct Key {
+        uint64_t fileId;
+        uint64_t index;
+
+        bool operator==(const Key &o) const { return fileId == o.fileId && index == o.index; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            return std::hash<uint64_t>()(k.fileId * 0x9E3779B97F4A7C15ULL ^ k.index);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<Block> block;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        uint64_t bytes = 0;
+    };
+
+    std::vector<Shard> shards;
+    uint64_t shardCap;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> sharedLoads{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> bypass{0};
+    std::atomic<uint64_t> diskBytes{0};
+    std::atomic<uint64_t> cachedBytes{0};
+
+    // 从 LRU 尾部淘汰未被引用的块，直到能放下 need 字节（调用方持有分片锁）
+    bool makeRoom(Shard &sh, int need) {
+        auto it = sh.lru.end();
+        while (sh.bytes + need > shardCap && it != sh.lru.begin()) {
+            --it;
+            // use_count == 1 表示只有缓存自身持有
+            if (it->block->ready && it->block.use_count() == 1) {
+                uint64_t sz = it->block->data.size();
+                sh.index.erase(it->key);
+                it = sh.lru.erase(it);
+                sh.bytes -= sz;
+                cachedBytes -= sz;
+                evictions++;
+            }
+        }
+        return sh.bytes + need <= shardCap;
+    }
+
+    BlockRef loadPrivate(std::shared_ptr<Block> blk, int len, const Loader &loader) {
+        blk->data.resize(len);
+        if (loader(blk->data.data(), len) != len) {
+            throw std::runtime_error("Block load failed");
+        }
+        diskBytes += len;
+        blk->ready = true;
+        return blk;
+    }
+};
+
+// serve 模式下被共享的文件：整文件 BLAKE3 只由领先的会话按块顺序计算一次
+struct ServedFile {
+    uint64_t id = 0;
+    fs::path path;
+    uint64_t size = 0;
+    uint64_t blockCount = 0;
+
+    std::mutex mtx;
+    blake3_hasher hasher;
+    uint64_t hashedBlocks = 0;
+    bool hashDone = false;
+    uint8_t hash[BLAKE3_OUT_LEN];
+
+    // 会话按顺序处理第 index 块时调用；只有恰好处于哈希前沿的会话才真正计算
+    void feedHash(uint64_t index, const char *data, int len) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (index != hashedBlocks || hashDone) {
+            return;
+        }
+        blake3_hasher_update(&hasher, data, len);
+        hashedBlocks++;
+        if (hashedBlocks == blockCount) {
+            blake3_hasher_finalize(&hasher, hash, BLAKE3_OUT_LEN);
+            hashDone = true;
+        }
+    }
+};
+
+// 内核 UDP 缓冲区：自建 UDP 套接字交给 UDT（bind2），以便连接后读回内核实际生效的大小。
+// Linux 会把 SO_SNDBUF/SO_RCVBUF 静默截断到 wmem_max/rmem_max，且 getsockopt 返回值为实际的两倍
+class SocketBuffers {
+public:
+    static UDPSOCKET openBound(int port, int bytes) {
+        UDPSOCKET fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef _WIN32
+        if (fd == INVALID_SOCKET) return fd;
+#else
+        if (fd < 0) return fd;
+#endif
+        int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *) &bytes, sizeof(bytes));
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *) &bytes, sizeof(bytes));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (::bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            closeFd(fd);
+            return invalidFd();
+        }
+        return fd;
+    }
+
+    static UDPSOCKET invalidFd() {
+#ifdef _WIN32
+        return INVALID_SOCKET;
+#else
+        return -1;
+#endif
+    }
+
+    static bool valid(UDPSOCKET fd) {
+#ifdef _WIN32
+        return fd != INVALID_SOCKET;
+#else
+        return fd >= 0;
+#endif
+    }
+
+    static void closeFd(UDPSOCKET fd) {
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    // 读回 UDT 与内核两层缓冲的实际大小；requested 为本端请求的 UDP 缓冲
+    static json inspect(UDTSOCKET s, UDPSOCKET fd, int requested) {
+        int udtSnd = 0, udtRcv = 0;
+        int len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_SNDBUF, &udtSnd, &len);
+        len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_RCVBUF, &udtRcv, &len);
+
+        json j = json::object({
+            {"requested_bytes", requested},
+            {"udt_snd_bytes", udtSnd},
+            {"udt_rcv_bytes", udtRcv}
+        });
+        if (!valid(fd)) {
+            j["kernel"] = nullptr;
+            j["clamped"] = false;
+            return j;
+        }
+
+        int snd = kernelSize(fd, SO_SNDBUF);
+        int rcv = kernelSize(fd, SO_RCVBUF);
+        j["udp_snd_effective_bytes"] = snd;
+        j["udp_rcv_effective_bytes"] = rcv;
+        j["clamped"] = (snd < requested || rcv < requested);
+#ifdef __linux__
+        j["wmem_max"] = readProc("/proc/sys/net/core/wmem_max");
+        j["rmem_max"] = readProc("/proc/sys/net/core/rmem_max");
+#endif
+        return j;
+    }
+
+private:
+    static int kernelSize(UDPSOCKET fd, int opt) {
+        int v = 0;
+#ifdef _WIN32
+        int len = sizeof(v);
+#else
+        socklen_t len = sizeof(v);
+#endif
+        if (::getsockopt(fd, SOL_SOCKET, opt, (char *) &v, &len) != 0) {
+            return 0;
+        }
+#ifdef __linux__
+        v /= 2;  // 内核返回的是加倍后的记账值
+#endif
+        return v;
+    }
+
+    static long long readProc(const char *path) {
+        std::ifstream f(path);
+        long long v = 0;
+        f >> v;
+        return v;
+    }
+};
+
+// 路径 MTU 探测：向对端端口发送带 DF 标志的 UDP 探测包，由内核根据 ICMP "需要分片"
+// 更新路由 PMTU（IP_MTU），取其作为 UDT_MSS（UDT 的 MSS 即 IP 包长）。
+// 结果按目的地址缓存在本地小表中，有效期内直接复用
+class PathMtu {
+public:
+    // 返回建议的 MSS；source 为 "cache" / "probe" / "default"
+    static int discover(const std::string &ip, int port, std::string &source) {
+        json cache = loadCache();
+        auto now = static_cast<int64_t>(std::time(nullptr));
+        if (cache.contains(ip)) {
+            const json &e = cache[ip];
+            if (now - e.value("updated", static_cast<int64_t>(0)) < PMTU_CACHE_TTL_SEC) {
+                source = "cache";
+                return e.value("mtu", DEFAULT_MSS);
+            }
+        }
+
+        int mtu = probe(ip, port);
+        if (mtu <= 0) {
+            source = "default";
+            return DEFAULT_MSS;
+        }
+
+        mtu = std::max(MIN_MSS, std::min(MAX_MSS, mtu));
+        {
+            // 作业模式下多个会话可能同时探测，重新读取后再合并写回
+            static std::mutex cacheMutex;
+            std::lock_guard<std::mutex> lk(cacheMutex);
+            cache = loadCache();
+            cache[ip] = json::object({{"mtu", mtu}, {"updated", now}});
+            saveCache(cache);
+        }
+        source = "probe";
+        return mtu;
+    }
+
+private:
+    static int probe(const std::string &ip, int port) {
+#ifdef __linux__
+        int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) return 0;
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        int pmtuMode = IP_PMTUDISC_DO;  // 置 DF，超过已知 PMTU 的发送直接返回 EMSGSIZE
+        int recvErr = 1;                // ICMP 错误进入错误队列，便于等待
+        if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0 ||
+            ::connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0 ||
+            ::setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtuMode, sizeof(pmtuMode)) != 0) {
+            ::close(fd);
+            return 0;
+        }
+        ::setsockopt(fd, IPPROTO_IP, IP_RECVERR, &recvErr, sizeof(recvErr));
+
+        // 探测包内容全 0：UDT 监听端把它当作目标 ID 为 0 的非握手包丢弃
+        std::vector<char> buf(MAX_MSS, 0);
+        int mtu = currentMtu(fd);
+        for (int round = 0; round < PMTU_PROBE_ROUNDS && mtu > 0; ++round) {
+            int size = std::min(mtu, MAX_MSS) - UDP_IP_OVERHEAD;
+            if (::send(fd, buf.data(), size, 0) < 0 && errno != EMSGSIZE) {
+                break;
+            }
+
+            // 等待沿途路由器的 ICMP 回报（或确认没有回报）
+            pollfd pfd = {fd, POLLERR, 0};
+            if (::poll(&pfd, 1, PMTU_PROBE_WAIT_MS) > 0 && (pfd.revents & POLLERR)) {
+                char cbuf[512];
+                msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = cbuf;
+                msg.msg_controllen = sizeof(cbuf);
+                ::recvmsg(fd, &msg, MSG_ERRQUEUE);
+            }
+
+            int next = currentMtu(fd);
+            if (next <= 0 || next >= mtu) {
+                break;  // 没有更小的 PMTU 回报，当前值在路径上可达
+            }
+            mtu = next;
+        }
+        ::close(fd);
+        return mtu;
+#else
+        (void) ip;
+        (void) port;
+        return 0;
+#endif
+    }
+
+#ifdef __linux__
+    static int currentMtu(int fd) {
+        int mtu = 0;
+        socklen_t len = sizeof(mtu);
+        if (::getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len) != 0) {
+            return 0;
+        }
+        return mtu;
+    }
+#endif
+
+    static fs::path cacheFile() {
+#ifdef _WIN32
+        const char *base = std::getenv("LOCALAPPDATA");
+        fs::path dir = base ? fs::path(base) : fs::temp_directory_path();
+#else
+        const char *xdg = std::getenv("XDG_CACHE_HOME");
+        const char *home = std::getenv("HOME");
+        fs::path dir = xdg ? fs::path(xdg) : (home ? fs::path(home) / ".cache" : fs::temp_directory_path());
+#endif
+        return dir / "hruft" / "pmtu.json";
+    }
+
+    static json loadCache() {
+        std::ifstream f(cacheFile());
+        if (!f) return json::object();
+        try {
+            json j = json::parse(f);
+            return j.is_object() ? j : json::object();
+        } catch (const json::exception &) {
+            return json::object();
+        }
+    }
+
+    static void saveCache(const json &cache) {
+        std::error_code ec;
+        fs::path file = cacheFile();
+        fs::create_directories(file.parent_path(), ec);
+        // 先写临时文件再改名，避免并发传输读到半个文件；临时文件名带进程号与序号，
+        // 并发的进程（以及同一进程内的多个作业）各写各的
+        static std::atomic<unsigned> seq{0};
+        fs::path tmp = file;
+#ifdef _WIN32
+        tmp += ".tmp" + std::to_string(GetCurrentProcessId());
+#else
+        tmp += ".tmp" + std::to_string(::getpid());
+#endif
+        tmp += "." + std::to_string(seq++);
+        {
+            std::ofstream f(tmp, std::ios::trunc);
+            if (!f) return;
+            f << cache.dump(2);
+        }
+        fs::rename(tmp, file, ec);
+        if (ec) {
+            fs::remove(tmp, ec);
+        }
+    }
+};
+
+// 本地传输历史：每次传输结束追加一条定长记录（只追加；O_APPEND 下单次 write 是原子的，多作业 / 多进程并发追加安全）。
+// 查询时只读映射整个文件，按 (对端, 方向) 建索引、按完成时间排序；对端此前最近若干次合格传输的中位数即为基线
+class TransferHistory {
+public:
+#pragma pack(push, 1)
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+    };
+
+    struct Record {
+        int64_t timeMs;        // 完成时间（Unix 毫秒）
+        uint64_t bytes;
+        double durationSec;
+        double goodputMbps;    // 文件字节 / 本端计时
+        double rttMs;
+        double retransRatio;
+        uint32_t flags;
+        char role[12];         // send | recv | fetch | serve
+        char transport[8];
+        char peer[56];         // 对端主机（不含端口），超长截断
+    };
+#pragma pack(pop)
+    static_assert(sizeof(Record) == 128, "history record layout changed");
+
+private:
+    fs::path file;
+    const char *base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    std::vector<char> data;  // 没有 mmap，整体读入
+#endif
+    size_t count = 0;
+    std::map<std::pair<std::string, std::string>, std::vector<const Record *>> index;
+
+    template<size_t N>
+    static void copyField(char (&dst)[N], const std::string &src) {
+        size_t n = std::min(src.size(), N - 1);
+        memcpy(dst, src.data(), n);
+        dst[n] = 0;
+    }
+
+    template<size_t N>
+    static std::string field(const char (&src)[N]) {
+        return std::string(src, strnlen(src, N));
+    }
+
+    static double median(std::vector<double> v) {
+        if (v.empty()) return 0.0;
+        std::sort(v.begin(), v.end());
+        size_t mid = v.size() / 2;
+        return v.size() % 2 ? v[mid] : (v[mid - 1] + v[mid]) / 2;
+    }
+
+    void unmap() {
+        index.clear();
+#ifdef _WIN32
+        data.clear();
+#else
+        if (base) {
+            ::munmap(const_cast<char *>(base), length);
+        }
+#endif
+        base = nullptr;
+        length = 0;
+        count = 0;
+    }
+
+public:
+    explicit TransferHistory(const fs::path &f) : file(f) {
+    }
+
+    ~TransferHistory() {
+        unmap();
+    }
+
+    TransferHistory(const TransferHistory &) = delete;
+    TransferHistory &operator=(const TransferHistory &) = delete;
+
+    // 默认位置：$XDG_DATA_HOME/hruft（缺省 ~/.local/share/hruft），Windows 为 %LOCALAPPDATA%\hruft
+    static fs::path defaultFile() {
+#ifdef _WIN32
+        const char *appData = std::getenv("LOCALAPPDATA");
+        fs::path dir = appData ? fs::path(appData) : fs::temp_directory_path();
+#else
+        const char *xdg = std::getenv("XDG_DATA_HOME");
+        const char *home = std::getenv("HOME");
+        fs::path dir = xdg ? fs::path(xdg) : (home ? fs::path(home) / ".local" / "share" : fs::temp_directory_path());
+#endif
+        return dir / "hruft" / "history.bin";
+    }
+
+    // "ip:port" → "ip"：同一对端每次连接的源端口不同，历史按主机归并
+    static std::string host(const std::string &peer) {
+        size_t colon = peer.rfind(':');
+        return colon == std::string::npos ? peer : peer.substr(0, colon);
+    }
+
+    static Record make(const std::string &peer, const std::string &role, const std::string &transport,
+                       uint64_t bytes, double duration, double rttMs, double retrans, bool success) {
+        Record r;
+        memset(&r, 0, sizeof(r));
+        r.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        r.bytes = bytes;
+        r.durationSec = duration;
+        r.goodputMbps = duration > 0 ? bytes * 8.0 / 1e6 / duration : 0.0;
+        r.rttMs = rttMs;
+        r.retransRatio = retrans;
+        r.flags = success ? HISTORY_FLAG_SUCCESS : 0;
+        copyField(r.role, role);
+        copyField(r.transport, transport);
+        copyField(r.peer, peer);
+        return r;
+    }
+
+    // 追加一条记录。新文件先在临时文件里写好文件头再 link 到位（已存在时失败，沿用先创建者的），
+    // 避免并发创建时记录先于文件头落盘；文件头不符（不是历史文件或格式已变）时不写
+    static bool append(const fs::path &f, const Record &r) {
+        std::error_code ec;
+        if (f.has_parent_path()) {
+            fs::create_directories(f.parent_path(), ec);
+        }
+        Header h = {HISTORY_MAGIC, HISTORY_VERSION, sizeof(Record), 0};
+#ifdef _WIN32
+        std::fstream io(f, std::ios::binary | std::ios::in | std::ios::out | std::ios::app);
+        if (!io) {
+            io.open(f, std::ios::binary | std::ios::out | std::ios::app);
+            if (!io) return false;
+        }
+        if (fs::file_size(f, ec) == 0) {
+            io.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        } else {
+            Header cur = {};
+            io.seekg(0);
+            io.read(reinterpret_cast<char *>(&cur), sizeof(cur));
+            if (!io || cur.magic != HISTORY_MAGIC || cur.recordSize != sizeof(Record)) return false;
+        }
+        io.write(reinterpret_cast<const char *>(&r), sizeof(r));
+        return static_cast<bool>(io);
+#else
+        if (!fs::exists(f, ec)) {
+            std::string tmp = f.string() + ".tmp" + std::to_string(::getpid());
+            int t = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (t >= 0) {
+                bool ok = ::write(t, &h, sizeof(h)) == static_cast<ssize_t>(sizeof(h));
+                ::close(t);
+                if (ok) {
+                    ::link(tmp.c_str(), f.c_str());
+                }
+                ::unlink(tmp.c_str());
+            }
+        }
+        int fd = ::open(f.c_str(), O_RDWR | O_APPEND);
+        if (fd < 0) {
+            return false;
+        }
+        Header cur = {};
+        bool ok = ::pread(fd, &cur, sizeof(cur), 0) == static_cast<ssize_t>(sizeof(cur)) &&
+                  cur.magic == HISTORY_MAGIC && cur.recordSize == sizeof(Record) &&
+                  ::write(fd, &r, sizeof(r)) == static_cast<ssize_t>(sizeof(r));
+        ::close(fd);
+        return ok;
+#endif
+    }
+
+    // 只读映射并建索引；文件不存在或文件头不符时返回 false。末尾不完整的记录（正在追加）忽略
+    bool open() {
+        unmap();
+#ifdef _WIN32
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return false;
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        base = data.data();
+        length = data.size();
+#else
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                base = static_cast<const char *>(p);
+                length = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+        Header h = {};
+        if (length >= sizeof(h)) {
+            memcpy(&h, base, sizeof(h));
+        }
+        if (h.magic != HISTORY_MAGIC || h.recordSize != sizeof(Record)) {
+            unmap();
+            return false;
+        }
+
+        count = (length - sizeof(Header)) / sizeof(Record);
+        const Record *recs = reinterpret_cast<const Record *>(base + sizeof(Header));
+        for (size_t i = 0; i < count; ++i) {
+            index[{field(recs[i].peer), field(recs[i].role)}].push_back(&recs[i]);
+        }
+        for (auto &e : index) {
+            std::stable_sort(e.second.begin(), e.second.end(), [](const Record *a, const Record *b) {
+                return a->timeMs < b->timeMs;
+            });
+        }
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    static bool eligible(const Record &r) {
+        return (r.flags & HISTORY_FLAG_SUCCESS) && r.bytes >= HISTORY_MIN_BYTES && r.goodputMbps > 0;
+    }
+
+    // 序列中第 end 条之前最近 HISTORY_WINDOW 次合格传输的中位数
+    static json baseline(const std::vector<const Record *> &series, size_t end) {
+        std::vector<double> rate, rtt, retrans;
+        int64_t since = 0;
+        for (size_t i = end; i-- > 0 && rate.size() < HISTORY_WINDOW;) {
+            if (!eligible(*series[i])) continue;
+            rate.push_back(series[i]->goodputMbps);
+            rtt.push_back(series[i]->rttMs);
+            retrans.push_back(series[i]->retransRatio);
+            since = series[i]->timeMs;
+        }
+        return json::object({
+            {"samples", rate.size()},
+            {"since", rate.empty() ? std::string() : Utils::formatLocalTime(static_cast<std::time_t>(since / 1000))},
+            {"goodput_mbps", median(rate)},
+            {"rtt_ms", median(rtt)},
+            {"retrans_ratio", median(retrans)}
+        });
+    }
+
+    static bool regressed(const json &base, double goodputMbps) {
+        return base.value("samples", static_cast<size_t>(0)) >= HISTORY_MIN_SAMPLES &&
+               goodputMbps < base.value("goodput_mbps", 0.0) * HISTORY_REGRESSION;
+    }
+
+    // 本次传输对照该 (对端, 方向) 的历史基线；没有合格的历史时返回 null
+    json compare(const Record &r) const {
+        auto it = index.find({field(r.peer), field(r.role)});
+        if (it == index.end()) {
+            return json();
+        }
+        json base = baseline(it->second, it->second.size());
+        double ref = base.value("goodput_mbps", 0.0);
+        if (ref <= 0) {
+            return json();
+        }
+        bool comparable = eligible(r);
+        return json::object({
+            {"peer", field(r.peer)},
+            {"role", field(r.role)},
+            {"baseline", base},
+            {
+                "current", json::object({
+                    {"goodput_mbps", r.goodputMbps},
+                    {"rtt_ms", r.rttMs},
+                    {"retrans_ratio", r.retransRatio},
+                    {"comparable", comparable}
+                })
+            },
+            {"change_pct", (r.goodputMbps / ref - 1) * 100},
+            {"regression", comparable && regressed(base, r.goodputMbps)}
+        });
+    }
+
+    // 每个 (对端, 方向) 一行：次数、最近一次与基线、最近 HISTORY_WINDOW 次的走势；
+    // 最近一次合格传输相对此前基线回退时标出。detailed 时逐条列出
+    void print(const std::string &peer, bool detailed) const {
+        static const char *bars[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+        std::ostringstream out;
+        out << "[INFO] Transfer history: " << file.string() << " (" << count << " records)" << std::endl;
+
+        size_t shown = 0, flagged = 0;
+        for (const auto &e : index) {
+            if (!peer.empty() && e.first.first != peer) continue;
+            const std::vector<const Record *> &s = e.second;
+            ++shown;
+
+            size_t last = s.size();
+            for (size_t i = s.size(); i-- > 0;) {
+                if (eligible(*s[i])) {
+                    last = i;
+                    break;
+                }
+            }
+            size_t ok = 0;
+            for (const Record *r : s) ok += (r->flags & HISTORY_FLAG_SUCCESS) ? 1 : 0;
+
+            out << "\n" << e.first.first << " (" << e.first.second << "): " << s.size() << " transfers, "
+                    << s.size() - ok << " failed, last " << Utils::formatLocalTime(s.back()->timeMs / 1000) << std::endl;
+            if (last == s.size()) {
+                out << "  no transfer of at least " << Utils::formatSize(HISTORY_MIN_BYTES)
+                        << " completed yet" << std::endl;
+                continue;
+            }
+
+            std::vector<double> trend;
+            for (size_t i = last + 1; i-- > 0 && trend.size() < HISTORY_WINDOW;) {
+                if (eligible(*s[i])) trend.insert(trend.begin(), s[i]->goodputMbps);
+            }
+            double hi = *std::max_element(trend.begin(), trend.end());
+            std::string spark;
+            for (double v : trend) {
+                spark += bars[std::min(7, static_cast<int>(v / hi * 8))];
+            }
+
+            json base = baseline(s, last);
+            double ref = base.value("goodput_mbps", 0.0);
+            out << std::fixed << std::setprecision(1) << "  last " << s[last]->goodputMbps << " Mbps";
+            if (base.value("samples", static_cast<size_t>(0)) > 0) {
+                out << ", median of previous " << base.value("samples", static_cast<size_t>(0)) << " "
+                        << ref << " Mbps (" << std::showpos << (s[last]->goodputMbps / ref - 1) * 100
+                        << std::noshowpos << "%)";
+            }
+            out << ", trend " << spark << std::endl;
+            if (regressed(base, s[last]->goodputMbps)) {
+                ++flagged;
+                out << "  [WARNING] Regression: " << std::setprecision(0)
+                        << (1 - s[last]->goodputMbps / ref) * 100 << "% slower than the trailing median" << std::endl;
+            }
+
+            if (detailed) {
+                for (size_t i = 0; i < s.size(); ++i) {
+                    const Record &r = *s[i];
+                    out << "    " << Utils::formatLocalTime(r.timeMs / 1000) << "  " << std::setw(10)
+                            << Utils::formatSize(r.bytes) << "  " << std::setprecision(1) << std::setw(9)
+                            << r.goodputMbps << " Mbps  rtt " << std::setprecision(2) << r.rttMs << " ms  retrans "
+                            << r.retransRatio * 100 << "%  " << field(r.transport)
+                            << ((r.flags & HISTORY_FLAG_SUCCESS) ? "" : "  FAILED")
+                            << (eligible(r) && regressed(baseline(s, i), r.goodputMbps) ? "  REGRESSION" : "")
+                            << std::endl;
+                }
+            }
+        }
+
+        if (shown == 0) {
+            out << "[INFO] No transfers recorded" << (peer.empty() ? "" : " for " + peer) << std::endl;
+        } else if (flagged > 0) {
+            out << "\n[WARNING] " << flagged << " peer(s) regressed below " << std::setprecision(0)
+                    << HISTORY_REGRESSION * 100 << "% of their trailing median" << std::endl;
+        }
+        std::cout << out.str();
+    }
+};
+
+// --- 主程序类 ---
+// 发送端速率上限汇总：在线调优、接收端写盘提示等来源各自给出上限，生效值取最小。
+// 生效值写入 UDT_MAXBW（UDT 每次更新发送间隔时强制执行）与自定义控制器的 setRateCap
+class RateCaps {
+    UDTSOCKET sock;
+    ReportingCC *cc;
+    std::mutex mtx;
+    std::map<std::string, double> caps;
+    double effective = 0;
+
+public:
+    RateCaps(UDTSOCKET s, ReportingCC *controller) : sock(s), cc(controller) {
+    }
+
+    // bps == 0 表示撤销该来源的上限；返回 UDT_MAXBW 是否设置成功
+    bool set(const std::string &source, double bps) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (bps > 0) {
+            caps[source] = bps;
+        } else {
+            caps.erase(source);
+        }
+        effective = 0;
+        for (const auto &c : caps) {
+            if (effective <= 0 || c.second < effective) effective = c.second;
+        }
+
+        int64_t maxBw = effective > 0 ? static_cast<int64_t>(effective / 8) : -1;
+        bool applied = UDT::setsockopt(sock, 0, UDT_MAXBW, &maxBw, sizeof(maxBw)) != UDT::ERROR;
+        if (cc) {
+            cc->setRateCap(effective);
+        }
+        return applied;
+    }
+
+    bool hasController() const {
+        return cc != nullptr;
+    }
+
+    double current() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return effective;
+    }
+};
+
+// 线程角色登记：hruft 自己创建的线程在入口处构造一个 Scope，登记 tid → 角色并设置线程名（top -H、perf 中可见），
+// 退出时记下本线程累计的 CPU 时间（线程退出后 /proc/self/task 里就没有它了）。
+// 没有登记的线程都是 UDT 库内部的（收发队列、垃圾回收），资源统计里归为 "udt"
+class ThreadRoles {
+public:
+    struct Finished {
+        uint64_t seq;  // 退出顺序号，供统计区分哪些线程在区间内退出
+        int tid;
+        std::string role;
+        double userSec;
+        double sysSec;
+    };
+
+private:
+    static std::mutex &mtx() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::map<int, std::string> &live() {
+        static std::map<int, std::string> roles;
+        return roles;
+    }
+
+    static std::deque<Finished> &finished() {
+        static std::deque<Finished> done;
+        return done;
+    }
+
+    static uint64_t &finishedSeq() {
+        static uint64_t seq = 0;
+        return seq;
+    }
+
+public:
+
+    static int currentTid() {
+#ifdef __linux__
+        return static_cast<int>(syscall(SYS_gettid));
+#else
+        return 0;
+#endif
+    }
+
+    class Scope {
+        int tid;
+        std::string role;
+
+    public:
+        explicit Scope(const std::string &r, bool rename = true) : tid(currentTid()), role(r) {
+#ifdef __linux__
+            if (rename) {
+                pthread_setname_np(pthread_self(), ("hruft-" + role).substr(0, 15).c_str());
+            }
+#endif
+            std::lock_guard<std::mutex> lk(mtx());
+            live()[tid] = role;
+        }
+
+        ~Scope() {
+            Finished f{0, tid, role, 0, 0};
+#ifdef __linux__
+            rusage ru;
+            if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+                f.userSec = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+                f.sysSec = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+            }
+#endif
+            std::lock_guard<std::mutex> lk(mtx());
+            live().erase(tid);
+            f.seq = ++finishedSeq();
+            finished().push_back(f);
+            // serve 等长期运行的进程只保留最近的记录
+            if (finished().size() > RESOURCE_MAX_FINISHED) {
+                finished().pop_front();
+            }
+        }
+    };
+
+    // 登记表快照（加锁拷贝）
+    static std::map<int, std::string> liveSnapshot() {
+        std::lock_guard<std::mutex> lk(mtx());
+        return live();
+    }
+
+    static std::vector<Finished> finishedSnapshot() {
+        std::lock_guard<std::mutex> lk(mtx());
+        return std::vector<Finished>(finished().begin(), finished().end());
+    }
+
+    static uint64_t finishedCount() {
+        std::lock_guard<std::mutex> lk(mtx());
+        return finishedSeq();
+    }
+};
+
+// 一次传输的 CPU 与内存开销：begin() 到 report() 之间进程的用户态 / 内核态 CPU（getrusage），
+// 按线程角色拆分（/proc/self/task/<tid>/stat 的 utime / stime 差值，期间退出的线程用其退出时的累计值），
+// 峰值 RSS，以及效率：每 CPU 秒搬运的 GB、每字节 CPU 周期（按标称主频估算）。非 Linux 只有进程级数据。
+// 这些数据都是进程级的：区间内有其他传输并发（作业模式）时报告标为 scope = "process"，
+// 并省去按本次字节数折算的效率，避免把别的会话的 CPU 算到本次头上
+class ResourceUsage {
+    struct Times {
+        double userSec = 0;
+        double sysSec = 0;
+    };
+
+    std::chrono::steady_clock::time_point start;
+    Times processStart;
+    std::map<int, Times> threadStart;
+    uint64_t finishedMark = 0;  // begin() 时已退出线程的序号，之前退出的不计入本次
+    bool counted = false;       // 已计入 activeSessions()
+    bool overlapped = false;    // begin() 时已有其他传输在进行
+    uint64_t startedMark = 0;   // begin() 时的 startedSessions()，之后有变化说明区间内有新传输开始
+
+    // 进程内正在统计的传输数与累计开始数
+    static std::atomic<int> &activeSessions() {
+        static std::atomic<int> n{0};
+        return n;
+    }
+
+    static std::atomic<uint64_t> &startedSessions() {
+        static std::atomic<uint64_t> n{0};
+        return n;
+    }
+
+    static Times processTimes() {
+        Times t;
+#ifndef _WIN32
+        rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+            t.userSec = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+            t.sysSec = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        }
+#endif
+        return t;
+    }
+
+    // 当前进程内所有线程的累计 CPU 时间
+    static std::map<int, Times> threadTimes() {
+        std::map<int, Times> all;
+#ifdef __linux__
+        static const double tick = static_cast<double>(sysconf(_SC_CLK_TCK));
+        std::error_code ec;
+        for (const auto &entry : fs::directory_iterator("/proc/self/task", ec)) {
+            std::ifstream in(entry.path() / "stat");
+            std::string line;
+            if (!std::getline(in, line)) continue;
+            // 线程名可能含空格，从最后一个 ')' 之后开始按空格切分：状态为第 3 列，utime / stime 为第 14 / 15 列
+            size_t p = line.rfind(')');
+            if (p == std::string::npos) continue;
+            std::istringstream fields(line.substr(p + 1));
+            std::string f;
+            double utime = 0, stime = 0;
+            for (int col = 3; col <= 15 && (fields >> f); ++col) {
+                if (col == 14) utime = std::atof(f.c_str());
+                if (col == 15) stime = std::atof(f.c_str());
+            }
+            int tid = std::atoi(entry.path().filename().string().c_str());
+            all[tid] = Times{utime / tick, stime / tick};
+        }
+#endif
+        return all;
+    }
+
+    static double peakRssMb() {
+#ifndef _WIN32
+        rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+            return ru.ru_maxrss / 1048576.0;  // macOS 以字节计
+#else
+            return ru.ru_maxrss / 1024.0;     // Linux 以 KB 计
+#endif
+        }
+#endif
+        return 0;
+    }
+
+    static double rssMb() {
+#ifdef __linux__
+        std::ifstream in("/proc/self/statm");
+        long long pages = 0, resident = 0;
+        if (in >> pages >> resident) {
+            return resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / 1048576.0;
+        }
+#endif
+        return 0;
+    }
+
+    // CPU 标称主频（MHz），取不到时为 0
+    static double cpuMhz() {
+#ifdef __linux__
+        std::ifstream maxFreq("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+        double khz = 0;
+        if (maxFreq >> khz && khz > 0) {
+            return khz / 1000;
+        }
+        std::ifstream info("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(info, line)) {
+            if (line.rfind("cpu MHz", 0) == 0) {
+                size_t colon = line.find(':');
+                if (colon != std::string::npos) return std::atof(line.c_str() + colon + 1);
+            }
+        }
+#endif
+        return 0;
+    }
+
+public:
+    ResourceUsage() = default;
+    ResourceUsage(const ResourceUsage &) = delete;
+    ResourceUsage &operator=(const ResourceUsage &) = delete;
+
+    ~ResourceUsage() {
+        if (counted) {
+            activeSessions().fetch_sub(1);
+        }
+    }
+
+    void begin() {
+        if (!counted) {
+            counted = true;
+            overlapped = activeSessions().fetch_add(1) > 0;
+        }
+        startedMark = startedSessions().fetch_add(1) + 1;
+        start = std::chrono::steady_clock::now();
+        processStart = processTimes();
+        threadStart = threadTimes();
+        finishedMark = ThreadRoles::finishedCount();
+    }
+
+    // bytes 为本次传输的文件字节，appBuffers / udtBuffers 为应用块缓冲峰值与 UDT 收发缓冲配置（字节）
+    json report(uint64_t bytes, uint64_t appBuffers, uint64_t udtBuffers) const {
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Times now = processTimes();
+        double user = now.userSec - processStart.userSec;
+        double sys = now.sysSec - processStart.sysSec;
+        double cpu = user + sys;
+
+        // 按角色汇总：仍在运行的线程取差值，期间退出的登记线程取退出时的累计值
+        std::map<std::string, json> roles;
+        auto add = [&](const std::string &role, double u, double s) {
+            json &r = roles[role];
+            if (r.is_null()) {
+                r = json::object({{"threads", 0}, {"user_sec", 0.0}, {"sys_sec", 0.0}, {"max_thread_pct", 0.0}});
+            }
+            r["threads"] = r["threads"].get<int>() + 1;
+            r["user_sec"] = r["user_sec"].get<double>() + u;
+            r["sys_sec"] = r["sys_sec"].get<double>() + s;
+            double pct = wall > 0 ? (u + s) / wall * 100 : 0.0;
+            r["max_thread_pct"] = std::max(r["max_thread_pct"].get<double>(), pct);
+        };
+        std::map<int, std::string> tags = ThreadRoles::liveSnapshot();
+        for (const auto &t : threadTimes()) {
+            auto before = threadStart.find(t.first);
+            Times base = before != threadStart.end() ? before->second : Times();
+            auto tag = tags.find(t.first);
+            add(tag != tags.end() ? tag->second : "udt", t.second.userSec - base.userSec, t.second.sysSec - base.sysSec);
+        }
+        for (const auto &f : ThreadRoles::finishedSnapshot()) {
+            if (f.seq <= finishedMark) continue;
+            auto before = threadStart.find(f.tid);
+            Times base = before != threadStart.end() ? before->second : Times();
+            add(f.role, f.userSec - base.userSec, f.sysSec - base.sysSec);
+        }
+        json threads = json::object();
+        for (auto &r : roles) {
+            r.second["cpu_sec"] = r.second["user_sec"].get<double>() + r.second["sys_sec"].get<double>();
+            threads[r.first] = r.second;
+        }
+
+        double mhz = cpuMhz();
+        bool shared = overlapped || startedSessions().load() != startedMark;
+        json efficiency = json::object({{"cpu_mhz", mhz}});
+        if (!shared) {
+            efficiency["gb_per_cpu_sec"] = cpu > 0 ? bytes / 1e9 / cpu : 0.0;
+            efficiency["cycles_per_byte_est"] = bytes > 0 && mhz > 0 ? cpu * mhz * 1e6 / bytes : 0.0;
+        }
+        json j = json::object({
+            {"scope", shared ? "process" : "session"},
+            {"wall_sec", wall},
+            {"cpu", json::object({
+                {"user_sec", user},
+                {"sys_sec", sys},
+                {"cpu_sec", cpu},
+                {"cores_used", wall > 0 ? cpu / wall : 0.0}
+            })},
+            {"memory", json::object({
+                {"peak_rss_mb", peakRssMb()},
+                {"rss_mb", rssMb()},
+                {"app_buffers_peak_mb", appBuffers / 1048576.0},
+                {"udt_buffers_mb", udtBuffers / 1048576.0}
+            })},
+            {"efficiency", efficiency}
+        });
+        if (!threads.empty()) {
+            j["threads"] = threads;
+        }
+        return j;
+    }
+};
+
+// 发送端读取接收端的写盘速率提示，据此设置 "disk" 速率上限，直到收到结束提示
+class DiskHintListener {
+    UDTSOCKET sock;
+    RateCaps &caps;
+    std::thread worker;
+
+    mutable std::mutex mtx;
+    uint64_t hints = 0;
+    uint64_t limitedHints = 0;
+    double lastBps = 0;
+    double minBps = 0;
+    bool ended = false;
+
+    std::atomic<bool> stopping{false};
+    int savedTimeout = -1;
+
+    // 读取一帧提示；按 DISK_HINT_INTERVAL_MS 超时轮询 stopping，超时前已读到的部分帧保留
+    bool readHint(DiskHint &h) {
+        char *p = (char *) &h;
+        int got = 0;
+        while (got < static_cast<int>(sizeof(h))) {
+            if (stopping.load()) {
+                return false;
+            }
+            int r = UDT::recv(sock, p + got, static_cast<int>(sizeof(h)) - got, 0);
+            if (r == UDT::ERROR) {
+                if (UDT::getsockstate(sock) == CONNECTED) {
+                    continue; // 超时
+                }
+                return false;
+            }
+            got += r;
+        }
+        return true;
+    }
+
+    void loop() {
+        while (true) {
+            DiskHint h;
+            if (!readHint(h) || ntohl(h.magic) != DISK_HINT_MAGIC) {
+                return;
+            }
+            double bps = static_cast<double>(ntohll(h.bits_per_sec));
+            bool final = (ntohl(h.flags) & DISK_HINT_FINAL) != 0;
+            if (!final) {
+                caps.set("disk", bps);
+            }
+
+            std::lock_guard<std::mutex> lk(mtx);
+            if (final) {
+                ended = true;
+                return;
+            }
+            hints++;
+            lastBps = bps;
+            if (bps > 0) {
+                limitedHints++;
+                minBps = (minBps <= 0) ? bps : std::min(minBps, bps);
+            }
+        }
+    }
+
+public:
+    DiskHintListener(UDTSOCKET s, RateCaps &c) : sock(s), caps(c) {
+    }
+
+    // 异常退出时置 stopping，读线程在下一次接收超时时退出；控制连接仍归发送流程所有
+    ~DiskHintListener() {
+        stopping = true;
+        join();
+    }
+
+    void begin() {
+        int len = sizeof(savedTimeout);
+        UDT::getsockopt(sock, 0, UDT_RCVTIMEO, &savedTimeout, &len);
+        int interval = DISK_HINT_INTERVAL_MS;
+        UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &interval, sizeof(int));
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("disk-hints");
+            loop();
+        });
+    }
+
+    // 正常结束：接收端收齐数据后发送结束提示，读线程随之退出
+    void finish() {
+        join();
+    }
+
+private:
+    // 等待读线程并恢复控制连接原有的接收超时（之后的 ACK / 报告读取依赖它）
+    void join() {
+        if (worker.joinable()) {
+            worker.join();
+            UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &savedTimeout, sizeof(int));
+        }
+    }
+
+public:
+
+    json report() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return json::object({
+            {"hints_received", hints},
+            {"disk_limited_hints", limitedHints},
+            {"last_hint_mbps", lastBps / 1e6},
+            {"min_hint_mbps", minBps / 1e6},
+            {"final_received", ended}
+        });
+    }
+};
+
+// 发送端读流水线：读线程按块读取并计算哈希，发送线程取块发送，读盘与网络发送重叠。
+// 深度（在途缓冲块数）与读块大小可在运行期调整；两端的等待时间供在线调优判断瓶颈在读盘还是网络
+class BlockPipeline {
+public:
+    struct Block {
+        std::vector<char> data;
+        int len = 0;
+    };
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<Block> > ready;
+    std::vector<std::unique_ptr<Block> > freeList;
+    int outstanding = 0;  // 已交给读线程、尚未归还的块数
+    int capacity;         // 读块大小上限
+    int64_t memLimit;     // 深度 × 块大小不超过此值
+    bool finished = false;
+    bool aborted = false;
+    std::exception_ptr error;
+
+    std::atomic<int> depth;
+    std::atomic<int> blockSize;
+    std::atomic<uint64_t> consumerWaitUs{0};  // 发送线程等待读盘
+    std::atomic<uint64_t> producerWaitUs{0};  // 读线程等待空闲缓冲（网络更慢）
+    std::atomic<int> readyCount{0};           // 已读好待发的块数（无锁读取，供 --metrics）
+    int64_t allocated = 0;                    // 各块缓冲当前占用的内存（受 mtx 保护）
+    int64_t peakAllocated = 0;
+
+    static uint64_t usSince(std::chrono::steady_clock::time_point t0) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - t0).count());
+    }
+
+public:
+    BlockPipeline(int initialDepth, int initialBlock, int maxBlock, int64_t memoryLimit)
+        : capacity(maxBlock), memLimit(memoryLimit), depth(initialDepth), blockSize(0) {
+        blockSize.store(std::min(initialBlock, maxBlockSize()), std::memory_order_relaxed);
+    }
+
+    // 读线程：取一块空闲缓冲（大小为当前块大小，读满 data.size() 即可）；流水线已满时等待，中止后返回 nullptr
+    std::unique_ptr<Block> acquire() {
+        auto t0 = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [&] { return aborted || outstanding < depth.load(std::memory_order_relaxed); });
+        producerWaitUs.fetch_add(usSince(t0), std::memory_order_relaxed);
+        if (aborted) return nullptr;
+
+        outstanding++;
+        std::unique_ptr<Block> b;
+        if (!freeList.empty()) {
+            b = std::move(freeList.back());
+            freeList.pop_back();
+        } else {
+            b.reset(new Block);
+        }
+        // 块大小变化后按新大小重新分配，缩小时同时归还内存
+        size_t want = static_cast<size_t>(blockSize.load(std::memory_order_relaxed));
+        if (b->data.size() != want) {
+            allocated += static_cast<int64_t>(want) - static_cast<int64_t>(b->data.size());
+            peakAllocated = std::max(peakAllocated, allocated);
+            std::vector<char>(want).swap(b->data);
+        }
+        return b;
+    }
+
+    void push(std::unique_ptr<Block> b) {
+        std::lock_guard<std::mutex> lk(mtx);
+        ready.push_back(std::move(b));
+        readyCount.store(static_cast<int>(ready.size()), std::memory_order_relaxed);
+        cv.notify_all();
+    }
+
+    // 读线程结束（err 非空时发送线程取完已读数据后重新抛出）
+    void finish(std::exception_ptr err = nullptr) {
+        std::lock_guard<std::mutex> lk(mtx);
+        finished = true;
+        error = err;
+        cv.notify_all();
+    }
+
+    // 发送线程：按序取下一块，数据读完返回 nullptr
+    std::unique_ptr<Block> pop() {
+        auto t0 = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [&] { return !ready.empty() || finished || aborted; });
+        consumerWaitUs.fetch_add(usSince(t0), std::memory_order_relaxed);
+        if (!ready.empty()) {
+            std::unique_ptr<Block> b = std::move(ready.front());
+            ready.pop_front();
+            readyCount.store(static_cast<int>(ready.size()), std::memory_order_relaxed);
+            return b;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return nullptr;
+    }
+
+    void release(std::unique_ptr<Block> b) {
+        std::lock_guard<std::mutex> lk(mtx);
+        outstanding--;
+        freeList.push_back(std::move(b));
+        cv.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lk(mtx);
+        aborted = true;
+        cv.notify_all();
+    }
+
+    // 以下两个设置受内存上限约束，返回实际生效的值。两者都在 mtx 下读取对方的当前值再写入，
+    // 发送线程调块大小与调优线程调深度并发时，深度 × 块大小仍不超过 memLimit
+    int setDepth(int d) {
+        std::lock_guard<std::mutex> lk(mtx);
+        int64_t fit = memLimit / std::max(1, blockSize.load(std::memory_order_relaxed));
+        d = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(d, fit)));
+        depth.store(d, std::memory_order_relaxed);
+        cv.notify_all();
+        return d;
+    }
+
+    int setBlockSize(int bytes) {
+        std::lock_guard<std::mutex> lk(mtx);
+        int b = std::min(bytes, maxBlockSize());
+        blockSize.store(b, std::memory_order_relaxed);
+        return b;
+    }
+
+    int getDepth() const { return depth.load(std::memory_order_relaxed); }
+    int getBlockSize() const { return blockSize.load(std::memory_order_relaxed); }
+    int maxBlockSize() const {
+        int64_t fit = memLimit / std::max(1, depth.load(std::memory_order_relaxed));
+        return static_cast<int>(std::max<int64_t>(MIN_BLOCK_SIZE, std::min<int64_t>(capacity, fit)));
+    }
+    int queued() const { return readyCount.load(std::memory_order_relaxed); }
+
+    // 块缓冲内存的峰值（字节）
+    int64_t peakBytes() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return peakAllocated;
+    }
+    uint64_t consumerWait() const { return consumerWaitUs.load(std::memory_order_relaxed); }
+    uint64_t producerWait() const { return producerWaitUs.load(std::memory_order_relaxed); }
+};
+
+// 读写块大小（--block-size）：固定模式只统计；auto 模式起点由探测带宽决定，
+// 之后每 BLOCK_TUNE_INTERVAL_MS 按 UDT::send/recv 的调用开销与本端队列占用调整：
+//   调用固定开销占比（调用次数 × 最短调用耗时 / 周期）偏高，或本端是瓶颈 -> 加倍，摊薄每块开销
+//   开销占比很低且对端是瓶颈（块只是在队列里闲置） -> 减半，省内存
+// 上限由调用方按内存上限给出
+class BlockSizer {
+    bool adaptive;
+    int size;
+    int initial;
+    int smallest;
+    int largest;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point windowStart;
+
+    uint64_t calls = 0, bytes = 0, callUs = 0;
+    uint64_t windowCalls = 0;
+    uint64_t minCallUs = std::numeric_limits<uint64_t>::max();  // 最快的一次调用近似固定开销（阻塞等待的调用不算）
+    json changes = json::array();
+    uint64_t dropped = 0;
+
+public:
+    BlockSizer(int initialBytes, bool auto_)
+        : adaptive(auto_), size(initialBytes), initial(initialBytes), smallest(initialBytes), largest(initialBytes) {
+        start = windowStart = std::chrono::steady_clock::now();
+    }
+
+    // 按探测带宽选起始块：约 BLOCK_PROBE_SPAN_MS 的数据量，取 2 的幂
+    static int fromProbe(double bps, int fallback, int ceiling) {
+        if (bps <= 0) return std::min(fallback, ceiling);
+        double want = bps / 8 * BLOCK_PROBE_SPAN_MS / 1000.0;
+        int b = MIN_BLOCK_SIZE;
+        while (b < MAX_BLOCK_SIZE && b < want) b *= 2;
+        return std::max(MIN_BLOCK_SIZE, std::min(b, ceiling));
+    }
+
+    int current() const { return size; }
+
+    // 计时一次 UDT 收发调用；fn 返回本次收发的字节数（出错时为负）
+    template<class F>
+    int call(F fn) {
+        auto t0 = std::chrono::steady_clock::now();
+        int r = fn();
+        uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - t0).count());
+        calls++;
+        windowCalls++;
+        callUs += us;
+        minCallUs = std::min(minCallUs, us);
+        if (r > 0) bytes += r;
+        return r;
+    }
+
+    double windowSec() const {
+        return std::max(1e-3, std::chrono::duration<double>(std::chrono::steady_clock::now() - windowStart).count());
+    }
+
+    bool due() const {
+        return adaptive && std::chrono::steady_clock::now() - windowStart >= std::chrono::milliseconds(BLOCK_TUNE_INTERVAL_MS);
+    }
+
+    // backlog：周期内本端是瓶颈的比例；idle：对端是瓶颈、块在队列中闲置的比例。返回新的块大小
+    int tick(double backlog, double idle, int ceiling) {
+        auto now = std::chrono::steady_clock::now();
+        double windowUs = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - windowStart).count());
+        double overhead = windowCalls > 0 && windowUs > 0 ? windowCalls * static_cast<double>(minCallUs) / windowUs : 0;
+        windowStart = now;
+        windowCalls = 0;
+        backlog = std::min(1.0, backlog);
+        idle = std::min(1.0, idle);
+
+        int next = size;
+        std::string reason;
+        if ((overhead > BLOCK_OVERHEAD_HIGH || backlog > BLOCK_BACKLOG) && size < ceiling) {
+            next = std::min(size * 2, ceiling);
+            reason = overhead > BLOCK_OVERHEAD_HIGH ? "调用固定开销占 " + std::to_string(static_cast<int>(overhead * 100)) + "%"
+                                                    : "本端瓶颈占 " + std::to_string(static_cast<int>(backlog * 100)) + "%";
+        } else if (overhead < BLOCK_OVERHEAD_LOW && idle > BLOCK_IDLE && size > MIN_BLOCK_SIZE) {
+            next = std::max(size / 2, MIN_BLOCK_SIZE);
+            reason = "对端瓶颈占 " + std::to_string(static_cast<int>(idle * 100)) + "%，块在队列中闲置";
+        } else if (size > ceiling) {
+            next = ceiling;
+            reason = "内存上限";
+        }
+        if (next != size) {
+            if (changes.size() < BLOCK_MAX_CHANGES) {
+                changes.push_back(json::object({
+                    {"t_ms", std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count()},
+                    {"from", size},
+                    {"to", next},
+                    {"overhead", overhead},
+                    {"reason", reason}
+                }));
+            } else {
+                dropped++;
+            }
+            size = next;
+            smallest = std::min(smallest, size);
+            largest = std::max(largest, size);
+        }
+        return size;
+    }
+
+    // 传输开始时的实际起始块（按内存上限收紧后）
+    void begin(int bytes) {
+        size = initial = smallest = largest = bytes;
+        start = windowStart = std::chrono::steady_clock::now();
+    }
+
+    // 调用方按内存上限收紧后的实际值
+    void settle(int applied) {
+        size = applied;
+        smallest = std::min(smallest, size);
+        largest = std::max(largest, size);
+    }
+
+    json report(int64_t memLimit) const {
+        return json::object({
+            {"mode", adaptive ? "auto" : "fixed"},
+            {"initial_bytes", initial},
+            {"final_bytes", size},
+            {"min_bytes", smallest},
+            {"max_bytes", largest},
+            {"memory_limit_bytes", memLimit},
+            {"calls", calls},
+            {"avg_call_us", calls > 0 ? static_cast<double>(callUs) / calls : 0.0},
+            {"avg_call_bytes", calls > 0 ? static_cast<double>(bytes) / calls : 0.0},
+            {"min_call_us", calls > 0 ? minCallUs : 0},
+            {"changes", changes},
+            {"changes_dropped", dropped}
+        });
+    }
+};
+
+// 在线闭环调优（--tune）：传输期间每 intervalMs 采样一次 UDT::perfmon（不清零计数，自行求差），
+// 判断当前状态并调整运行期可改的参数：
+//   loss_burst              周期丢包率超过阈值     -> 速率上限降到周期发送速率 × TUNE_LOSS_BACKOFF
+//   receiver_buffer_starved 对端通告窗口接近耗尽   -> 速率上限钉在周期发送速率，不再往满缓冲里灌
+//   source_backpressure     发送线程主要在等读盘   -> 加深读流水线，深度到顶后加大读块
+//   steady                  连续干净周期后逐步放宽速率上限，超过峰值速率即解除
+// 速率上限以 "tuner" 来源交给 RateCaps，与接收端写盘提示取最小后生效。
+// 每次调整都记入决策日志，随报告输出便于审计
+class LiveTuner {
+    UDTSOCKET sock;
+    RateCaps *caps;
+    BlockPipeline *pipe;
+    int intervalMs;
+    bool blockTunable;  // 读块大小交给 BlockSizer（--block-size auto）时不调
+    int payloadBytes;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    mutable std::mutex logMutex;
+    json decisions = json::array();
+    uint64_t dropped = 0;
+    std::map<std::string, uint64_t> regimes;
+    uint64_t samples = 0;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastSample;
+    int64_t prevSent = 0;
+    int prevLost = 0;
+    uint64_t prevSourceWait = 0;
+    int peakFlowWindow = 0;
+    double peakSendBps = 0;
+    double rateCap = 0;
+    int cleanSamples = 0;
+    double lossAtCut = 0;       // 上次因丢包降速时的丢包率
+    int ineffectiveCuts = 0;    // 降速后丢包率仍未下降的次数
+    bool lossInsensitive = false;  // 判定为非拥塞丢包后不再因丢包降速
+
+    void record(const std::string &regime, const std::string &knob, double from, double to,
+                const std::string &reason, json extra = json::object()) {
+        json d = json::object({
+            {"t_ms", std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count()},
+            {"regime", regime},
+            {"knob", knob},
+            {"from", from},
+            {"to", to},
+            {"reason", reason}
+        });
+        d.update(extra);
+        std::lock_guard<std::mutex> lk(logMutex);
+        if (decisions.size() < TUNE_MAX_DECISIONS) {
+            decisions.push_back(d);
+        } else {
+            dropped++;
+        }
+    }
+
+    // bps == 0 表示解除本来源的上限
+    void applyRateCap(double bps, const std::string &regime, const std::string &reason) {
+        json via = json::array();
+        if (caps->set("tuner", bps)) via.push_back("udt_maxbw");
+        if (caps->hasController()) via.push_back("cc_pacing");
+        record(regime, "rate_cap_mbps", rateCap / 1e6, bps / 1e6, reason,
+               json::object({{"applied", !via.empty()}, {"via", via}}));
+        rateCap = bps;
+    }
+
+    static std::string percent(double v) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << v * 100 << "%";
+        return oss.str();
+    }
+
+    void sample() {
+        UDT::TRACEINFO perf;
+        if (UDT::perfmon(sock, &perf, false) == UDT::ERROR) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - lastSample).count();
+        lastSample = now;
+        if (dt <= 0) return;
+
+        int64_t sent = perf.pktSentTotal - prevSent;
+        int lost = perf.pktSndLossTotal - prevLost;
+        prevSent = perf.pktSentTotal;
+        prevLost = perf.pktSndLossTotal;
+        uint64_t sourceWait = pipe ? pipe->consumerWait() : 0;
+        double sourceWaitRatio = (sourceWait - prevSourceWait) / (dt * 1e6);
+        prevSourceWait = sourceWait;
+
+        double lossRatio = sent > 0 ? static_cast<double>(lost) / sent : 0.0;
+        double sendBps = sent * payloadBytes * 8.0 / dt;
+        peakSendBps = std::max(peakSendBps, sendBps);
+        peakFlowWindow = std::max(peakFlowWindow, perf.pktFlowWindow);
+        bool starved = peakFlowWindow > 0 && perf.pktFlowWindow < peakFlowWindow * TUNE_FLOW_STARVED;
+
+        std::string regime;
+        if (sent <= 0 && sourceWaitRatio < TUNE_SOURCE_WAIT) {
+            regime = "idle";
+        } else if (lossRatio > TUNE_LOSS_BURST) {
+            regime = "loss_burst";
+        } else if (starved) {
+            regime = "receiver_buffer_starved";
+        } else if (sourceWaitRatio > TUNE_SOURCE_WAIT) {
+            regime = "source_backpressure";
+        } else {
+            regime = "steady";
+        }
+        {
+            std::lock_guard<std::mutex> lk(logMutex);
+            regimes[regime]++;
+            samples++;
+        }
+
+        if (regime == "loss_burst" && !lossInsensitive) {
+            cleanSamples = 0;
+            // 降速后丢包率没有下降，说明丢包与发送速率无关（链路误码等），解除上限并不再因丢包降速
+            if (rateCap > 0 && lossRatio >= lossAtCut * TUNE_LOSS_BACKOFF) {
+                ineffectiveCuts++;
+            } else {
+                ineffectiveCuts = 0;
+            }
+            double target = std::max(TUNE_MIN_RATE_BPS, sendBps * TUNE_LOSS_BACKOFF);
+            if (ineffectiveCuts >= 2) {
+                lossInsensitive = true;
+                applyRateCap(0, regime, "连续降速后丢包率仍为 " + percent(lossRatio) + "，判定为非拥塞丢包");
+            } else if (rateCap <= 0 || target < rateCap) {
+                lossAtCut = lossRatio;
+                applyRateCap(target, regime, "周期丢包率 " + percent(lossRatio) + " 超过 " +
+                                             percent(TUNE_LOSS_BURST));
+            }
+        } else if (regime == "receiver_buffer_starved") {
+            cleanSamples = 0;
+            double target = std::max(TUNE_MIN_RATE_BPS, sendBps);
+            if (rateCap <= 0 || target < rateCap * TUNE_LOSS_BACKOFF) {
+                applyRateCap(target, regime, "对端通告窗口 " + std::to_string(perf.pktFlowWindow) +
+                                             " 包，峰值 " + std::to_string(peakFlowWindow) + " 包");
+            }
+        } else if (regime == "source_backpressure" || regime == "steady") {
+            cleanSamples++;
+        }
+
+        if (regime == "source_backpressure" && pipe) {
+            std::string reason = "发送线程 " + percent(std::min(1.0, sourceWaitRatio)) + " 的时间在等待读盘";
+            int depth = pipe->getDepth();
+            int block = pipe->getBlockSize();
+            int next = depth < PIPELINE_MAX_DEPTH ? pipe->setDepth(depth + 1) : depth;
+            if (next != depth) {
+                record(regime, "pipeline_depth", depth, next, reason);
+            } else if (blockTunable && block < pipe->maxBlockSize()) {
+                next = pipe->setBlockSize(std::min(block * 2, pipe->maxBlockSize()));
+                record(regime, "block_bytes", block, next, reason);
+            }
+        }
+
+        // 干净周期：逐步放宽速率上限，超过峰值发送速率一定比例后解除
+        if (rateCap > 0 && cleanSamples >= TUNE_CLEAN_SAMPLES) {
+            double next = rateCap * TUNE_RECOVER_STEP;
+            std::string reason = std::to_string(cleanSamples) + " 个周期无丢包突发与接收缓冲饥饿";
+            applyRateCap(next > peakSendBps * TUNE_RELEASE_RATIO ? 0.0 : next, regime, reason);
+        }
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(intervalMs), [&] { return stopping; })) {
+            lk.unlock();
+            sample();
+            lk.lock();
+        }
+    }
+
+public:
+    LiveTuner(UDTSOCKET s, RateCaps *rateCaps, BlockPipeline *pipeline, int interval, bool tunableBlock)
+        : sock(s), caps(rateCaps), pipe(pipeline), intervalMs(interval), blockTunable(tunableBlock) {
+        int mss = DEFAULT_MSS;
+        int len = sizeof(mss);
+        UDT::getsockopt(s, 0, UDT_MSS, &mss, &len);
+        payloadBytes = std::max(1, mss - UDP_IP_OVERHEAD - 16);  // UDT 数据包头 16 字节
+    }
+
+    ~LiveTuner() {
+        stop();
+    }
+
+    void begin() {
+        UDT::TRACEINFO perf;
+        if (UDT::perfmon(sock, &perf, false) != UDT::ERROR) {
+            prevSent = perf.pktSentTotal;
+            prevLost = perf.pktSndLossTotal;
+        }
+        start = lastSample = std::chrono::steady_clock::now();
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("tuner");
+            loop();
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    json report() const {
+        std::lock_guard<std::mutex> lk(logMutex);
+        json r = json::object({
+            {"interval_ms", intervalMs},
+            {"samples", samples},
+            {"regimes", regimes},
+            {"decisions", decisions},
+            {"decisions_dropped", dropped},
+            {"final", json::object({
+                {"rate_cap_mbps", rateCap / 1e6},
+                {"peak_send_mbps", peakSendBps / 1e6},
+                {"loss_insensitive", lossInsensitive},
+                {"pipeline_depth", pipe ? pipe->getDepth() : 0},
+                {"block_bytes", pipe ? pipe->getBlockSize() : 0}
+            })}
+        });
+        if (pipe) {
+            r["pipeline"] = json::object({
+                {"source_wait_ms", pipe->consumerWait() / 1000.0},
+                {"network_wait_ms", pipe->producerWait() / 1000.0}
+            });
+        }
+        return r;
+    }
+};
+
+// 截止时间调度（--deadline）：每 DEADLINE_REPLAN_MS 按剩余字节与剩余时间重算最低所需速率，
+// 以 (1 + DEADLINE_HEADROOM) 倍作为 RateCaps 的 "deadline" 上限，只跑到刚好够用、不挤占其他流量；
+// 周期实际速率低于所需速率（链路给不了计划速率）或已过截止时间时升级为全速，
+// 重新领先足够多后回到计划速率。每次重算记录一个计划 / 实际曲线点，随报告输出
+class DeadlinePlanner {
+    UDTSOCKET sock;
+    int payloadBytes;
+    RateCaps *caps;
+    const std::atomic<uint64_t> &progress;
+    uint64_t total;
+    std::time_t deadlineWall;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point lastTick;
+    uint64_t lastBytes = 0;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    mutable std::mutex mtx;
+    json points = json::array();
+    uint64_t ticks = 0;
+    uint64_t stride = 1;  // 曲线点超过上限时抽稀，之后每 stride 次重算记录一次
+    bool escalated = false;
+    uint64_t escalations = 0;
+    double initialRequired = 0;
+    double target = 0;
+    double smoothed = 0;  // 实际速率的平滑值：应用层按块计数，单个周期的速率有量化抖动
+    double finishMargin = 0;
+    bool finished = false;
+
+    static double seconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    // 已上线的字节数：应用层按 4MB 块交给 UDT，计数太粗，优先用 perfmon 的首发包数估算；
+    // 取不到时退回应用层计数
+    uint64_t sentBytes() {
+        uint64_t handed = progress.load(std::memory_order_relaxed);
+        UDT::TRACEINFO perf;
+        if (UDT::perfmon(sock, &perf, false) == UDT::ERROR || perf.pktSentTotal <= 0) {
+            return handed;
+        }
+        uint64_t wire = static_cast<uint64_t>(perf.pktSentTotal - perf.pktRetransTotal) * payloadBytes;
+        return std::min(wire, handed);
+    }
+
+    // final 为 true 时只记录终点（接收端已确认收齐）
+    void tick(bool final = false) {
+        auto now = std::chrono::steady_clock::now();
+        double left = seconds(deadline - now);
+        double dt = seconds(now - lastTick);
+        uint64_t done = sentBytes();
+        double actual = (ticks > 0 && dt > 0) ? (done - lastBytes) * 8.0 / dt : 0.0;
+        lastBytes = done;
+        lastTick = now;
+
+        uint64_t remaining = total > done ? total - done : 0;
+        double required = left > 0 ? remaining * 8.0 / left : 0.0;
+
+        std::lock_guard<std::mutex> lk(mtx);
+        if (ticks == 1) {
+            smoothed = actual;
+        } else if (ticks > 1) {
+            smoothed += DEADLINE_SMOOTHING * (actual - smoothed);
+        }
+
+        if (final) {
+            escalated = false;
+        } else if (left <= 0 && remaining > 0) {
+            if (!escalated) escalations++;
+            escalated = true;
+        } else if (!escalated && ticks > 0 && smoothed < required) {
+            escalated = true;
+            escalations++;
+        } else if (escalated && left > 0 && smoothed > required * (1 + 2 * DEADLINE_HEADROOM)) {
+            escalated = false;
+        }
+
+        if (final || remaining == 0) {
+            target = 0;
+        } else {
+            target = escalated ? 0.0 : std::max(TUNE_MIN_RATE_BPS, required * (1 + DEADLINE_HEADROOM));
+        }
+        caps->set("deadline", target);
+
+        // 原始计划：从开始到截止时间匀速完成
+        double span = seconds(deadline - start);
+        double planned = span > 0 ? std::min(1.0, seconds(now - start) / span) * total : total;
+        if (ticks % stride == 0) {
+            points.push_back(json::object({
+                {"t_s", seconds(now - start)},
+                {"sent_bytes", done},
+                {"plan_bytes", static_cast<uint64_t>(planned)},
+                {"required_mbps", required / 1e6},
+                {"target_mbps", target / 1e6},
+                {"actual_mbps", actual / 1e6},
+                {"smoothed_mbps", smoothed / 1e6},
+                {"escalated", escalated}
+            }));
+            if (points.size() >= DEADLINE_MAX_POINTS) {
+                json thinned = json::array();
+                for (size_t i = 0; i < points.size(); i += 2) thinned.push_back(points[i]);
+                points = thinned;
+                stride *= 2;
+            }
+        }
+        ticks++;
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(DEADLINE_REPLAN_MS), [&] { return stopping; })) {
+            lk.unlock();
+            tick();
+            lk.lock();
+        }
+    }
+
+public:
+    DeadlinePlanner(UDTSOCKET s, RateCaps *rateCaps, const std::atomic<uint64_t> &handedBytes,
+                    uint64_t totalBytes, std::time_t when)
+        : sock(s), caps(rateCaps), progress(handedBytes), total(totalBytes), deadlineWall(when) {
+        int mss = DEFAULT_MSS;
+        int len = sizeof(mss);
+        UDT::getsockopt(s, 0, UDT_MSS, &mss, &len);
+        payloadBytes = std::max(1, mss - UDP_IP_OVERHEAD - 16);
+    }
+
+    ~DeadlinePlanner() {
+        stop();
+    }
+
+    // 返回按计划所需的初始速率（bit/s），已过截止时间时为 0
+    double begin() {
+        start = lastTick = std::chrono::steady_clock::now();
+        deadline = start + std::chrono::seconds(deadlineWall - std::time(nullptr));
+        double span = seconds(deadline - start);
+        initialRequired = span > 0 ? total * 8.0 / span : 0.0;
+        tick();
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("deadline");
+            loop();
+        });
+        return initialRequired;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        // 记录终点并撤销上限
+        tick(true);
+        caps->set("deadline", 0);
+        std::lock_guard<std::mutex> lk(mtx);
+        finishMargin = seconds(deadline - std::chrono::steady_clock::now());
+        finished = progress.load(std::memory_order_relaxed) >= total;
+    }
+
+    json report() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return json::object({
+            {"deadline", Utils::formatLocalTime(deadlineWall)},
+            {"initial_required_mbps", initialRequired / 1e6},
+            {"headroom", DEADLINE_HEADROOM},
+            {"replan_interval_ms", DEADLINE_REPLAN_MS},
+            {"replans", ticks},
+            {"escalations", escalations},
+            {"met", finished && finishMargin >= 0},
+            {"finish_margin_sec", finishMargin},
+            {"points", points}
+        });
+    }
+};
+
+// Chrome 轨迹（--trace）：每个线程写自己的缓冲（首次记录时登记一次，之后只是追加，无锁），结束时统一写出
+// Chrome trace-event JSON，可在 Perfetto / chrome://tracing 中打开。各阶段每次调用是一个 X 事件，
+// 线程按记录过的阶段命名；采样线程按周期记录速率、RTT 与缓冲占用的计数器轨迹
+class TraceLog {
+    struct Span {
+        const char *name;
+        uint64_t startNs;
+        uint64_t durNs;
+        uint64_t offset;  // 该阶段此前累计的字节数，即本块在流中的位置
+        uint64_t bytes;
+    };
+
+    struct Buffer {
+        int tid;
+        std::vector<Span> spans;
+        uint64_t dropped;
+    };
+
+    struct Sample {
+        std::string name;
+        char phase;  // 'C' 计数器 / 'i' 瞬时事件
+        uint64_t tNs;
+        json args;
+    };
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> ids{1};
+        return ids.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const uint64_t id = nextId();
+    std::string role;
+    UDTSOCKET sock;
+    uint64_t startNs;
+    std::atomic<uint64_t> bytes{0};
+
+    std::mutex mtx;
+    std::vector<std::unique_ptr<Buffer> > buffers;
+    std::vector<Sample> samples;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    // 本线程在本实例中的缓冲；线程局部缓存记住最近一次使用的实例
+    Buffer *local() {
+        struct Cache {
+            uint64_t owner = 0;
+            Buffer *buf = nullptr;
+        };
+        static thread_local Cache cache;
+        if (cache.owner != id) {
+            std::lock_guard<std::mutex> lk(mtx);
+            buffers.emplace_back(new Buffer{static_cast<int>(buffers.size()) + 1, {}, 0});
+            cache.owner = id;
+            cache.buf = buffers.back().get();
+        }
+        return cache.buf;
+    }
+
+    double tsUs(uint64_t ns) const {
+        return (ns - startNs) / 1e3;
+    }
+
+    void run() {
+        bool sending = (role == "sender");
+        int bufBytes = 0;
+        int len = sizeof(bufBytes);
+        if (sock != UDT::INVALID_SOCK) {
+            UDT::getsockopt(sock, 0, sending ? UDT_SNDBUF : UDT_RCVBUF, &bufBytes, &len);
+        }
+        uint64_t lastNs = startNs;
+        uint64_t lastBytes = 0;
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(TRACE_COUNTER_MS), [&] { return stopping; })) {
+            uint64_t t = now();
+            uint64_t b = bytes.load(std::memory_order_relaxed);
+            counter("rate", t, json::object({{"mbps", t > lastNs ? (b - lastBytes) * 8e3 / (t - lastNs) : 0.0}}));
+            lastNs = t;
+            lastBytes = b;
+
+            UDT::TRACEINFO p;
+            if (sock == UDT::INVALID_SOCK || UDT::perfmon(sock, &p, false) == UDT::ERROR) {
+                continue;
+            }
+            int avail = sending ? p.byteAvailSndBuf : p.byteAvailRcvBuf;
+            counter("rtt", t, json::object({{"ms", p.msRTT}}));
+            counter("buffer_fill", t, json::object({
+                {sending ? "udt_snd_mb" : "udt_rcv_mb", std::max(0, bufBytes - avail) / 1e6}
+            }));
+            counter("flight", t, json::object({{"pkts", p.pktFlightSize}}));
+        }
+    }
+
+public:
+    TraceLog(const std::string &r, UDTSOCKET s) : role(r), sock(s), startNs(now()) {
+    }
+
+    ~TraceLog() {
+        stop();
+    }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void begin() {
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("trace");
+            run();
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    // 已传字节数，数据路径与进度共用一次原子写
+    void setBytes(uint64_t n) {
+        bytes.store(n, std::memory_order_relaxed);
+    }
+
+    void span(const char *name, uint64_t t0, uint64_t durNs, uint64_t offset, uint64_t n) {
+        Buffer *b = local();
+        if (b->spans.size() >= TRACE_MAX_SPANS) {
+            b->dropped++;
+            return;
+        }
+        b->spans.push_back(Span{name, t0, durNs, offset, n});
+    }
+
+    void counter(const std::string &name, uint64_t t, json args) {
+        std::lock_guard<std::mutex> lk(mtx);
+        samples.push_back(Sample{name, 'C', t, std::move(args)});
+    }
+
+    void instant(const std::string &name, uint64_t t, json args) {
+        std::lock_guard<std::mutex> lk(mtx);
+        samples.push_back(Sample{name, 'i', t, std::move(args)});
+    }
+
+    // 写出轨迹文件（须在各数据线程结束后调用），返回事件数；打不开文件时返回 -1
+    long write(const std::string &path) {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        long n = 0;
+        auto emit = [&](const json &e) {
+            out << (n++ ? ",\n" : "") << e.dump();
+        };
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        emit(json::object({{"ph", "M"}, {"name", "process_name"}, {"pid", 1}, {"args", {{"name", "hruft " + role}}}}));
+        uint64_t dropped = 0;
+        for (const auto &b : buffers) {
+            std::set<std::string> names;
+            for (const Span &s : b->spans) names.insert(s.name);
+            std::string label;
+            for (const auto &name : names) label += (label.empty() ? "" : "+") + name;
+            emit(json::object({{"ph", "M"}, {"name", "thread_name"}, {"pid", 1}, {"tid", b->tid},
+                               {"args", {{"name", label}}}}));
+            for (const Span &s : b->spans) {
+                emit(json::object({
+                    {"ph", "X"}, {"cat", "stage"}, {"name", s.name}, {"pid", 1}, {"tid", b->tid},
+                    {"ts", tsUs(s.startNs)}, {"dur", s.durNs / 1e3},
+                    {"args", {{"offset", s.offset}, {"bytes", s.bytes}}}
+                }));
+            }
+            dropped += b->dropped;
+        }
+        for (const Sample &s : samples) {
+            if (s.tNs < startNs) continue;
+            json e = json::object({{"ph", std::string(1, s.phase)}, {"name", s.name}, {"pid", 1},
+                                   {"ts", tsUs(s.tNs)}, {"args", s.args}});
+            if (s.phase == 'i') e["s"] = "p";
+            emit(e);
+        }
+        out << "\n],\"otherData\":" << json::object({{"role", role}, {"dropped_spans", dropped}}).dump() << "}\n";
+        return out ? n : -1;
+    }
+};
+
+// 硬件性能计数器（--perf-counters，仅 Linux）：每个线程第一次计时时用 perf_event_open 打开一组只统计用户态的
+// 计数器（cycles 为组长，instructions、LLC 未命中同组读取），阶段调用前后各读一次，差值计入该阶段；
+// 上下文切换取 getrusage(RUSAGE_THREAD)，不需要权限。打不开（perf_event_paranoid、容器 seccomp、
+// 虚拟机没有 PMU）时只记录原因，之后不再尝试，计时与上下文切换照常
+class PerfCounters {
+public:
+    struct Values {
+        bool hardware = false;
+        bool cache = false;  // LLC 未命中计数器可用
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t llcMisses = 0;
+        uint64_t ctxSwitches = 0;
+    };
+
+private:
+    // 线程结束时关闭本线程的计数器
+    struct Group {
+        std::vector<int> fds;
+        bool tried = false;
+
+        ~Group() {
+#ifdef __linux__
+            for (int fd : fds) ::close(fd);
+#endif
+        }
+    };
+
+    static std::mutex &statusMutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::string &failure() {
+        static std::string reason;
+        return reason;
+    }
+
+    static std::atomic<bool> &failed() {
+        static std::atomic<bool> f{false};
+        return f;
+    }
+
+    static void fail(const std::string &reason) {
+        std::lock_guard<std::mutex> lk(statusMutex());
+        if (!failed().load()) {
+            failure() = reason;
+            failed().store(true);
+        }
+    }
+
+#ifdef __linux__
+    static int open(uint64_t config, int leader) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+    }
+
+    static std::string paranoid() {
+        std::ifstream in("/proc/sys/kernel/perf_event_paranoid");
+        std::string level;
+        return (in >> level) ? " (kernel.perf_event_paranoid=" + level + ")" : "";
+    }
+#endif
+
+    static Group &group() {
+        static thread_local Group g;
+        if (g.tried || failed().load(std::memory_order_relaxed)) return g;
+        g.tried = true;
+#ifdef __linux__
+        int leader = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (leader < 0) {
+            int err = errno;
+            fail(std::string("perf_event_open: ") + strerror(err) +
+                 (err == EACCES || err == EPERM ? paranoid() : err == ENOENT || err == ENODEV ? " (no hardware PMU)" : ""));
+            return g;
+        }
+        g.fds.push_back(leader);
+        int fd = open(PERF_COUNT_HW_INSTRUCTIONS, leader);
+        if (fd < 0) {
+            fail(std::string("perf_event_open(instructions): ") + strerror(errno));
+            return g;
+        }
+        g.fds.push_back(fd);
+        // LLC 未命中在部分虚拟机上没有，缺失时只少这一项
+        fd = open(PERF_COUNT_HW_CACHE_MISSES, leader);
+        if (fd >= 0) g.fds.push_back(fd);
+#else
+        fail("perf_event_open is only available on Linux");
+#endif
+        return g;
+    }
+
+public:
+    // 在调用线程上试开一次，返回是否可用
+    static bool probe() {
+        read();
+        return !failed().load();
+    }
+
+    static Values read() {
+        Values v;
+#ifdef __linux__
+        Group &g = group();
+        if (g.fds.size() >= 2) {
+            uint64_t buf[4] = {0, 0, 0, 0};
+            ssize_t want = static_cast<ssize_t>((1 + g.fds.size()) * sizeof(uint64_t));
+            if (::read(g.fds[0], buf, sizeof(buf)) == want && buf[0] == g.fds.size()) {
+                v.hardware = true;
+                v.cache = g.fds.size() > 2;
+                v.cycles = buf[1];
+                v.instructions = buf[2];
+                v.llcMisses = buf[3];
+            }
+        }
+        rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+            v.ctxSwitches = static_cast<uint64_t>(ru.ru_nvcsw + ru.ru_nivcsw);
+        }
+#endif
+        return v;
+    }
+
+    static json status() {
+        std::lock_guard<std::mutex> lk(statusMutex());
+        json j = json::object({{"hardware", !failed().load()}});
+        if (failed().load()) j["reason"] = failure();
+        return j;
+    }
+
+    // BLAKE3 运行时会选中的 SIMD 路径：按 libblake3 的派发规则自行检测 CPU 与操作系统支持
+    // （库的 blake3_simd_degree 属内部接口，不随公开头文件发布）。degree 为一次并行压缩的块数；
+    // 库在编译时关闭了某条路径（如 BLAKE3_NO_AVX512）时实际会退到下一档
+    static json blake3Dispatch() {
+        size_t degree = 1;
+        const char *isa = "portable";
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        unsigned r1[4] = {0, 0, 0, 0}, r7[4] = {0, 0, 0, 0};
+        unsigned maxLeaf;
+        uint64_t xcr0 = 0;
+#ifdef _MSC_VER
+        int regs[4];
+        __cpuid(regs, 0);
+        maxLeaf = static_cast<unsigned>(regs[0]);
+        __cpuidex(regs, 1, 0);
+        for (int i = 0; i < 4; ++i) r1[i] = static_cast<unsigned>(regs[i]);
+        if (maxLeaf >= 7) {
+            __cpuidex(regs, 7, 0);
+            for (int i = 0; i < 4; ++i) r7[i] = static_cast<unsigned>(regs[i]);
+        }
+        if (r1[2] & (1u << 27)) xcr0 = _xgetbv(0);
+#else
+        maxLeaf = __get_cpuid_max(0, nullptr);
+        __cpuid_count(1, 0, r1[0], r1[1], r1[2], r1[3]);
+        if (maxLeaf >= 7) __cpuid_count(7, 0, r7[0], r7[1], r7[2], r7[3]);
+        if (r1[2] & (1u << 27)) {
+            unsigned lo, hi;
+            __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            xcr0 = (static_cast<uint64_t>(hi) << 32) | lo;
+        }
+#endif
+        bool ymm = (xcr0 & 0x6) == 0x6;    // OSXSAVE 且操作系统保存 XMM/YMM 状态
+        bool zmm = (xcr0 & 0xE6) == 0xE6;  // 另保存 opmask 与 ZMM 状态
+        if (zmm && (r7[1] & (1u << 16)) && (r7[1] & (1u << 31))) {  // AVX512F + AVX512VL
+            degree = 16;
+            isa = "avx512";
+        } else if (ymm && (r7[1] & (1u << 5))) {                    // AVX2
+            degree = 8;
+            isa = "avx2";
+        } else if ((r1[2] & (1u << 19)) || (r1[3] & (1u << 26))) {   // SSE4.1 / SSE2
+            degree = 4;
+            isa = "sse";
+        }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        degree = 4;  // AArch64 必有 NEON
+        isa = "neon";
+#elif defined(__arm__) && defined(__linux__) && defined(HWCAP_NEON)
+        if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+            degree = 4;
+            isa = "neon";
+        }
+#endif
+        return json::object({{"simd_degree", degree}, {"isa", isa}});
+    }
+};
+
+// 单个阶段的耗时直方图（HDR 式对数-线性分桶，单位 ns）：
+// 小于 16ns 的值各占一桶，之后每个 2 的幂区间均分 16 个子桶，只用原子计数，记录无锁、可随时读取
+class StageHistogram {
+    static const int SUB = 1 << STAGE_SUB_BITS;
+    static const int BUCKETS = (STAGE_MAX_EXP - STAGE_SUB_BITS + 2) * SUB;
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> sumNs{0};
+    std::atomic<uint64_t> maxNs{0};
+
+    TraceLog *trace = nullptr;
+    const char *traceName = "";
+
+    // --perf-counters：各次调用的计数器差值累计
+    bool counting = false;
+    std::atomic<uint64_t> cycles{0};
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint64_t> llcMisses{0};
+    std::atomic<uint64_t> ctxSwitches{0};
+    std::atomic<bool> hardware{false};
+    std::atomic<bool> cache{false};
+
+    // 计时起点：时间戳与（--perf-counters 时）本线程计数器读数；读计数器的系统调用不计入耗时
+    struct Mark {
+        PerfCounters::Values c0;
+        uint64_t t0;
+    };
+
+    Mark mark() const {
+        PerfCounters::Values c0 = counting ? PerfCounters::read() : PerfCounters::Values();
+        return Mark{c0, now()};
+    }
+
+    void finish(const Mark &m, uint64_t n) {
+        uint64_t ns = now() - m.t0;
+        uint64_t offset = record(ns, n);
+        if (counting) {
+            PerfCounters::Values c1 = PerfCounters::read();
+            if (c1.hardware && m.c0.hardware) {
+                cycles.fetch_add(c1.cycles - m.c0.cycles, std::memory_order_relaxed);
+                instructions.fetch_add(c1.instructions - m.c0.instructions, std::memory_order_relaxed);
+                hardware.store(true, std::memory_order_relaxed);
+                if (c1.cache) {
+                    llcMisses.fetch_add(c1.llcMisses - m.c0.llcMisses, std::memory_order_relaxed);
+                    cache.store(true, std::memory_order_relaxed);
+                }
+            }
+            ctxSwitches.fetch_add(c1.ctxSwitches - m.c0.ctxSwitches, std::memory_order_relaxed);
+        }
+        if (trace) trace->span(traceName, m.t0, ns, offset, n);
+    }
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < static_cast<uint64_t>(SUB)) return static_cast<int>(ns);
+        int exp = STAGE_SUB_BITS;
+        while (exp < 63 && (ns >> (exp + 1)) != 0) exp++;
+        if (exp > STAGE_MAX_EXP) return BUCKETS - 1;
+        int sub = static_cast<int>((ns >> (exp - STAGE_SUB_BITS)) & (SUB - 1));
+        return (exp - STAGE_SUB_BITS + 1) * SUB + sub;
+    }
+
+    // 桶的上界（报告分位数时取上界，偏保守）
+    static uint64_t upperOf(int bucket) {
+        if (bucket < SUB) return static_cast<uint64_t>(bucket);
+        int exp = bucket / SUB + STAGE_SUB_BITS - 1;
+        uint64_t sub = static_cast<uint64_t>(bucket % SUB);
+        return ((SUB + sub + 1) << (exp - STAGE_SUB_BITS)) - 1;
+    }
+
+public:
+    StageHistogram() {
+        for (auto &c : counts) c.store(0, std::memory_order_relaxed);
+    }
+
+    // 与 Chrome 轨迹共用同一时钟，计时的起点可直接作为轨迹时间戳
+    static uint64_t now() {
+        return TraceLog::now();
+    }
+
+    // 记录一次耗时，返回此前累计的字节数
+    uint64_t record(uint64_t ns, uint64_t n) {
+        counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        calls.fetch_add(1, std::memory_order_relaxed);
+        uint64_t offset = bytes.fetch_add(n, std::memory_order_relaxed);
+        sumNs.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = maxNs.load(std::memory_order_relaxed);
+        while (ns > m && !maxNs.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {
+        }
+        return offset;
+    }
+
+    // 计时的调用同时写入 Chrome 轨迹（--trace 时）
+    void traceTo(TraceLog *t, const char *name) {
+        trace = t;
+        traceName = name;
+    }
+
+    // 计时的调用同时累计硬件计数器（--perf-counters 时）
+    void countHardware() {
+        counting = true;
+    }
+
+    // 计时一次收发 / 读盘调用；fn 返回字节数（出错时为负，不计字节）
+    template<class F>
+    int timed(F fn) {
+        Mark m = mark();
+        int r = fn();
+        finish(m, r > 0 ? static_cast<uint64_t>(r) : 0);
+        return r;
+    }
+
+    // 计时一次已知字节数的操作（写盘、哈希）
+    template<class F>
+    void timed(uint64_t n, F fn) {
+        Mark m = mark();
+        fn();
+        finish(m, n);
+    }
+
+    uint64_t callCount() const { return calls.load(std::memory_order_relaxed); }
+    uint64_t byteCount() const { return bytes.load(std::memory_order_relaxed); }
+    uint64_t busyNs() const { return sumNs.load(std::memory_order_relaxed); }
+    uint64_t maxLatencyNs() const { return maxNs.load(std::memory_order_relaxed); }
+
+    // 第 q 分位（0~1，最近秩）的耗时上界，单位 ns
+    uint64_t percentile(double q) const {
+        uint64_t total = 0;
+        for (const auto &c : counts) total += c.load(std::memory_order_relaxed);
+        if (total == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(upperOf(i), maxLatencyNs());
+        }
+        return maxLatencyNs();
+    }
+
+    // 计数器汇总：IPC、每周期字节数、每 MB 的 LLC 未命中；没有硬件计数器时只有上下文切换
+    json counters() const {
+        json j = json::object({{"ctx_switches", ctxSwitches.load(std::memory_order_relaxed)}});
+        uint64_t cyc = cycles.load(std::memory_order_relaxed);
+        if (!hardware.load(std::memory_order_relaxed) || cyc == 0) {
+            return j;
+        }
+        uint64_t ins = instructions.load(std::memory_order_relaxed);
+        uint64_t n = byteCount();
+        j["cycles"] = cyc;
+        j["instructions"] = ins;
+        j["ipc"] = static_cast<double>(ins) / cyc;
+        j["bytes_per_cycle"] = static_cast<double>(n) / cyc;
+        if (cache.load(std::memory_order_relaxed)) {
+            uint64_t llc = llcMisses.load(std::memory_order_relaxed);
+            j["llc_misses"] = llc;
+            j["llc_misses_per_mb"] = n > 0 ? llc / (n / 1048576.0) : 0.0;
+        }
+        return j;
+    }
+
+    json report(double wallSec) const {
+        uint64_t n = callCount();
+        double busySec = busyNs() / 1e9;
+        json j = json::object({
+            {"calls", n},
+            {"bytes", byteCount()},
+            {"p50_us", percentile(0.50) / 1e3},
+            {"p99_us", percentile(0.99) / 1e3},
+            {"max_us", maxLatencyNs() / 1e3},
+            {"mean_us", n > 0 ? busyNs() / 1e3 / n : 0.0},
+            {"busy_pct", wallSec > 0 ? std::min(100.0, busySec / wallSec * 100) : 0.0},
+            {"busy_mbps", busySec > 0 ? byteCount() * 8.0 / 1e6 / busySec : 0.0}
+        });
+        if (counting) {
+            j["counters"] = counters();
+        }
+        return j;
+    }
+};
+
+// 一端数据面各阶段的直方图：read / hash / send（发送端），recv / hash / write（接收端）。
+// 墙钟时间从 begin() 到 stop()，busy_pct = 阶段累计耗时 / 墙钟时间
+class StageStats {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    bool running = false;
+    bool counting = false;
+
+public:
+    StageHistogram read, hash, send, recv, write;
+
+    void begin() {
+        start = std::chrono::steady_clock::now();
+        running = true;
+    }
+
+    void stop() {
+        if (running) end = std::chrono::steady_clock::now();
+        running = false;
+    }
+
+    double wallSec() const {
+        return std::chrono::duration<double>((running ? std::chrono::steady_clock::now() : end) - start).count();
+    }
+
+    // 各阶段同时累计硬件计数器；须在数据线程开始前调用
+    void countHardware() {
+        counting = true;
+        for (StageHistogram *h : {&read, &hash, &send, &recv, &write}) h->countHardware();
+    }
+
+    // 各阶段的计时同时写入 Chrome 轨迹；须在数据线程开始前调用
+    void attach(TraceLog *t) {
+        read.traceTo(t, "read");
+        hash.traceTo(t, "hash");
+        send.traceTo(t, "send");
+        recv.traceTo(t, "recv");
+        write.traceTo(t, "write");
+    }
+
+    // 只输出用到的阶段；都没用到时返回 null
+    json report() const {
+        double wall = wallSec();
+        json j = json::object({{"wall_sec", wall}});
+        const std::pair<const char *, const StageHistogram *> all[] = {
+            {"read", &read}, {"hash", &hash}, {"send", &send}, {"recv", &recv}, {"write", &write}
+        };
+        bool any = false;
+        for (const auto &s : all) {
+            if (s.second->callCount() == 0) continue;
+            j[s.first] = s.second->report(wall);
+            any = true;
+        }
+        if (hash.callCount() > 0) {
+            j["blake3"] = PerfCounters::blake3Dispatch();
+        }
+        if (counting) {
+            j["perf_counters"] = PerfCounters::status();
+        }
+        return any ? j : json();
+    }
+};
+
+// 拥塞控制事件录制：UDT 在收到 ACK / NAK 或超时时回调控制器，录制器在回调线程内把事件写入固定容量的
+// 环形缓冲——写入只占一次原子自增，每个槽带序号（seqlock），读取方跳过已被覆盖或正在写的槽，
+// 回调路径上没有锁。RTT 与相邻两次 RTT 之差（抖动）另记入直方图，环形缓冲被覆盖不影响分布统计
+class CcRecorder {
+public:
+    enum Kind : uint8_t { ACK = 1, LOSS, TIMEOUT };
+
+    struct Event {
+        uint64_t tNs;          // steady_clock 时间戳
+        Kind kind;
+        bool changed;          // 本次回调改变了发送间隔或拥塞窗口
+        int32_t value;         // ACK：确认序号；LOSS：本次报告的丢包数
+        int32_t ranges;        // LOSS：丢包列表长度（UDT 区间编码后的元素数）
+        int32_t rttUs;         // 回调时控制器看到的（平滑）RTT
+        int32_t bandwidthPps;  // UDT 估计的链路容量，包/秒
+        double periodUs;       // 回调后的发送间隔
+        double cwnd;           // 回调后的拥塞窗口，包
+    };
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq{0};  // 2i+1：正在写第 i 个事件；2i+2：已写完
+        Event ev;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head{0};
+    uint64_t startNs;
+
+    StageHistogram rtt, jitter;  // 直方图单位沿用 ns
+    std::atomic<int32_t> lastRtt{0};
+    std::atomic<uint64_t> acks{0}, losses{0}, lostPkts{0}, timeouts{0}, changes{0};
+
+    static json distribution(const StageHistogram &h) {
+        uint64_t n = h.callCount();
+        return json::object({
+            {"samples", n},
+            {"p50_ms", h.percentile(0.50) / 1e6},
+            {"p90_ms", h.percentile(0.90) / 1e6},
+            {"p99_ms", h.percentile(0.99) / 1e6},
+            {"max_ms", h.maxLatencyNs() / 1e6},
+            {"mean_ms", n > 0 ? h.busyNs() / 1e6 / n : 0.0}
+        });
+    }
+
+public:
+    CcRecorder() : slots(new Slot[CC_TRACE_EVENTS]), startNs(StageHistogram::now()) {
+    }
+
+    void record(Kind kind, int32_t value, int32_t ranges, int32_t rttUs, int32_t bandwidthPps,
+                double periodUs, double cwnd, bool changed) {
+        uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+        Slot &s = slots[i & (CC_TRACE_EVENTS - 1)];
+        s.seq.store(2 * i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.ev = Event{StageHistogram::now(), kind, changed, value, ranges, rttUs, bandwidthPps, periodUs, cwnd};
+        s.seq.store(2 * i + 2, std::memory_order_release);
+
+        if (changed) changes.fetch_add(1, std::memory_order_relaxed);
+        if (kind == LOSS) {
+            losses.fetch_add(1, std::memory_order_relaxed);
+            lostPkts.fetch_add(static_cast<uint64_t>(std::max(value, 0)), std::memory_order_relaxed);
+        } else if (kind == TIMEOUT) {
+            timeouts.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            acks.fetch_add(1, std::memory_order_relaxed);
+            if (rttUs > 0) {
+                rtt.record(static_cast<uint64_t>(rttUs) * 1000, 0);
+                int32_t prev = lastRtt.exchange(rttUs, std::memory_order_relaxed);
+                if (prev > 0) {
+                    jitter.record(static_cast<uint64_t>(std::abs(rttUs - prev)) * 1000, 0);
+                }
+            }
+        }
+    }
+
+    // 环形缓冲中仍完整的事件（按时间先后）
+    std::vector<Event> events() const {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > static_cast<uint64_t>(CC_TRACE_EVENTS) ? end - CC_TRACE_EVENTS : 0;
+        std::vector<Event> out;
+        out.reserve(static_cast<size_t>(end - begin));
+        for (uint64_t i = begin; i < end; ++i) {
+            const Slot &s = slots[i & (CC_TRACE_EVENTS - 1)];
+            uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq != 2 * i + 2) continue;
+            Event ev = s.ev;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != seq) continue;
+            out.push_back(ev);
+        }
+        return out;
+    }
+
+    json summary() const {
+        uint64_t total = head.load(std::memory_order_relaxed);
+        return json::object({
+            {"events", json::object({
+                {"acks", acks.load(std::memory_order_relaxed)},
+                {"losses", losses.load(std::memory_order_relaxed)},
+                {"lost_packets", lostPkts.load(std::memory_order_relaxed)},
+                {"timeouts", timeouts.load(std::memory_order_relaxed)},
+                {"rate_changes", changes.load(std::memory_order_relaxed)},
+                {"recorded", total},
+                {"overwritten", total > static_cast<uint64_t>(CC_TRACE_EVENTS) ? total - CC_TRACE_EVENTS : 0}
+            })},
+            {"rtt_distribution", distribution(rtt)},
+            {"jitter", distribution(jitter)}
+        });
+    }
+
+    // 写出 JSONL 事件轨迹，返回写出的行数；打不开文件时返回 -1
+    long writeTrace(const std::string &path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            return -1;
+        }
+        static const char *names[] = {"", "ack", "loss", "timeout"};
+        long lines = 0;
+        for (const Event &e : events()) {
+            json line = json::object({
+                {"type", "cc"},
+                {"event", names[e.kind]},
+                {"t_ms", e.tNs > startNs ? (e.tNs - startNs) / 1e6 : 0.0},
+                {"rtt_ms", e.rttUs / 1000.0},
+                {"bandwidth_pps", e.bandwidthPps},
+                {"period_us", e.periodUs},
+                {"cwnd_pkts", e.cwnd},
+                {"changed", e.changed}
+            });
+            if (e.kind == ACK) {
+                line["ack"] = e.value;
+            } else if (e.kind == LOSS) {
+                line["lost"] = e.value;
+                line["ranges"] = e.ranges;
+            }
+            out << line.dump() << "\n";
+            lines++;
+        }
+        return lines;
+    }
+};
+
+// 主线程通过 UDT_CC 取回 CCC 指针后经 dynamic_cast 找到录制器，不必知道具体控制器类型
+class CcTraceSource {
+public:
+    virtual ~CcTraceSource() {}
+    virtual const CcRecorder &recorder() const = 0;
+};
+
+// 录制包装：继承具体控制器，回调先交给控制器处理，再把回调后的 RTT / 发送间隔 / 窗口记下来。
+// 必须用继承而不是持有另一个 CCC 实例——速率、窗口、RTT 都是 CCC 的 protected 成员
+template<class CC>
+class RecordingCC : public CC, public CcTraceSource {
+    CcRecorder rec;
+    double lastPeriod = 0;
+    double lastCwnd = 0;
+
+    void note(CcRecorder::Kind kind, int32_t value, int32_t ranges) {
+        bool changed = this->m_dPktSndPeriod != lastPeriod || this->m_dCWndSize != lastCwnd;
+        lastPeriod = this->m_dPktSndPeriod;
+        lastCwnd = this->m_dCWndSize;
+        rec.record(kind, value, ranges, this->m_iRTT, this->m_iBandwidth, lastPeriod, lastCwnd, changed);
+    }
+
+    // UDT 丢包列表：最高位为 1 的元素是区间起点，紧随其后的是区间终点，其余元素是单个序号
+    static int32_t lostCount(const int32_t *list, int size) {
+        int64_t n = 0;
+        for (int i = 0; i < size; ++i) {
+            if ((list[i] & 0x80000000) && i + 1 < size) {
+                int64_t first = list[i] & 0x7FFFFFFF;
+                int64_t last = list[++i];
+                n += last >= first ? last - first + 1 : last - first + 0x80000001LL;
+            } else {
+                n++;
+            }
+        }
+        return static_cast<int32_t>(std::min<int64_t>(n, std::numeric_limits<int32_t>::max()));
+    }
+
+public:
+    template<class... A>
+    explicit RecordingCC(A... args) : CC(args...) {
+    }
+
+    virtual void init() override {
+        CC::init();
+        lastPeriod = this->m_dPktSndPeriod;
+        lastCwnd = this->m_dCWndSize;
+    }
+
+    virtual void onACK(int32_t ack) override {
+        CC::onACK(ack);
+        note(CcRecorder::ACK, ack, 0);
+    }
+
+    virtual void onLoss(const int32_t *list, int size) override {
+        CC::onLoss(list, size);
+        note(CcRecorder::LOSS, lostCount(list, size), size);
+    }
+
+    virtual void onTimeout() override {
+        CC::onTimeout();
+        note(CcRecorder::TIMEOUT, 0, 0);
+    }
+
+    virtual const CcRecorder &recorder() const override {
+        return rec;
+    }
+};
+
+// 拥塞控制工厂：创建带录制包装的控制器，构造参数原样转交给控制器
+template<class CC, class... Args>
+class RecordingCCFactory : public CCCVirtualFactory {
+    std::tuple<Args...> args;
+
+public:
+    explicit RecordingCCFactory(Args... a) : args(a...) {
+    }
+
+    virtual CCC* create() override {
+        return std::apply([](Args... a) -> CCC* { return new RecordingCC<CC>(a...); }, args);
+    }
+
+    virtual CCCVirtualFactory* clone() override {
+        return new RecordingCCFactory(*this);
+    }
+};
+
+// 时间序列采样（--stats-out）：独立线程每个周期以清零方式读取一次 UDT::perfmon（周期内计数与速率），
+// 每个周期写一行 JSON（JSONL），结束时按周期给出各指标的 min / p50 / p99 / max，并入报告 timeseries 段
+class StatsSampler {
+    UDTSOCKET sock = UDT::INVALID_SOCK;
+    std::string role;
+    std::string path;
+    int intervalMs;
+    std::ofstream out;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    std::map<std::string, std::vector<double> > series;
+    uint64_t samples = 0;
+
+    void sample() {
+        UDT::TRACEINFO p;
+        if (UDT::perfmon(sock, &p, true) == UDT::ERROR) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double periodMs = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+
+        bool sending = (role == "sender");
+        double lossPkts = sending ? p.pktSndLoss : p.pktRcvLoss;
+        double basePkts = sending ? p.pktSent : p.pktRecv;
+        json line = json::object({
+            {"type", "stats"},
+            {"role", role},
+            {"t_ms", std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count()},
+            {"interval_ms", periodMs},
+            {"throughput_mbps", sending ? p.mbpsSendRate : p.mbpsRecvRate},
+            {"rtt_ms", p.msRTT},
+            {"pkt_sent", p.pktSent},
+            {"pkt_recv", p.pktRecv},
+            {"pkt_snd_loss", p.pktSndLoss},
+            {"pkt_rcv_loss", p.pktRcvLoss},
+            {"pkt_retrans", p.pktRetrans},
+            {"loss_ratio", basePkts > 0 ? lossPkts / basePkts : 0.0},
+            {"flow_window", p.pktFlowWindow},
+            {"cong_window", p.pktCongestionWindow},
+            {"flight_size", p.pktFlightSize},
+            {"snd_buf_avail_bytes", p.byteAvailSndBuf},
+            {"rcv_buf_avail_bytes", p.byteAvailRcvBuf},
+            {"est_bandwidth_mbps", p.mbpsBandwidth},
+            {"pkt_snd_period_us", p.usPktSndPeriod}
+        });
+        out << line.dump() << '\n';
+        out.flush();
+
+        samples++;
+        for (const char *key : {"throughput_mbps", "rtt_ms", "loss_ratio", "pkt_retrans", "flow_window",
+                                "cong_window", "snd_buf_avail_bytes", "rcv_buf_avail_bytes"}) {
+            series[key].push_back(line[key].get<double>());
+        }
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(intervalMs), [this] { return stopping; })) {
+            lk.unlock();
+            sample();
+            lk.lock();
+        }
+    }
+
+public:
+    StatsSampler(const std::string &file, const std::string &who, int interval)
+        : role(who), path(file), intervalMs(interval) {
+        out.open(
+#ifdef _WIN32
+            fs::path(Utf8Util::toWide(file)),
+#else
+            file,
+#endif
+            std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open stats output: " + file);
+        }
+    }
+
+    ~StatsSampler() {
+        stop();
+    }
+
+    void begin(UDTSOCKET s) {
+        sock = s;
+        UDT::TRACEINFO p;
+        UDT::perfmon(sock, &p, true);  // 清零，第一行只含本周期
+        start = last = std::chrono::steady_clock::now();
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("sampler");
+            loop();
+        });
+    }
+
+    // 停止并补记最后一个不完整的周期
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+            sample();
+        }
+    }
+
+    json summary() const {
+        json metrics = json::object();
+        for (const auto &s : series) {
+            metrics[s.first] = Utils::distribution(s.second);
+        }
+        return json::object({
+            {"file", path},
+            {"interval_ms", intervalMs},
+            {"samples", samples},
+            {"metrics", metrics}
+        });
+    }
+};
+
+// 进度输出：独立线程按固定周期读取原子计数并输出一条进度事件，数据路径只做一次原子写，不碰控制台。
+// human 为单行刷新（写到 fd 时逐行），json 为每周期一行 {"type":"progress",...}
+class ProgressReporter {
+    std::string role;
+    std::string format;
+    int fd;
+    int intervalMs;
+    bool detailed;
+    uint64_t total;
+
+    std::atomic<uint64_t> done{0};
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    uint64_t lastDone = 0;
+
+    void write(const std::string &text) {
+        if (fd < 0) {
+            std::cout << text << std::flush;
+            return;
+        }
+        size_t off = 0;
+        while (off < text.size()) {
+#ifdef _WIN32
+            int n = _write(fd, text.data() + off, static_cast<unsigned>(text.size() - off));
+#else
+            int n = static_cast<int>(::write(fd, text.data() + off, text.size() - off));
+#endif
+            if (n <= 0) return;
+            off += n;
+        }
+    }
+
+    void emit(bool final) {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t cur = done.load(std::memory_order_relaxed);
+        double periodSec = std::chrono::duration<double>(now - last).count();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        double speed = periodSec > 0 ? (cur - lastDone) * 8.0 / 1e6 / periodSec : 0.0;
+        double avg = elapsed > 0 ? cur * 8.0 / 1e6 / elapsed : 0.0;
+        last = now;
+        lastDone = cur;
+
+        std::ostringstream oss;
+        if (format == "json") {
+            json ev = json::object({
+                {"type", "progress"},
+                {"role", role},
+                {"t_ms", std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count()},
+                {"current", cur},
+                {"total", total},
+                {"speed_mbps", speed},
+                {"avg_mbps", avg},
+                {"final", final}
+            });
+            if (total > 0) {
+                ev["percent"] = static_cast<double>(cur) / total * 100.0;
+                if (avg > 0 && cur < total) {
+                    ev["eta_sec"] = (total - cur) * 8.0 / 1e6 / avg;
+                }
+            }
+            oss << ev.dump() << "\n";
+        } else {
+            oss << (fd < 0 ? "\r" : "") << "[Progress] ";
+            if (total == 0) {
+                oss << Utils::formatSize(cur) << " (stream)";
+            } else {
+                oss << std::fixed << std::setprecision(1) << static_cast<double>(cur) / total * 100.0
+                        << "% | " << Utils::formatSize(cur) << " / " << Utils::formatSize(total);
+            }
+            if (detailed) {
+                oss << " | Rate: " << std::fixed << std::setprecision(1) << (final ? avg : speed) << " Mbps";
+            }
+            if (fd >= 0) oss << "\n";
+        }
+        write(oss.str());
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(intervalMs), [this] { return stopping; })) {
+            lk.unlock();
+            emit(false);
+            lk.lock();
+        }
+    }
+
+public:
+    ProgressReporter(const std::string &who, const std::string &fmt, int outFd, int interval, bool detail,
+                     uint64_t totalBytes)
+        : role(who), format(fmt), fd(outFd), intervalMs(interval), detailed(detail), total(totalBytes) {}
+
+    ~ProgressReporter() {
+        stop();
+    }
+
+    void begin() {
+        start = last = std::chrono::steady_clock::now();
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("progress");
+            loop();
+        });
+    }
+
+    // 数据路径调用：只有一次原子写
+    void set(uint64_t bytes) {
+        done.store(bytes, std::memory_order_relaxed);
+    }
+
+    // 停止并输出最后一条（final = true）
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+            emit(true);
+        }
+    }
+};
+
+// 作业模式中一个会话的令牌桶：发送线程每块先取令牌，令牌按分配器授予的速率补充；
+// 同一速率同时作为 RateCaps 的 "scheduler" 上限，由 UDT 在线上平滑发出
+class SessionShare {
+    std::mutex mtx;
+    std::condition_variable cv;
+    RateCaps *caps = nullptr;
+    UDTSOCKET sock = UDT::INVALID_SOCK;
+    int payloadBytes = 1;
+    double tokens = 0;
+    double depth = SCHED_BURST_BYTES;
+    double grantBps = 0;
+    bool active = false;
+    std::chrono::steady_clock::time_point lastRefill;
+    std::atomic<uint64_t> bytes{0};
+    double waitedSec = 0;
+    bool waiting = false;
+    std::chrono::steady_clock::time_point waitStart;
+
+    void refill(std::chrono::steady_clock::time_point now) {
+        double dt = std::chrono::duration<double>(now - lastRefill).count();
+        lastRefill = now;
+        tokens = std::min(depth, tokens + dt * grantBps / 8);
+    }
+
+public:
+    const std::string name;
+    const std::string dest;
+    const double weight;
+    const int priority;
+    const double maxBps;  // 0 表示不设单会话上限
+
+    // 以下由 BandwidthScheduler 在其锁内维护
+    bool done = false;
+    double demand = 0;
+    double next = 0;
+    double achievedBps = 0;
+    double peakBps = 0;
+    uint64_t lastBytes = 0;
+    double lastWait = 0;
+    double grantIntegral = 0;  // 授予速率 × 时间
+    double activeSec = 0;
+
+    SessionShare(const std::string &n, const std::string &d, double w, int p, double cap)
+        : name(n), dest(d), weight(w), priority(p), maxBps(cap) {
+    }
+
+    void attach(RateCaps *c, UDTSOCKET s) {
+        int mss = DEFAULT_MSS;
+        int len = sizeof(mss);
+        UDT::getsockopt(s, 0, UDT_MSS, &mss, &len);
+        std::lock_guard<std::mutex> lk(mtx);
+        payloadBytes = std::max(1, mss - UDP_IP_OVERHEAD - 16);
+        caps = c;
+        sock = s;
+        active = true;
+        tokens = SCHED_BURST_BYTES;
+        lastRefill = std::chrono::steady_clock::now();
+        if (caps && grantBps > 0) caps->set("scheduler", grantBps);
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lk(mtx);
+        caps = nullptr;
+        sock = UDT::INVALID_SOCK;
+        active = false;
+        cv.notify_all();
+    }
+
+    bool isActive() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return active;
+    }
+
+    double granted() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return grantBps;
+    }
+
+    void grant(double bps) {
+        std::lock_guard<std::mutex> lk(mtx);
+        refill(std::chrono::steady_clock::now());
+        grantBps = bps;
+        if (caps) caps->set("scheduler", bps);
+        cv.notify_all();
+    }
+
+    // 取 n 字节令牌；不足时允许透支一块，等待补足后返回，使长期速率不超过授予速率
+    void take(size_t n) {
+        std::unique_lock<std::mutex> lk(mtx);
+        // UDT 以同一速率发送上一块期间积攒的令牌须能留到下一块，否则限速叠加，实际只有一半
+        depth = std::max(depth, static_cast<double>(n));
+        refill(std::chrono::steady_clock::now());
+        tokens -= static_cast<double>(n);
+        if (tokens < 0 && active && grantBps > 0) {
+            waiting = true;
+            waitStart = std::chrono::steady_clock::now();
+        }
+        while (tokens < 0 && active && grantBps > 0) {
+            double waitSec = std::min(-tokens * 8 / grantBps, SCHED_REBALANCE_MS / 1000.0);
+            cv.wait_for(lk, std::chrono::duration<double>(waitSec));
+            refill(std::chrono::steady_clock::now());
+        }
+        if (waiting) {
+            waiting = false;
+            waitedSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+        }
+        bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 累计等令牌时间（含正在进行的等待）：一块可能跨越多个分配周期，只看字节数会把被限速的会话误判为空闲
+    double tokenWait() {
+        std::lock_guard<std::mutex> lk(mtx);
+        double w = waitedSec;
+        if (waiting) w += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+        return w;
+    }
+
+    uint64_t sentBytes() const {
+        return bytes.load(std::memory_order_relaxed);
+    }
+
+    // 已真正发上线路的字节：取令牌按整块计，块在 UDT 中按授予速率发出要跨越多个周期，
+    // 按取令牌的字节估速会把正在发送的会话误判为空闲
+    uint64_t wireBytes() {
+        uint64_t admitted = sentBytes();
+        std::lock_guard<std::mutex> lk(mtx);
+        UDT::TRACEINFO perf;
+        if (sock == UDT::INVALID_SOCK || UDT::perfmon(sock, &perf, false) == UDT::ERROR || perf.pktSentTotal <= 0) {
+            return admitted;
+        }
+        uint64_t wire = static_cast<uint64_t>(perf.pktSentTotal - perf.pktRetransTotal) * payloadBytes;
+        return std::min(wire, admitted);
+    }
+};
+
+// 作业模式的中央带宽分配器：总速率先按优先级从高到低分配，同一优先级内按权重做加权公平
+// （注水法：需求、单会话上限或目的地址上限低于公平份额的会话按其限制封顶，余量在其余会话间再分）。
+// 每 SCHED_REBALANCE_MS 用各会话的实际速率重估需求：用满授予速率或在等令牌视为还想要更多，
+// 否则（读盘、网络或接收端限制了它）需求为实际速率加余量，用不完的份额就此让给其他会话
+class BandwidthScheduler {
+    double capacity;
+    std::map<std::string, double> destCaps;
+    std::vector<std::shared_ptr<SessionShare> > sessions;
+
+    std::mutex mtx;
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    std::chrono::steady_clock::time_point lastAccount;
+    std::chrono::steady_clock::time_point lastMeasure;
+    uint64_t rebalances = 0;
+
+    // 只有已接入（进入发送循环）的会话参与分配
+    bool eligible(const std::shared_ptr<SessionShare> &s) {
+        return !s->done && s->isActive();
+    }
+
+    void allocate() {
+        const double unlimited = std::numeric_limits<double>::infinity();
+        std::map<std::string, double> destLeft;
+        std::map<std::string, int> destCount;
+        std::set<int, std::greater<int> > levels;
+        int count = 0;
+        for (auto &s : sessions) {
+            s->next = 0;
+            if (!eligible(s)) continue;
+            count++;
+            destCount[s->dest]++;
+            levels.insert(s->priority);
+            auto cap = destCaps.find(s->dest);
+            destLeft[s->dest] = cap != destCaps.end() ? cap->second : unlimited;
+        }
+
+        // 先预留保底速率（总量、目的地址上限不足时均分），注水只分配余下的部分，保证授予总和不超过总速率
+        double pool = capacity;
+        for (auto &s : sessions) {
+            if (!eligible(s)) continue;
+            double floor = std::min(SCHED_MIN_RATE_BPS, capacity / count);
+            floor = std::min(floor, destLeft[s->dest] / destCount[s->dest]);
+            if (s->maxBps > 0) floor = std::min(floor, s->maxBps);
+            s->next = floor;
+            pool -= floor;
+        }
+        for (auto &s : sessions) {
+            if (eligible(s)) destLeft[s->dest] -= s->next;
+        }
+
+        for (int level : levels) {
+            std::vector<SessionShare *> open;
+            for (auto &s : sessions) {
+                if (eligible(s) && s->priority == level) open.push_back(s.get());
+            }
+            while (!open.empty() && pool > 0) {
+                double totalWeight = 0;
+                std::map<std::string, double> destWeight;
+                for (SessionShare *s : open) {
+                    totalWeight += s->weight;
+                    destWeight[s->dest] += s->weight;
+                }
+                double unit = pool / totalWeight;
+
+                // 找出公平份额超过自身剩余限制的会话，按限制封顶后把余量留给其余会话
+                std::vector<SessionShare *> rest;
+                std::vector<std::pair<SessionShare *, double> > capped;
+                for (SessionShare *s : open) {
+                    double limit = std::min(s->demand, s->maxBps > 0 ? s->maxBps : unlimited) - s->next;
+                    limit = std::max(0.0, std::min(limit, destLeft[s->dest] * s->weight / destWeight[s->dest]));
+                    if (unit * s->weight >= limit) {
+                        capped.push_back(std::make_pair(s, limit));
+                    } else {
+                        rest.push_back(s);
+                    }
+                }
+                if (capped.empty()) {
+                    for (SessionShare *s : open) {
+                        s->next += unit * s->weight;
+                        destLeft[s->dest] -= unit * s->weight;
+                    }
+                    pool = 0;
+                    break;
+                }
+                for (auto &c : capped) {
+                    c.first->next += c.second;
+                    destLeft[c.first->dest] -= c.second;
+                    pool -= c.second;
+                }
+                open.swap(rest);
+            }
+        }
+
+        for (auto &s : sessions) {
+            if (eligible(s)) s->grant(s->next);
+        }
+    }
+
+    void rebalance(bool measure) {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - lastAccount).count();
+        lastAccount = now;
+        for (auto &s : sessions) {
+            if (s->done || !s->isActive()) continue;
+            s->grantIntegral += s->granted() * dt;
+            s->activeSec += dt;
+        }
+
+        if (measure) {
+            double period = std::chrono::duration<double>(now - lastMeasure).count();
+            lastMeasure = now;
+            for (auto &s : sessions) {
+                if (s->done || !s->isActive() || period <= 0) continue;
+                uint64_t b = s->wireBytes();
+                double w = s->tokenWait();
+                s->achievedBps = (b - s->lastBytes) * 8.0 / period;
+                bool throttled = (w - s->lastWait) >= SCHED_THROTTLED * period;
+                s->lastBytes = b;
+                s->lastWait = w;
+                s->peakBps = std::max(s->peakBps, s->achievedBps);
+                s->demand = (throttled || s->achievedBps >= SCHED_HUNGRY * s->granted())
+                                ? std::numeric_limits<double>::infinity()
+                                : std::max(SCHED_MIN_RATE_BPS, s->achievedBps * SCHED_DEMAND_MARGIN);
+            }
+            rebalances++;
+        }
+        allocate();
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lk(stopMutex);
+        while (!stopCv.wait_for(lk, std::chrono::milliseconds(SCHED_REBALANCE_MS), [this] { return stopping; })) {
+            lk.unlock();
+            {
+                std::lock_guard<std::mutex> g(mtx);
+                rebalance(true);
+            }
+            lk.lock();
+        }
+    }
+
+public:
+    BandwidthScheduler(double totalBps, const std::map<std::string, double> &caps)
+        : capacity(totalBps), destCaps(caps) {
+        lastAccount = lastMeasure = std::chrono::steady_clock::now();
+    }
+
+    ~BandwidthScheduler() {
+        stop();
+    }
+
+    std::shared_ptr<SessionShare> add(const std::string &name, const std::string &dest, double weight,
+                                      int priority, double maxBps) {
+        std::lock_guard<std::mutex> lk(mtx);
+        sessions.push_back(std::make_shared<SessionShare>(name, dest, weight, priority, maxBps));
+        sessions.back()->demand = std::numeric_limits<double>::infinity();
+        return sessions.back();
+    }
+
+    // 会话进入发送循环时接入，立即按新的会话集合重新分配
+    void attach(const std::shared_ptr<SessionShare> &share, RateCaps *caps, UDTSOCKET sock) {
+        std::lock_guard<std::mutex> lk(mtx);
+        share->attach(caps, sock);
+        share->lastBytes = share->wireBytes();
+        share->lastWait = share->tokenWait();
+        rebalance(false);
+    }
+
+    // 会话结束（或失败）时退出，份额立即让给其余会话；可重复调用
+    void detach(const std::shared_ptr<SessionShare> &share) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (share->done) return;
+        rebalance(false);
+        share->detach();
+        share->done = true;
+        allocate();
+    }
+
+    void begin() {
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("scheduler");
+            loop();
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(stopMutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    json report() {
+        std::lock_guard<std::mutex> lk(mtx);
+        json dest = json::object();
+        for (const auto &c : destCaps) {
+            dest[c.first] = c.second / 1e6;
+        }
+        json list = json::array();
+        for (auto &s : sessions) {
+            double sec = s->activeSec;
+            list.push_back(json::object({
+                {"name", s->name},
+                {"dest", s->dest},
+                {"weight", s->weight},
+                {"priority", s->priority},
+                {"max_mbps", s->maxBps / 1e6},
+                {"bytes", s->sentBytes()},
+                {"active_sec", sec},
+                {"granted_mbps", sec > 0 ? s->grantIntegral / sec / 1e6 : 0.0},
+                {"achieved_mbps", sec > 0 ? s->sentBytes() * 8.0 / sec / 1e6 : 0.0},
+                {"peak_mbps", s->peakBps / 1e6}
+            }));
+        }
+        return json::object({
+            {"capacity_mbps", capacity / 1e6},
+            {"dest_caps_mbps", dest},
+            {"rebalance_interval_ms", SCHED_REBALANCE_MS},
+            {"rebalances", rebalances},
+            {"sessions", list}
+        });
+    }
+};
+
+// 一个传输会话对外发布的计数（--metrics）。数据路径只做原子写（字节数、队列深度），
+// perfmon 衍生的量由 MetricsServer 的轮询线程定期填写；抓取只做原子读
+struct SessionMetrics {
+    uint64_t id = 0;
+    std::string name;
+    std::string role;
+    std::string peer;
+    UDTSOCKET sock = UDT::INVALID_SOCK;
+    int sndBufBytes = 0;
+    int rcvBufBytes = 0;
+    std::shared_ptr<StageStats> stages;
+
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> size{0};        // 文件大小，流为 0
+    std::atomic<int> pipelineBlocks{0};   // 读流水线中待发的块
+
+    std::atomic<double> rateBps{0};
+    std::atomic<double> rttSec{0};
+    std::atomic<double> bandwidthBps{0};
+    std::atomic<int64_t> retrans{0};
+    std::atomic<int64_t> lost{0};
+    std::atomic<int> flightPkts{0};
+    std::atomic<int64_t> sndBufUsed{0};
+    std::atomic<int64_t> rcvBufUsed{0};
+
+    // 仅轮询线程使用
+    uint64_t lastBytes = 0;
+};
+
+// 本机 Prometheus 抓取端点（--metrics <port>，只监听 127.0.0.1）。
+// 一个线程既接受抓取连接，也每 METRICS_POLL_MS 对登记的会话调用一次 perfmon（不清零）。
+// 会话表的锁只在登记 / 注销、轮询和抓取之间使用，数据路径从不触碰；抓取时只读原子计数
+class MetricsServer {
+    int port;
+    UDPSOCKET listenFd;
+
+    std::mutex mtx;
+    std::vector<std::shared_ptr<SessionMetrics> > sessions;
+    uint64_t nextId = 1;
+    std::atomic<uint64_t> finishedBytes{0};
+    std::atomic<uint64_t> finishedSessions{0};
+    std::atomic<uint64_t> scrapes{0};
+
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+    std::chrono::steady_clock::time_point lastPoll;
+
+    static std::string label(const std::string &v) {
+        std::string out;
+        for (char c : v) {
+            if (c == '\\' || c == '"') out += '\\';
+            if (c == '\n') {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    static void header(std::ostringstream &o, const char *name, const char *type, const char *help) {
+        o << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    void poll() {
+        auto now = std::chrono::steady_clock::now();
+        double sec = std::chrono::duration<double>(now - lastPoll).count();
+        lastPoll = now;
+
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto &m : sessions) {
+            uint64_t b = m->bytes.load(std::memory_order_relaxed);
+            if (sec > 0) {
+                m->rateBps.store((b - m->lastBytes) * 8.0 / sec, std::memory_order_relaxed);
+            }
+            m->lastBytes = b;
+
+            UDT::TRACEINFO p;
+            if (m->sock == UDT::INVALID_SOCK || UDT::perfmon(m->sock, &p, false) == UDT::ERROR) {
+                continue;
+            }
+            m->rttSec.store(p.msRTT / 1e3, std::memory_order_relaxed);
+            m->bandwidthBps.store(p.mbpsBandwidth * 1e6, std::memory_order_relaxed);
+            m->retrans.store(p.pktRetransTotal, std::memory_order_relaxed);
+            m->lost.store(m->role == "receiver" ? p.pktRcvLossTotal : p.pktSndLossTotal, std::memory_order_relaxed);
+            m->flightPkts.store(p.pktFlightSize, std::memory_order_relaxed);
+            m->sndBufUsed.store(std::max<int64_t>(0, m->sndBufBytes - p.byteAvailSndBuf), std::memory_order_relaxed);
+            m->rcvBufUsed.store(std::max<int64_t>(0, m->rcvBufBytes - p.byteAvailRcvBuf), std::memory_order_relaxed);
+        }
+    }
+
+    std::string render() {
+        // 会话列表、活跃字节与已结束累计在同一把锁下读取：remove() 在锁内把字节转入 finishedBytes，
+        // 分开读会重复计数，下一次抓取时计数器回落被 Prometheus 当作重置
+        std::vector<std::shared_ptr<SessionMetrics> > snap;
+        uint64_t active = 0;
+        uint64_t doneBytes = 0, doneSessions = 0;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            snap = sessions;
+            for (auto &m : snap) {
+                active += m->bytes.load(std::memory_order_relaxed);
+            }
+            doneBytes = finishedBytes.load(std::memory_order_relaxed);
+            doneSessions = finishedSessions.load(std::memory_order_relaxed);
+        }
+        auto ld = [](const std::atomic<double> &a) { return a.load(std::memory_order_relaxed); };
+
+        std::ostringstream o;
+        o << std::setprecision(10);
+        double rate = 0;
+        for (auto &m : snap) {
+            rate += ld(m->rateBps);
+        }
+        header(o, "hruft_sessions_active", "gauge", "Transfer sessions in progress.");
+        o << "hruft_sessions_active " << snap.size() << "\n";
+        header(o, "hruft_sessions_finished_total", "counter", "Transfer sessions that have ended.");
+        o << "hruft_sessions_finished_total " << doneSessions << "\n";
+        header(o, "hruft_bytes_total", "counter", "Payload bytes moved by all sessions, finished and active.");
+        o << "hruft_bytes_total " << doneBytes + active << "\n";
+        header(o, "hruft_rate_bits_per_second", "gauge", "Aggregate payload rate of active sessions.");
+        o << "hruft_rate_bits_per_second " << rate << "\n";
+        header(o, "hruft_scrapes_total", "counter", "Scrapes served by this endpoint.");
+        o << "hruft_scrapes_total " << scrapes.load(std::memory_order_relaxed) << "\n";
+
+        // 每个指标一组：先写 HELP / TYPE，再逐会话输出
+        auto labels = [](const SessionMetrics &m) {
+            return "session=\"" + std::to_string(m.id) + "\",name=\"" + label(m.name) + "\",role=\"" + m.role +
+                   "\",peer=\"" + label(m.peer) + "\"";
+        };
+        auto each = [&](const char *name, const char *type, const char *help,
+                        const std::function<void(const SessionMetrics &, const std::string &)> &fn) {
+            if (snap.empty()) return;
+            header(o, name, type, help);
+            for (auto &m : snap) fn(*m, labels(*m));
+        };
+        each("hruft_session_bytes_total", "counter", "Payload bytes sent or received.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_bytes_total{" << l << "} " << m.bytes.load(std::memory_order_relaxed) << "\n";
+             });
+        each("hruft_session_size_bytes", "gauge", "File size, 0 for streams.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_size_bytes{" << l << "} " << m.size.load(std::memory_order_relaxed) << "\n";
+             });
+        each("hruft_session_rate_bits_per_second", "gauge", "Payload rate over the last poll interval.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_rate_bits_per_second{" << l << "} " << ld(m.rateBps) << "\n";
+             });
+        each("hruft_session_rtt_seconds", "gauge", "UDT smoothed round-trip time.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_rtt_seconds{" << l << "} " << ld(m.rttSec) << "\n";
+             });
+        each("hruft_session_est_bandwidth_bits_per_second", "gauge", "UDT estimated link bandwidth.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_est_bandwidth_bits_per_second{" << l << "} " << ld(m.bandwidthBps) << "\n";
+             });
+        each("hruft_session_retransmits_total", "counter", "UDT packets retransmitted.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_retransmits_total{" << l << "} " << m.retrans.load(std::memory_order_relaxed) << "\n";
+             });
+        each("hruft_session_lost_packets_total", "counter", "UDT packets reported lost.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_lost_packets_total{" << l << "} " << m.lost.load(std::memory_order_relaxed) << "\n";
+             });
+        each("hruft_session_queue_depth", "gauge",
+             "Queue depths: read pipeline blocks, UDT buffer bytes in use, packets in flight.",
+             [&](const SessionMetrics &m, const std::string &l) {
+                 o << "hruft_session_queue_depth{" << l << ",queue=\"pipeline_blocks\"} "
+                         << m.pipelineBlocks.load(std::memory_order_relaxed) << "\n"
+                         << "hruft_session_queue_depth{" << l << ",queue=\"udt_snd_bytes\"} "
+                         << m.sndBufUsed.load(std::memory_order_relaxed) << "\n"
+                         << "hruft_session_queue_depth{" << l << ",queue=\"udt_rcv_bytes\"} "
+                         << m.rcvBufUsed.load(std::memory_order_relaxed) << "\n"
+                         << "hruft_session_queue_depth{" << l << ",queue=\"flight_pkts\"} "
+                         << m.flightPkts.load(std::memory_order_relaxed) << "\n";
+             });
+
+        // 阶段耗时：summary（p50 / p99、累计耗时与次数）
+        bool anyStages = false;
+        for (auto &m : snap) anyStages = anyStages || m->stages;
+        if (anyStages) {
+            header(o, "hruft_stage_latency_seconds", "summary", "Per-call latency of each data-path stage.");
+            for (auto &m : snap) {
+                if (!m->stages) continue;
+                std::string l = labels(*m);
+                const std::pair<const char *, const StageHistogram *> all[] = {
+                    {"read", &m->stages->read}, {"hash", &m->stages->hash}, {"send", &m->stages->send},
+                    {"recv", &m->stages->recv}, {"write", &m->stages->write}
+                };
+                for (const auto &st : all) {
+                    if (st.second->callCount() == 0) continue;
+                    std::string sl = l + ",stage=\"" + st.first + "\"";
+                    o << "hruft_stage_latency_seconds{" << sl << ",quantile=\"0.5\"} " << st.second->percentile(0.5) / 1e9 << "\n"
+                            << "hruft_stage_latency_seconds{" << sl << ",quantile=\"0.99\"} " << st.second->percentile(0.99) / 1e9 << "\n"
+                            << "hruft_stage_latency_seconds_sum{" << sl << "} " << st.second->busyNs() / 1e9 << "\n"
+                            << "hruft_stage_latency_seconds_count{" << sl << "} " << st.second->callCount() << "\n";
+                }
+            }
+        }
+        return o.str();
+    }
+
+    void serveClient(UDPSOCKET fd) {
+#ifdef _WIN32
+        DWORD tv = METRICS_CLIENT_TIMEOUT_MS;
+#else
+        timeval tv;
+        tv.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000;
+        tv.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000;
+#endif
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char *) &tv, sizeof(tv));
+
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos && req.size() < METRICS_MAX_REQUEST) {
+            int r = static_cast<int>(::recv(fd, buf, sizeof(buf), 0));
+            if (r <= 0) break;
+            req.append(buf, r);
+        }
+
+        std::string status = "200 OK", body;
+        if (req.compare(0, 13, "GET /metrics ") == 0 || req.compare(0, 6, "GET / ") == 0) {
+            scrapes.fetch_add(1, std::memory_order_relaxed);
+            body = render();
+        } else {
+            status = "404 Not Found";
+            body = "try /metrics\n";
+        }
+        std::string resp = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t off = 0;
+        while (off < resp.size()) {
+            int n = static_cast<int>(::send(fd, resp.data() + off, static_cast<int>(resp.size() - off), 0));
+            if (n <= 0) break;
+            off += n;
+        }
+        SocketBuffers::closeFd(fd);
+    }
+
+    void loop() {
+        lastPoll = std::chrono::steady_clock::now();
+        while (!stopping.load()) {
+            auto wait = std::chrono::milliseconds(METRICS_POLL_MS) - (std::chrono::steady_clock::now() - lastPoll);
+            long waitUs = std::max<long>(0, static_cast<long>(
+                std::min<int64_t>(200000, std::chrono::duration_cast<std::chrono::microseconds>(wait).count())));
+            fd_set rd;
+            FD_ZERO(&rd);
+            FD_SET(listenFd, &rd);
+            timeval tv;
+            tv.tv_sec = 0;
+            tv.tv_usec = waitUs;
+            if (::select(static_cast<int>(listenFd) + 1, &rd, nullptr, nullptr, &tv) > 0) {
+                UDPSOCKET c = ::accept(listenFd, nullptr, nullptr);
+                if (SocketBuffers::valid(c)) serveClient(c);
+            }
+            if (std::chrono::steady_clock::now() - lastPoll >= std::chrono::milliseconds(METRICS_POLL_MS)) {
+                poll();
+            }
+        }
+    }
+
+public:
+    explicit MetricsServer(int port_) : port(port_), listenFd(SocketBuffers::invalidFd()) {}
+
+    ~MetricsServer() { stop(); }
+
+    void begin() {
+        listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (!SocketBuffers::valid(listenFd)) {
+            throw std::runtime_error("Failed to create metrics socket");
+        }
+        int reuse = 1;
+        ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(listenFd, (sockaddr *) &addr, sizeof(addr)) != 0 || ::listen(listenFd, 8) != 0) {
+            SocketBuffers::closeFd(listenFd);
+            listenFd = SocketBuffers::invalidFd();
+            throw std::runtime_error("Metrics port " + std::to_string(port) + " unavailable");
+        }
+        worker = std::thread([this] {
+            ThreadRoles::Scope role("metrics");
+            loop();
+        });
+        std::cout << "[INFO] Metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
+    }
+
+    void stop() {
+        stopping.store(true);
+        if (worker.joinable()) {
+            worker.join();
+        }
+        if (SocketBuffers::valid(listenFd)) {
+            SocketBuffers::closeFd(listenFd);
+            listenFd = SocketBuffers::invalidFd();
+        }
+    }
+
+    // 登记会话：在数据传输开始前调用（sock 在注销前必须保持有效）
+    std::shared_ptr<SessionMetrics> add(const std::string &name, const std::string &role, const std::string &peer,
+                                        UDTSOCKET s, uint64_t size, std::shared_ptr<StageStats> stages) {
+        auto m = std::make_shared<SessionMetrics>();
+        m->name = name;
+        m->role = role;
+        m->peer = peer;
+        m->sock = s;
+        m->stages = std::move(stages);
+        m->size.store(size, std::memory_order_relaxed);
+        int len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_SNDBUF, &m->sndBufBytes, &len);
+        len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_RCVBUF, &m->rcvBufBytes, &len);
+
+        std::lock_guard<std::mutex> lk(mtx);
+        m->id = nextId++;
+        sessions.push_back(m);
+        return m;
+    }
+
+    // 注销会话（关闭其 socket 之前调用）；字节数并入已结束会话的累计
+    void remove(const std::shared_ptr<SessionMetrics> &m) {
+        if (!m) return;
+        std::lock_guard<std::mutex> lk(mtx);
+        auto it = std::find(sessions.begin(), sessions.end(), m);
+        if (it == sessions.end()) return;
+        sessions.erase(it);
+        finishedBytes.fetch_add(m->bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        finishedSessions.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+class HruftPro {
+    UDTSOCKET sock;
+    Config cfg;
+    blake3_hasher hasher;
+    StdoutRedirect stdoutGuard;
+
+    // serve 模式共享状态
+    std::unique_ptr<BlockCache> cache;
+    std::mutex filesMutex;
+    std::map<std::string, std::shared_ptr<ServedFile> > servedFiles;
+    uint64_t nextFileId = 1;
+    std::mutex logMutex;
+
+    // 本端缓冲区实际大小（连接/监听后读回）与传输前探测结论
+    json localBuffers;
+    json probeInfo;
+    json pmtuInfo;
+
+    // 作业模式：本会话在中央分配器中的份额，以及发送结束后的报告（供汇总）
+    BandwidthScheduler *scheduler = nullptr;
+    std::shared_ptr<SessionShare> share;
+    json lastReport;
+
+    // 进度输出线程（每次传输新建）
+    std::unique_ptr<ProgressReporter> progress;
+
+    // 本次传输数据面各阶段的耗时直方图（每次传输新建）
+    std::shared_ptr<StageStats> stages;
+
+    // --trace 的 Chrome 轨迹（每次传输新建）
+    std::unique_ptr<TraceLog> tracer;
+
+    // --metrics：抓取端点（作业模式下各会话共用父进程的端点）与本次传输登记的计数
+    std::unique_ptr<MetricsServer> metricsOwner;
+    MetricsServer *metrics = nullptr;
+    std::shared_ptr<SessionMetrics> live;
+
+    void publish(const std::string &name, const std::string &role, const std::string &peer, UDTSOCKET s,
+                 uint64_t size) {
+        if (metrics) {
+            live = metrics->add(name, role, peer, s, size, stages);
+        }
+    }
+
+    void unpublish() {
+        if (metrics && live) {
+            metrics->remove(live);
+        }
+        live.reset();
+    }
+
+    std::unique_ptr<StatsSampler> startSampler(UDTSOCKET s, const std::string &role) {
+        std::unique_ptr<StatsSampler> sampler;
+        if (!cfg.stats_out.empty()) {
+            sampler.reset(new StatsSampler(cfg.stats_out, role, cfg.stats_interval_ms));
+            sampler->begin(s);
+            std::cout << "[INFO] Writing " << role << " stats every " << cfg.stats_interval_ms << " ms to "
+                    << cfg.stats_out << std::endl;
+        }
+        return sampler;
+    }
+
+    // 核心性能设置：配置 Socket 缓冲区
+    void tuneSocket(UDTSOCKET s, int mss, int winSize) {
+        // 1. 设置 MSS (必须在连接前)
+        UDT::setsockopt(s, 0, UDT_MSS, &mss, sizeof(int));
+
+        // 2. 拥塞控制：none 使用 SimpleCC，rate 使用令牌桶定速的 RateCC，bbr 使用 BBRCC，
+        //    scavenger 使用基于时延让路的 ScavengerCC，udt 使用 UDT 自带的 CUDTCC；
+        //    都包一层 RecordingCC 录制 ACK / 丢包 / 超时事件。
+        //    UDT_MAXBW 保持默认（不限），速率只由控制器决定，避免在 10G 链路上被封顶
+        if (cfg.cc == "none") {
+            RecordingCCFactory<SimpleCC> factory;
+            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(factory));
+        } else if (cfg.cc == "rate") {
+            RecordingCCFactory<RateCC, double, double> factory(cfg.rate_bps, cfg.burst_kb * 1024.0);
+            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(factory));
+        } else if (cfg.cc == "bbr") {
+            RecordingCCFactory<BBRCC> factory;
+            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(factory));
+        } else if (cfg.cc == "scavenger") {
+            RecordingCCFactory<ScavengerCC, double> factory(cfg.target_delay_ms);
+            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(factory));
+        } else {
+            RecordingCCFactory<CUDTCC> factory;
+            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(factory));
+        }
+
+        // 3. UDT 缓冲区 (应用层可见窗口)
+        // 限制最大值
+        int udtBuf = std::min(winSize, UDT_MAX_BUF);
+        UDT::setsockopt(s, 0, UDT_SNDBUF, &udtBuf, sizeof(int));
+        UDT::setsockopt(s, 0, UDT_RCVBUF, &udtBuf, sizeof(int));
+
+        // 4. UDP 缓冲区 (操作系统内核级)，最小给 1MB
+        int udpBuf = udpBufferFor(winSize);
+
+        UDT::setsockopt(s, 0, UDP_SNDBUF, &udpBuf, sizeof(int));
+        UDT::setsockopt(s, 0, UDP_RCVBUF, &udpBuf, sizeof(int));
+
+        // 5. 阻塞模式
+        bool block = true;
+        UDT::setsockopt(s, 0, UDT_SNDSYN, &block, sizeof(bool));
+        UDT::setsockopt(s, 0, UDT_RCVSYN, &block, sizeof(bool));
+
+        // 6. 启用地址重用
+        bool reuse = true;
+        UDT::setsockopt(s, 0, UDT_REUSEADDR, &reuse, sizeof(bool));
+    }
+
+    static int udpBufferFor(int winSize) {
+        return std::max(std::min(winSize, UDT_MAX_BUF), 1 * 1024 * 1024);
+    }
+
+    // 自建 UDP 套接字并交给 UDT（bind2），以便之后读回内核缓冲的实际大小；
+    // 失败时返回无效句柄，由 UDT 自行绑定
+    UDPSOCKET attachUdp(UDTSOCKET s, int port) {
+        UDPSOCKET fd = SocketBuffers::openBound(port, udpBufferFor(cfg.window));
+        if (SocketBuffers::valid(fd) && UDT::bind2(s, fd) == UDT::ERROR) {
+            SocketBuffers::closeFd(fd);
+            return SocketBuffers::invalidFd();
+        }
+        return fd;
+    }
+
+    // 创建并连接到 cfg.ip:cfg.port + portOffset（send / fetch 共用；消息数据面用 SOCK_DGRAM + 1）。
+    // tries > 1 时连接失败会间隔 100ms 重试（探测后接收端需要时间重新监听）
+    UDTSOCKET connectPeer(int type = SOCK_STREAM, int portOffset = 0, int tries = 1) {
+        sockaddr_in serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(cfg.port + portOffset);
+
+        if (inet_pton(AF_INET, cfg.ip.c_str(), &serv_addr.sin_addr) <= 0) {
+            throw std::runtime_error("Invalid IP address: " + cfg.ip);
+        }
+
+        std::cout << "[INFO] Connecting to " << cfg.ip << ":" << cfg.port + portOffset << "..." << std::endl;
+
+        for (int attempt = 1; ; ++attempt) {
+            UDTSOCKET s = UDT::socket(AF_INET, type, 0);
+            if (s == UDT::INVALID_SOCK) {
+                throw std::runtime_error("Failed to create socket");
+            }
+
+            tuneSocket(s, cfg.mss, cfg.window);
+            UDPSOCKET fd = attachUdp(s, 0);
+
+            if (UDT::ERROR != UDT::connect(s, (sockaddr *) &serv_addr, sizeof(serv_addr))) {
+                localBuffers = SocketBuffers::inspect(s, fd, udpBufferFor(cfg.window));
+                std::cout << "[INFO] Connected successfully" << std::endl;
+                return s;
+            }
+
+            std::string error = UDT::getlasterror().getErrorMessage();
+            UDT::close(s);
+            if (attempt >= tries) {
+                throw std::runtime_error("Connect failed: " + error);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    // 创建监听 socket（recv / serve 共用；消息数据面用 SOCK_DGRAM + 1）
+    UDTSOCKET openListener(int type = SOCK_STREAM, int portOffset = 0) {
+        UDTSOCKET serv = UDT::socket(AF_INET, type, 0);
+        if (serv == UDT::INVALID_SOCK) {
+            throw std::runtime_error("Failed to create server socket");
+        }
+
+        // Bind socket with conservative settings
+        tuneSocket(serv, cfg.mss, cfg.window);
+
+        // UDT 按设置时的 MSS 把缓冲字节数换算成包数，接受的连接继承包数。MSS 放开到上限而握手落回 1500 时
+        // 缓冲只剩请求窗口的约 1/6，所以按 DEFAULT_MSS 换算包数（巨型帧连接的缓冲相应变大，按需分配）
+        if (!cfg.mss_set && cfg.mss > DEFAULT_MSS) {
+            int64_t scaled = static_cast<int64_t>(std::min(cfg.window, UDT_MAX_BUF)) * (cfg.mss - UDP_IP_OVERHEAD) /
+                             (DEFAULT_MSS - UDP_IP_OVERHEAD);
+            int udtBuf = static_cast<int>(std::min<int64_t>(scaled, std::numeric_limits<int>::max()));
+            UDT::setsockopt(serv, 0, UDT_SNDBUF, &udtBuf, sizeof(int));
+            UDT::setsockopt(serv, 0, UDT_RCVBUF, &udtBuf, sizeof(int));
+        }
+
+        // 优先绑定自建 UDP 套接字（便于读回内核缓冲），失败时退回 UDT::bind
+        UDPSOCKET fd = attachUdp(serv, cfg.port + portOffset);
+        if (!SocketBuffers::valid(fd)) {
+            sockaddr_in my_addr;
+            memset(&my_addr, 0, sizeof(my_addr));
+            my_addr.sin_family = AF_INET;
+            my_addr.sin_port = htons(cfg.port + portOffset);
+            my_addr.sin_addr.s_addr = INADDR_ANY;
+
+            if (UDT::ERROR == UDT::bind(serv, (sockaddr *) &my_addr, sizeof(my_addr))) {
+                std::string error = UDT::getlasterror().getErrorMessage();
+                UDT::close(serv);
+                throw std::runtime_error("Bind failed: " + error);
+            }
+        }
+
+        UDT::listen(serv, 10);
+        localBuffers = SocketBuffers::inspect(serv, fd, udpBufferFor(cfg.window));
+        std::cout << "[INFO] Listening on port " << cfg.port + portOffset << "..." << std::endl;
+        return serv;
+    }
+
+    // 发送协议头与文件名
+    void sendHeader(UDTSOCKET s, int mss, int window, uint64_t fsize, const std::string &fname,
+                    uint32_t flags = 0) {
+        ProtocolHeader hdr;
+        hdr.magic = htonl(MAGIC_ID);
+        hdr.mss = htonl(mss);
+        hdr.window_size = htonl(window);
+        hdr.file_size = htonll(fsize);
+        hdr.flags = htonl(flags);
+        hdr.filename_len = htons(static_cast<uint16_t>(fname.size()));
+
+        // 发送协议头
+        if (!Utils::sendAll(s, (char *) &hdr, sizeof(hdr))) {
+            throw std::runtime_error("Failed to send protocol header");
+        }
+
+        // 发送文件名
+        if (!Utils::sendAll(s, fname.c_str(), static_cast<int>(fname.size()))) {
+            throw std::runtime_error("Failed to send filename");
+        }
+    }
+
+    // 发送哈希与完成标记
+    void sendTrailer(UDTSOCKET s, const uint8_t *hash) {
+        if (!Utils::sendAll(s, (const char *) hash, BLAKE3_OUT_LEN)) {
+            throw std::runtime_error("Failed to send hash");
+        }
+
+        if (!Utils::sendAll(s, TRANSFER_COMPLETE.c_str(), static_cast<int>(TRANSFER_COMPLETE.size()))) {
+            throw std::runtime_error("Failed to send completion marker");
+        }
+    }
+
+    // 取本端自定义拥塞控制器；UDT 默认控制器、SimpleCC 或取不到时返回 nullptr
+    ReportingCC *reportingController(UDTSOCKET s) {
+        CCC *cc = nullptr;
+        int len = sizeof(cc);
+        if (UDT::getsockopt(s, 0, UDT_CC, &cc, &len) == UDT::ERROR || cc == nullptr) {
+            return nullptr;
+        }
+        return dynamic_cast<ReportingCC *>(cc);
+    }
+
+    // UDT 收发缓冲配置之和（字节）；UDT 按需分配，这是上限
+    static uint64_t udtBufferBytes(UDTSOCKET s) {
+        int snd = 0, rcv = 0;
+        int len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_SNDBUF, &snd, &len);
+        len = sizeof(int);
+        UDT::getsockopt(s, 0, UDT_RCVBUF, &rcv, &len);
+        return static_cast<uint64_t>(std::max(0, snd)) + static_cast<uint64_t>(std::max(0, rcv));
+    }
+
+    // 读取本端自定义拥塞控制器的内部状态；没有时返回 null
+    json controllerState(UDTSOCKET s) {
+        ReportingCC *rc = reportingController(s);
+        return rc ? rc->report() : json();
+    }
+
+    // 取本端拥塞控制器的事件录制器；取不到时返回 nullptr
+    const CcRecorder *ccRecorder(UDTSOCKET s) {
+        CCC *cc = nullptr;
+        int len = sizeof(cc);
+        if (UDT::getsockopt(s, 0, UDT_CC, &cc, &len) == UDT::ERROR || cc == nullptr) {
+            return nullptr;
+        }
+        CcTraceSource *src = dynamic_cast<CcTraceSource *>(cc);
+        return src ? &src->recorder() : nullptr;
+    }
+
+    // 汇总拥塞控制事件录制；配置了 --cc-trace 时同时写出事件轨迹
+    json ccEvents(UDTSOCKET s) {
+        const CcRecorder *rec = ccRecorder(s);
+        if (!rec) {
+            return json();
+        }
+        if (!cfg.cc_trace.empty()) {
+            long lines = rec->writeTrace(cfg.cc_trace);
+            if (lines < 0) {
+                std::cerr << "[WARNING] Cannot write congestion-control trace: " << cfg.cc_trace << std::endl;
+            } else {
+                std::cout << "[INFO] Wrote " << lines << " congestion-control events to " << cfg.cc_trace << std::endl;
+            }
+        }
+        return rec->summary();
+    }
+
+    fs::path historyFile() const {
+        return cfg.history_file.empty() ? TransferHistory::defaultFile() : fs::path(cfg.history_file);
+    }
+
+    // 本地传输历史：先对照该对端此前的传输（基线不含本次），再追加本次记录；返回对照结果，没有历史时为 null。
+    // RTT 与重传率取自本端报告
+    json recordHistory(const json &stats, const std::string &peer, const std::string &role,
+                       const std::string &transport, uint64_t bytes, double duration, bool success) {
+        if (!cfg.record_history) {
+            return json();
+        }
+        double rtt = 0, retrans = 0;
+        if (stats.is_object() && stats.contains("latency")) {
+            rtt = stats["latency"].value("rtt_ms", 0.0);
+        }
+        if (stats.is_object() && stats.contains("reliability")) {
+            retrans = stats["reliability"].value("retrans_ratio", 0.0);
+        }
+        TransferHistory::Record rec = TransferHistory::make(TransferHistory::host(peer), role, transport, bytes,
+                                                            duration, rtt, retrans, success);
+        fs::path file = historyFile();
+        json comparison;
+        {
+            TransferHistory history(file);
+            if (history.open()) {
+                comparison = history.compare(rec);
+            }
+        }
+        if (!TransferHistory::append(file, rec)) {
+            std::cerr << "[WARNING] Cannot append to transfer history: " << file.string() << std::endl;
+        }
+        return comparison;
+    }
+
+    // 等待接收端确认并读取其报告；无报告时返回 null
+    json collectReport(UDTSOCKET s, bool &acked) {
+        acked = Utils::waitForAck(s, ACK_TRANSFER);
+
+        // 报告可能大于一次 recv 的量（阶段直方图、时间序列等），读到构成完整 JSON 或连接关闭为止
+        std::string resp;
+        std::vector<char> respBuf(65536);
+        while (resp.size() < REPORT_MAX_BYTES) {
+            int r = UDT::recv(s, respBuf.data(), static_cast<int>(respBuf.size()), 0);
+            if (r <= 0) {
+                break;
+            }
+            resp.append(respBuf.data(), r);
+            if (json::accept(resp)) {
+                break;
+            }
+        }
+        if (resp.empty()) {
+            return json();
+        }
+        try {
+            return json::parse(resp);
+        } catch (const json::exception &e) {
+            return json(resp);
+        }
+    }
+
+    // 传输前探测得到的带宽（bit/s），未探测时为 0
+    double probedBandwidth() const {
+        if (!probeInfo.is_object()) return 0;
+        double mbps = std::max(probeInfo.value("train_mbps", 0.0), probeInfo.value("est_bandwidth_mbps", 0.0));
+        return std::max(mbps, probeInfo.value("bandwidth_mbps", 0.0)) * 1e6;
+    }
+
+    // 进度输出（total == 0 表示长度未知的流）：数据路径只调用 showProgress 写原子计数，输出在独立线程
+    void startProgress(const std::string &role, uint64_t total) {
+        if (cfg.progress == "none") return;
+        progress.reset(new ProgressReporter(role, cfg.progress, cfg.progress_fd, cfg.progress_interval_ms,
+                                            cfg.detailed, total));
+        progress->begin();
+    }
+
+    void showProgress(uint64_t done) {
+        if (progress) {
+            progress->set(done);
+        }
+        if (tracer) {
+            tracer->setBytes(done);
+        }
+    }
+
+    void stopProgress() {
+        if (progress) {
+            progress->stop();
+            progress.reset();
+        }
+    }
+
+    // --perf-counters：各阶段累计硬件计数器；先在本线程试开一次，不可用时提示原因（计时与上下文切换照常）
+    void countHardware() {
+        if (!cfg.perf_counters) return;
+        stages->countHardware();
+        if (!PerfCounters::probe()) {
+            std::cout << "[WARNING] Hardware counters unavailable, reporting context switches only: "
+                    << PerfCounters::status().value("reason", "") << std::endl;
+        }
+    }
+
+    // Chrome 轨迹：在 stages 新建之后、数据线程开始之前调用；s 为 UDT 数据连接（udp 数据面传 INVALID_SOCK）
+    void startTrace(const std::string &role, UDTSOCKET s) {
+        if (cfg.trace.empty()) return;
+        tracer.reset(new TraceLog(role, s));
+        stages->attach(tracer.get());
+        tracer->begin();
+    }
+
+    // 数据线程结束后写出轨迹；拥塞控制录制的发送间隔 / 窗口作为计数器轨迹，丢包与超时作为瞬时事件
+    void finishTrace(UDTSOCKET s) {
+        if (!tracer) return;
+        tracer->stop();
+        if (const CcRecorder *rec = s != UDT::INVALID_SOCK ? ccRecorder(s) : nullptr) {
+            for (const CcRecorder::Event &e : rec->events()) {
+                tracer->counter("cc", e.tNs, json::object({{"period_us", e.periodUs}, {"cwnd_pkts", e.cwnd}}));
+                if (e.kind == CcRecorder::LOSS) {
+                    tracer->instant("loss", e.tNs, json::object({{"lost", e.value}}));
+                } else if (e.kind == CcRecorder::TIMEOUT) {
+                    tracer->instant("timeout", e.tNs, json::object());
+                }
+            }
+        }
+        long events = tracer->write(cfg.trace);
+        if (events < 0) {
+            std::cerr << "[WARNING] Cannot write trace: " << cfg.trace << std::endl;
+        } else {
+            std::cout << "[INFO] Wrote " << events << " trace events to " << cfg.trace << std::endl;
+        }
+        stages->attach(nullptr);
+        tracer.reset();
+    }
+
+    // 消息模式发送：把一个应用块切成带 (block, offset) 头的乱序消息
+    // 头部按文件偏移换算成协议分块 (APP_BLOCK_SIZE) 的块号与块内偏移，读块大小可以任意
+    void sendBlockMessages(UDTSOCKET ds, uint64_t fileOffset, const char *data, int len,
+                           std::vector<char> &msgBuf, BlockSizer &sizer) {
+        for (int off = 0; off < len; off += MSG_CHUNK_SIZE) {
+            int n = std::min(MSG_CHUNK_SIZE, len - off);
+            uint64_t pos = fileOffset + off;
+
+            MsgHeader mh;
+            mh.block_index = htonll(pos / APP_BLOCK_SIZE);
+            mh.offset = htonl(static_cast<uint32_t>(pos % APP_BLOCK_SIZE));
+            memcpy(msgBuf.data(), &mh, sizeof(mh));
+            memcpy(msgBuf.data() + sizeof(mh), data + off, n);
+
+            // ttl = -1 保证可靠送达，inorder = false 允许接收端乱序交付
+            int total = static_cast<int>(sizeof(mh)) + n;
+            if (sizer.call([&] { return stages->send.timed([&] { return UDT::sendmsg(ds, msgBuf.data(), total, -1, false); }); }) != total) {
+                throw std::runtime_error("Send failed: " + std::string(UDT::getlasterror().getErrorMessage()));
+            }
+        }
+    }
+
+    // 消息模式接收：每条消息按 (block, offset) 直接写到文件位置，哈希经 ReorderBuffer 按序计算
+    // hintSock 有效时按周期经控制连接回报写盘速率
+    uint64_t receiveMessages(UDTSOCKET ds, std::ostream &out, bool seekable, uint64_t rSize,
+                             ReorderBuffer &reorder, DiskRateMeter &disk, UDTSOCKET hintSock) {
+        std::vector<char> mbuf(sizeof(MsgHeader) + MSG_CHUNK_SIZE);
+        uint64_t received = 0;
+
+        while (received < rSize) {
+            int r = stages->recv.timed([&] { return UDT::recvmsg(ds, mbuf.data(), static_cast<int>(mbuf.size())); });
+            if (r == UDT::ERROR) {
+                std::string error = UDT::getlasterror().getErrorMessage();
+                throw std::runtime_error("Receive error: " + error);
+            }
+            if (r < static_cast<int>(sizeof(MsgHeader))) {
+                throw std::runtime_error("Invalid data message size: " + std::to_string(r));
+            }
+
+            MsgHeader mh;
+            memcpy(&mh, mbuf.data(), sizeof(mh));
+            uint64_t pos = ntohll(mh.block_index) * APP_BLOCK_SIZE + ntohl(mh.offset);
+            int len = r - static_cast<int>(sizeof(MsgHeader));
+            const char *payload = mbuf.data() + sizeof(MsgHeader);
+
+            if (pos + len > rSize) {
+                throw std::runtime_error("Data message out of range");
+            }
+
+            if (seekable) {
+                disk.write(len, [&] {
+                    stages->write.timed(len, [&] {
+                        out.seekp(static_cast<std::streamoff>(pos));
+                        out.write(payload, len);
+                    });
+                });
+            }
+            reorder.push(pos, payload, len, [&](const char *d, int n) {
+                stages->hash.timed(n, [&] { blake3_hasher_update(&hasher, d, n); });
+                if (!seekable) {
+                    disk.write(n, [&] { stages->write.timed(n, [&] { out.write(d, n); }); });
+                }
+            });
+            if (!out) {
+                throw std::runtime_error("Failed to write to file");
+            }
+
+            double hint = 0;
+            if (hintSock != UDT::INVALID_SOCK && disk.poll(hint)) {
+                sendDiskHint(hintSock, hint, false);
+            }
+
+            received += len;
+            if (live) {
+                live->bytes.store(received, std::memory_order_relaxed);
+            }
+            showProgress(received);
+        }
+        return received;
+    }
+
+    // 写盘速率提示（FLAG_DISK_HINT）：接收端 -> 发送端，final 表示此后不再发送
+    void sendDiskHint(UDTSOCKET s, double bps, bool final) {
+        DiskHint h;
+        h.magic = htonl(DISK_HINT_MAGIC);
+        h.flags = htonl(final ? DISK_HINT_FINAL : 0);
+        h.bits_per_sec = htonll(static_cast<uint64_t>(bps));
+        if (!Utils::sendAll(s, (char *) &h, sizeof(h))) {
+            throw std::runtime_error("Failed to send disk rate hint");
+        }
+    }
+
+    // 原生 UDP 发送：首轮按速率顺序发送全部数据报（同时按序计算哈希），
+    // 之后根据接收端经控制连接回报的丢包位图重传，直到接收端宣告收齐
+    // 出错时为唤醒读线程会关闭控制连接，并把 ctrl 置为 INVALID_SOCK，调用方不再重复关闭
+    json sendUdpBlast(UDTSOCKET &ctrl, const fs::path &filePath, uint64_t fsize) {
+        UdpLayout layout(cfg.mss, fsize);
+        int stride = static_cast<int>(sizeof(UdpHeader)) + layout.payload;
+        UdpChannel ch;
+        ch.setBuffers(std::max(cfg.window, 1 * 1024 * 1024));
+        ch.connectTo(cfg.ip, cfg.port + 1);
+        if (!cfg.no_gso && !ch.enableGso(stride)) {
+            std::cout << "[WARNING] " << ch.gsoFallback << ", sending one datagram per packet" << std::endl;
+        }
+
+        // 顺序读（首轮 + 哈希）与随机读（重传）分开
+        std::ifstream ifs(filePath, std::ios::binary);
+        std::ifstream rfs(filePath, std::ios::binary);
+        if (!ifs || !rfs) {
+            throw std::runtime_error("Cannot open file for reading: " + cfg.path);
+        }
+
+        // 后台线程读取控制连接上的丢包位图
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::set<uint64_t> retrans;
+        // 最近一次重传的时间：接收端每个报告周期都会重报全部缺失位，
+        // 一个 RTT 加一个报告周期内重传过的序号不再重传，否则 RTT 越大同一数据报重复越多
+        std::map<uint64_t, std::chrono::steady_clock::time_point> resentAt;
+        std::chrono::steady_clock::duration holdoff = std::chrono::milliseconds(LOSS_REPORT_INTERVAL_MS);
+        bool done = false;
+        bool ctrlFailed = false;
+        bool firstPassDone = false;
+        uint64_t reports = 0, suppressed = 0;
+        // 流控：新数据不超过接收端首个空洞之后一个窗口，与接收端乱序缓冲的上限一致
+        uint64_t ackBase = 0, windowWaits = 0;
+        const uint64_t windowDgrams = std::max<uint64_t>(1, static_cast<uint64_t>(cfg.window) / layout.payload);
+
+        std::thread reader([&] {
+            ThreadRoles::Scope role("loss-reader");
+            std::vector<uint8_t> bits;
+            uint64_t lastHighest = 0;
+            while (true) {
+                LossReport rep;
+                bool ok = Utils::recvAll(ctrl, (char *) &rep, sizeof(rep));
+                uint64_t base = ntohll(rep.base);
+                uint64_t highest = ntohll(rep.highest);
+                uint32_t nbits = ntohl(rep.nbits);
+                if (ok && nbits <= MAX_REPORT_BITS) {
+                    bits.resize((nbits + 7) / 8);
+                    ok = Utils::recvAll(ctrl, (char *) bits.data(), static_cast<int>(bits.size()));
+                } else {
+                    ok = false;
+                }
+
+                // 控制连接与数据面同路径，取其 RTT 作为重传间隔
+                UDT::TRACEINFO perf;
+                bool haveRtt = ok && UDT::perfmon(ctrl, &perf, false) != UDT::ERROR && perf.msRTT > 0;
+
+                std::lock_guard<std::mutex> lk(mtx);
+                if (!ok) {
+                    ctrlFailed = true;
+                    cv.notify_all();
+                    return;
+                }
+                reports++;
+                if (nbits == 0 && base == layout.total && highest == layout.total) {
+                    done = true;
+                    cv.notify_all();
+                    return;
+                }
+                ackBase = std::max(ackBase, base);
+                if (haveRtt) {
+                    holdoff = std::chrono::microseconds(static_cast<int64_t>(perf.msRTT * 1000)) +
+                              std::chrono::milliseconds(LOSS_REPORT_INTERVAL_MS);
+                }
+
+                // base 之前的都已收到，不再需要重传时间
+                resentAt.erase(resentAt.begin(), resentAt.lower_bound(base));
+                auto now = std::chrono::steady_clock::now();
+                auto request = [&](uint64_t g) {
+                    auto it = resentAt.find(g);
+                    if (it != resentAt.end() && now - it->second < holdoff) {
+                        suppressed++;
+                        return;
+                    }
+                    retrans.insert(g);
+                };
+
+                for (uint32_t i = 0; i < nbits; ++i) {
+                    if ((bits[i >> 3] >> (i & 7)) & 1) {
+                        if (base + i < layout.total) request(base + i);
+                    }
+                }
+
+                // 尾部丢失：首轮已发完而接收端进度停滞，视 [highest, total) 为缺失
+                if (firstPassDone && highest == lastHighest && highest < layout.total) {
+                    uint64_t end = std::min<uint64_t>(layout.total, highest + MAX_REPORT_BITS);
+                    for (uint64_t g = highest; g < end; ++g) request(g);
+                }
+                lastHighest = highest;
+                cv.notify_all();
+            }
+        });
+
+        double rate = cfg.rate_bps > 0 ? cfg.rate_bps : DEFAULT_UDP_RATE_BPS;
+        Pacer pacer(rate);
+        // GSO 退回后容量只会变小，缓冲按初始容量分配
+        const int maxBatch = ch.sendCapacity();
+        std::vector<char> batch(static_cast<size_t>(maxBatch) * stride);
+        std::vector<int> lens(maxBatch);
+        std::vector<uint64_t> ids(maxBatch);
+
+        std::vector<char> block(APP_BLOCK_SIZE);
+        uint64_t curBlock = UINT64_MAX;
+        uint64_t next = 0;
+        uint64_t dgramSent = 0, retransSent = 0, sendErrors = 0;
+
+        auto putHeader = [&](int i, uint64_t g) {
+            UdpHeader uh;
+            uh.block_index = htonll(g / layout.perBlock);
+            uh.seq = htonl(static_cast<uint32_t>(g % layout.perBlock));
+            memcpy(batch.data() + i * stride, &uh, sizeof(uh));
+            lens[i] = static_cast<int>(sizeof(uh)) + layout.lengthOf(g);
+        };
+
+        try {
+            while (true) {
+                int count = 0;
+                int cap = ch.sendCapacity();
+                uint64_t windowEnd;
+                {
+                    std::unique_lock<std::mutex> lk(mtx);
+                    if (ctrlFailed) {
+                        throw std::runtime_error("Control connection lost during UDP transfer");
+                    }
+                    if (done) break;
+
+                    // 重传优先
+                    auto now = std::chrono::steady_clock::now();
+                    while (count < cap && !retrans.empty()) {
+                        ids[count++] = *retrans.begin();
+                        resentAt[*retrans.begin()] = now;
+                        retrans.erase(retrans.begin());
+                    }
+
+                    if (count == 0 && next == layout.total) {
+                        firstPassDone = true;
+                        cv.wait_for(lk, std::chrono::milliseconds(LOSS_REPORT_INTERVAL_MS),
+                                    [&] { return done || ctrlFailed || !retrans.empty(); });
+                        continue;
+                    }
+                    if (count == 0 && next >= ackBase + windowDgrams) {
+                        windowWaits++;
+                        cv.wait_for(lk, std::chrono::milliseconds(LOSS_REPORT_INTERVAL_MS),
+                                    [&] { return done || ctrlFailed || !retrans.empty() || next < ackBase + windowDgrams; });
+                        continue;
+                    }
+                    windowEnd = std::min<uint64_t>(layout.total, ackBase + windowDgrams);
+                }
+
+                for (int i = 0; i < count; ++i) {
+                    putHeader(i, ids[i]);
+                    rfs.clear();
+                    rfs.seekg(static_cast<std::streamoff>(layout.offsetOf(ids[i])));
+                    rfs.read(batch.data() + i * stride + sizeof(UdpHeader), layout.lengthOf(ids[i]));
+                    if (!rfs) {
+                        throw std::runtime_error("Read error during retransmission");
+                    }
+                }
+                retransSent += count;
+
+                // 新数据：按块顺序读取并计算哈希
+                while (count < cap && next < windowEnd) {
+                    uint64_t b = next / layout.perBlock;
+                    if (b != curBlock) {
+                        int blockLen = static_cast<int>(std::min<uint64_t>(APP_BLOCK_SIZE, fsize - b * APP_BLOCK_SIZE));
+                        if (!ifs.read(block.data(), blockLen)) {
+                            throw std::runtime_error("Read error on " + cfg.path);
+                        }
+                        blake3_hasher_update(&hasher, block.data(), blockLen);
+                        curBlock = b;
+                    }
+                    putHeader(count, next);
+                    memcpy(batch.data() + count * stride + sizeof(UdpHeader),
+                           block.data() + (next % layout.perBlock) * layout.payload, layout.lengthOf(next));
+                    count++;
+                    next++;
+                }
+
+                size_t wireBytes = 0;
+                for (int i = 0; i < count; ++i) wireBytes += lens[i] + UDP_IP_OVERHEAD;
+                pacer.wait(wireBytes);
+
+                // 发送失败的数据报由接收端位图触发重传
+                int n = ch.sendBatch(batch.data(), stride, lens.data(), count);
+                sendErrors += count - n;
+                dgramSent += n;
+
+                showProgress(std::min(next * layout.payload, fsize));
+            }
+        } catch (...) {
+            // 关闭控制连接以唤醒读线程，句柄随即作废
+            UDT::close(ctrl);
+            reader.join();
+            ctrl = UDT::INVALID_SOCK;
+            throw;
+        }
+        reader.join();
+
+        return json::object({
+            {"payload_bytes", layout.payload},
+            {"rate_bps", rate},
+            {"datagrams_total", layout.total},
+            {"datagrams_sent", dgramSent},
+            {"retransmitted", retransSent},
+            {"retrans_suppressed", suppressed},
+            {"window_waits", windowWaits},
+            {"send_errors", sendErrors},
+            {"loss_reports", reports},
+            {"gso", ch.gsoActive()},
+            {"gso_fallback", ch.gsoFallback},
+            {"send_syscalls", ch.sendCalls}
+        });
+    }
+
+    // 原生 UDP 接收：数据报直接写到文件位置，哈希经 ReorderBuffer 按序计算，
+    // 每 LOSS_REPORT_INTERVAL_MS 经控制连接回报一次丢包位图
+    uint64_t receiveUdpBlast(UDTSOCKET ctrl, std::ostream &out, bool seekable, uint64_t rSize,
+                             int rMSS, int rWin, ReorderBuffer &reorder, json &udpStats) {
+        UdpLayout layout(rMSS, rSize);
+        if (layout.payload <= 0) {
+            throw std::runtime_error("MSS too small for UDP transport");
+        }
+
+        UdpChannel ch;
+        ch.setBuffers(std::max(rWin, 1 * 1024 * 1024));
+        ch.bindLocal(cfg.port + 1);
+        ch.setRecvTimeout(LOSS_REPORT_INTERVAL_MS);
+        if (!cfg.no_gso && !ch.enableGro()) {
+            std::cout << "[INFO] UDP_GRO unavailable, receiving one datagram per packet" << std::endl;
+        }
+        Utils::sendAll(ctrl, DATA_READY.c_str(), static_cast<int>(DATA_READY.size()));
+
+        std::vector<uint64_t> have((layout.total + 63) / 64, 0);
+        auto has = [&](uint64_t g) { return ((have[g >> 6] >> (g & 63)) & 1) != 0; };
+
+        uint64_t count = 0, firstMissing = 0, highest = 0, received = 0;
+        uint64_t dups = 0, invalid = 0, deferred = 0, reports = 0, batches = 0;
+        uint64_t writePos = 0;
+        uint64_t reportedBase = 0;
+        const uint64_t halfWindow = std::max<uint64_t>(1, static_cast<uint64_t>(rWin) / layout.payload / 2);
+
+        int stride = static_cast<int>(sizeof(UdpHeader)) + layout.payload;
+        int maxDgrams = ch.prepareRecv(stride);
+        std::vector<const char *> dgrams(maxDgrams);
+        std::vector<int> lens(maxDgrams);
+        std::vector<uint8_t> bits;
+
+        auto sendReport = [&](bool final) {
+            LossReport rep;
+            uint32_t nbits = 0;
+            if (final) {
+                rep.base = htonll(layout.total);
+                rep.highest = htonll(layout.total);
+            } else {
+                nbits = static_cast<uint32_t>(std::min<uint64_t>(MAX_REPORT_BITS,
+                                                                 highest > firstMissing ? highest - firstMissing : 0));
+                bits.assign((nbits + 7) / 8, 0);
+                for (uint32_t i = 0; i < nbits; ++i) {
+                    if (!has(firstMissing + i)) bits[i >> 3] |= static_cast<uint8_t>(1 << (i & 7));
+                }
+                rep.base = htonll(firstMissing);
+                rep.highest = htonll(highest);
+            }
+            rep.nbits = htonl(nbits);
+            if (!Utils::sendAll(ctrl, (char *) &rep, sizeof(rep)) ||
+                !Utils::sendAll(ctrl, (char *) bits.data(), static_cast<int>(final ? 0 : bits.size()))) {
+                throw std::runtime_error("Failed to send loss report");
+            }
+            reports++;
+        };
+
+        auto lastReport = std::chrono::steady_clock::now();
+        auto lastData = lastReport;
+
+        while (count < layout.total) {
+            int n = ch.recvBatch(dgrams.data(), lens.data(), maxDgrams);
+            auto now = std::chrono::steady_clock::now();
+            if (n > 0) {
+                lastData = now;
+                batches++;
+            } else if (now - lastData > std::chrono::milliseconds(UDP_IDLE_TIMEOUT_MS)) {
+                throw std::runtime_error("UDP data plane timed out");
+            }
+
+            for (int i = 0; i < n; ++i) {
+                const char *dg = dgrams[i];
+                int len = lens[i] - static_cast<int>(sizeof(UdpHeader));
+                if (len <= 0) {
+                    invalid++;
+                    continue;
+                }
+
+                UdpHeader uh;
+                memcpy(&uh, dg, sizeof(uh));
+                uint64_t blockIdx = ntohll(uh.block_index);
+                uint32_t seq = ntohl(uh.seq);
+                uint64_t g = blockIdx * layout.perBlock + seq;
+                if (seq >= layout.perBlock || g >= layout.total || len != layout.lengthOf(g)) {
+                    invalid++;
+                    continue;
+                }
+                if (has(g)) {
+                    dups++;
+                    continue;
+                }
+                // 超前太多、乱序缓冲已满：当作丢失，待前面的空洞补上后按丢包报告重传
+                uint64_t pos = layout.offsetOf(g);
+                if (pos != reorder.contiguous() && !reorder.admits(len)) {
+                    deferred++;
+                    continue;
+                }
+                have[g >> 6] |= (1ULL << (g & 63));
+                count++;
+                highest = std::max(highest, g + 1);
+
+                const char *payload = dg + sizeof(UdpHeader);
+                if (seekable) {
+                    // 顺序到达时不做 seek，避免每个数据报都刷新文件缓冲
+                    if (pos != writePos) out.seekp(static_cast<std::streamoff>(pos));
+                    out.write(payload, len);
+                    writePos = pos + len;
+                }
+                reorder.push(pos, payload, len, [&](const char *d, int m) {
+                    blake3_hasher_update(&hasher, d, m);
+                    if (!seekable) {
+                        out.write(d, m);
+                    }
+                });
+                if (!out) {
+                    throw std::runtime_error("Failed to write to file");
+                }
+                received += len;
+            }
+
+            while (firstMissing < layout.total && has(firstMissing)) firstMissing++;
+
+            // 发送端按报告中的首个空洞推进窗口：前沿推进半个窗口时提前报告，不必等满一个周期
+            if (count < layout.total && (now - lastReport >= std::chrono::milliseconds(LOSS_REPORT_INTERVAL_MS) ||
+                                         firstMissing >= reportedBase + halfWindow)) {
+                sendReport(false);
+                lastReport = now;
+                reportedBase = firstMissing;
+            }
+
+            showProgress(received);
+        }
+
+        sendReport(true);
+
+        udpStats = json::object({
+            {"payload_bytes", layout.payload},
+            {"datagrams_total", layout.total},
+            {"duplicates", dups},
+            {"invalid", invalid},
+            {"deferred", deferred},
+            {"loss_reports", reports},
+            {"recv_batches", batches},
+            {"avg_batch", batches > 0 ? static_cast<double>(count + dups + invalid) / batches : 0.0},
+            {"gro", ch.groActive()},
+            {"recv_syscalls", ch.recvCalls}
+        });
+        return received;
+    }
+
+    // 根据保存路径与远端文件名确定输出文件（目录则拼接文件名，已存在则加时间戳）
+    fs::path resolveOutputPath(const std::string &filename) {
+#ifdef _WIN32
+        fs::path baseDir = fs::path(Utf8Util::toWide(cfg.path));
+        fs::path outPath = baseDir;
+        if (fs::is_directory(baseDir)) {
+            outPath /= fs::path(Utf8Util::toWide(filename)).filename();
+        }
+#else
+        fs::path outPath = cfg.path;
+        if (fs::is_directory(outPath)) {
+            outPath /= fs::path(filename).filename();
+        }
+#endif
+
+        // 确保目录存在
+        if (outPath.has_parent_path()) {
+            fs::create_directories(outPath.parent_path());
+        }
+
+        // 如果文件已存在，添加时间戳后缀
+        if (fs::exists(outPath)) {
+            auto now = std::chrono::system_clock::now();
+            auto in_time_t = std::chrono::system_clock::to_time_t(now);
+            std::tm tm = localTime(in_time_t);
+            std::stringstream ss;
+            ss << std::put_time(&tm, "_%Y%m%d_%H%M%S");
+            outPath.replace_filename(outPath.stem().string() + ss.str() + outPath.extension().string());
+        }
+        return outPath;
+    }
+
+    // 接收端会话主体：从已连接的 socket 接收一个文件（recv / fetch 共用）
+    // 连接发起方（send / fetch）：未显式指定 --mss 时按路径 MTU 设置 UDT_MSS（须在 connect 前）
+    void choosePathMss() {
+        if (cfg.mss_set || !cfg.pmtu) {
+            return;
+        }
+        std::string source;
+        cfg.mss = PathMtu::discover(cfg.ip, cfg.port, source);
+        pmtuInfo = json::object({{"mss", cfg.mss}, {"source", source}});
+        std::cout << "[INFO] Path MTU: MSS " << cfg.mss << " (" << source << ")" << std::endl;
+    }
+
+    // 监听方：UDT 握手取双方 MSS 的较小值，未显式指定时放开到上限，由发起方的路径 MTU 决定
+    void allowPeerMss() {
+        if (!cfg.mss_set) {
+            cfg.mss = MAX_MSS;
+        }
+    }
+
+    // 传输前探测（发送端）：往返测 RTT，发一段数据列车测带宽，把窗口设为约 2×BDP 并通知接收端。
+    // UDT 与内核缓冲只能在绑定前设置，所以探测用独立连接，结束后双方按新窗口重建连接
+    void probePath() {
+        UDTSOCKET ps = connectPeer();
+        try {
+            sendHeader(ps, cfg.mss, cfg.window, PROBE_TRAIN_BYTES, "", FLAG_PROBE);
+
+            double rttUs = 0;
+            for (int i = 0; i < PROBE_PINGS; ++i) {
+                auto t0 = std::chrono::steady_clock::now();
+                uint64_t ping = htonll(static_cast<uint64_t>(i));
+                uint64_t echo = 0;
+                if (!Utils::sendAll(ps, (char *) &ping, sizeof(ping)) ||
+                    !Utils::recvAll(ps, (char *) &echo, sizeof(echo))) {
+                    throw std::runtime_error("Probe ping failed");
+                }
+                double sample = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+                if (rttUs <= 0 || sample < rttUs) rttUs = sample;
+            }
+
+            std::vector<char> train(MSG_CHUNK_SIZE, 0);
+            for (uint32_t sent = 0; sent < PROBE_TRAIN_BYTES; sent += MSG_CHUNK_SIZE) {
+                int len = static_cast<int>(std::min<uint32_t>(MSG_CHUNK_SIZE, PROBE_TRAIN_BYTES - sent));
+                if (!Utils::sendAll(ps, train.data(), len)) {
+                    throw std::runtime_error("Probe train failed");
+                }
+            }
+
+            ProbeResult res;
+            if (!Utils::recvAll(ps, (char *) &res, sizeof(res))) {
+                throw std::runtime_error("Probe result not received");
+            }
+            uint64_t bytes = ntohll(res.bytes);
+            uint64_t usec = ntohll(res.usec);
+            double trainBps = usec > 0 ? bytes * 8.0 / usec * 1e6 : 0.0;
+            double estBps = ntohll(res.est_bw_kbps) * 1000.0;
+
+            // 列车在慢启动阶段测得的是下限，包对估计的是链路容量：取两者较大者
+            double bwBps = std::max(trainBps, estBps);
+            double bdp = bwBps * rttUs / 1e6 / 8.0;
+            int window = Config::clampWindow(static_cast<int64_t>(std::min<double>(UDT_MAX_BUF,
+                                                                                   std::max<double>(PROBE_MIN_WINDOW, 2 * bdp))));
+
+            ProbeDecision dec;
+            dec.window = htonl(static_cast<uint32_t>(window));
+            dec.rtt_us = htonl(static_cast<uint32_t>(rttUs));
+            dec.bw_bps = htonll(static_cast<uint64_t>(bwBps));
+            if (!Utils::sendAll(ps, (char *) &dec, sizeof(dec))) {
+                throw std::runtime_error("Failed to send probe decision");
+            }
+
+            // 等接收端关闭探测连接（随后它会按新窗口重新监听）
+            int timeout = 5000;
+            UDT::setsockopt(ps, 0, UDT_RCVTIMEO, &timeout, sizeof(int));
+            char c;
+            UDT::recv(ps, &c, 1, 0);
+
+            cfg.window = window;
+            probeInfo = json::object({
+                {"rtt_ms", rttUs / 1000.0},
+                {"train_mbps", trainBps / 1e6},
+                {"est_bandwidth_mbps", estBps / 1e6},
+                {"bdp_bytes", bdp},
+                {"window_bytes", window}
+            });
+            std::cout << "[INFO] Probe: RTT " << std::fixed << std::setprecision(2) << rttUs / 1000.0
+                    << " ms, bandwidth " << bwBps / 1e6 << " Mbps, window -> " << Utils::formatSize(window)
+                    << std::endl;
+        } catch (...) {
+            UDT::close(ps);
+            throw;
+        }
+        UDT::close(ps);
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROBE_RELISTEN_MS));
+    }
+
+    // 传输前探测（接收端）：回显 ping、计时数据列车、接受发送端给出的窗口
+    void answerProbe(UDTSOCKET s, uint64_t trainBytes) {
+        for (int i = 0; i < PROBE_PINGS; ++i) {
+            uint64_t ping;
+            if (!Utils::recvAll(s, (char *) &ping, sizeof(ping)) ||
+                !Utils::sendAll(s, (char *) &ping, sizeof(ping))) {
+                throw std::runtime_error("Probe ping failed");
+            }
+        }
+
+        // 以首个到达的数据块为起点，只统计其后的字节
+        std::vector<char> buf(MSG_CHUNK_SIZE);
+        uint64_t got = 0, firstLen = 0;
+        auto first = std::chrono::steady_clock::now();
+        while (got < trainBytes) {
+            int r = UDT::recv(s, buf.data(), static_cast<int>(std::min<uint64_t>(buf.size(), trainBytes - got)), 0);
+            if (r <= 0) {
+                throw std::runtime_error("Probe train interrupted");
+            }
+            if (got == 0) {
+                first = std::chrono::steady_clock::now();
+                firstLen = r;
+            }
+            got += r;
+        }
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - first);
+
+        UDT::TRACEINFO perf;
+        UDT::perfmon(s, &perf);
+
+        ProbeResult res;
+        res.bytes = htonll(got - firstLen);
+        res.usec = htonll(static_cast<uint64_t>(usec.count()));
+        res.est_bw_kbps = htonll(static_cast<uint64_t>(std::max(0.0, perf.mbpsBandwidth) * 1000));
+        ProbeDecision dec;
+        if (!Utils::sendAll(s, (char *) &res, sizeof(res)) ||
+            !Utils::recvAll(s, (char *) &dec, sizeof(dec))) {
+            throw std::runtime_error("Probe exchange failed");
+        }
+
+        cfg.window = Config::clampWindow(ntohl(dec.window));
+        probeInfo = json::object({
+            {"rtt_ms", ntohl(dec.rtt_us) / 1000.0},
+            {"bandwidth_mbps", ntohll(dec.bw_bps) / 1e6},
+            {"window_bytes", cfg.window}
+        });
+        std::cout << "[INFO] Probe finished, window -> " << Utils::formatSize(cfg.window) << std::endl;
+    }
+
+    // 接收一个文件；连接是传输前探测时返回 false（窗口已按探测结论更新）
+    bool receiveFile(UDTSOCKET s) {
+        // 读取协议头
+        ProtocolHeader hdr;
+        if (!Utils::recvAll(s, (char *) &hdr, sizeof(hdr))) {
+            throw std::runtime_error("Invalid protocol header received");
+        }
+
+        // 验证魔数
+        if (ntohl(hdr.magic) != MAGIC_ID) {
+            if ((ntohl(hdr.magic) & 0xFFFFFF00) == (MAGIC_ID & 0xFFFFFF00)) {
+                throw std::runtime_error("Protocol version mismatch: peer speaks HRP" +
+                                         std::string(1, static_cast<char>(ntohl(hdr.magic) & 0xFF)) +
+                                         ", this build speaks HRP" + std::string(1, static_cast<char>(MAGIC_ID & 0xFF)));
+            }
+            throw std::runtime_error("Invalid protocol magic number");
+        }
+
+        int rMSS = ntohl(hdr.mss);
+        int rWin = Config::clampWindow(ntohl(hdr.window_size));
+        uint64_t rSize = ntohll(hdr.file_size);
+        uint32_t rFlags = ntohl(hdr.flags);
+        uint16_t nameLen = ntohs(hdr.filename_len);
+        bool streamed = (rFlags & FLAG_STREAM) != 0;
+        bool msgMode = (rFlags & FLAG_MSG) != 0;
+        bool udpMode = (rFlags & FLAG_UDP) != 0;
+        bool diskHints = (rFlags & FLAG_DISK_HINT) != 0 && !udpMode && cfg.disk_hint;
+
+        if (streamed && (msgMode || udpMode)) {
+            throw std::runtime_error("Message/UDP transport does not support streams of unknown length");
+        }
+
+        if (rFlags & FLAG_PROBE) {
+            answerProbe(s, rSize);
+            return false;
+        }
+
+        // 应用发送方的窗口设置
+        tuneSocket(s, rMSS, rWin);
+
+        std::cout << "[INFO] Remote config - MSS: " << rMSS << ", Window: "
+                << Utils::formatSize(rWin) << std::endl;
+
+        // 读取文件名
+        std::vector<char> nameBuf(nameLen + 1);
+        if (!Utils::recvAll(s, nameBuf.data(), nameLen)) {
+            throw std::runtime_error("Failed to receive filename");
+        }
+        nameBuf[nameLen] = 0;
+        std::string filename = nameBuf.data();
+
+        // 应答写盘速率提示请求：发送端据此决定是否读取提示帧
+        if (rFlags & FLAG_DISK_HINT) {
+            const std::string &echo = diskHints ? DISK_HINT_ACCEPT : DISK_HINT_DECLINE;
+            if (!Utils::sendAll(s, echo.c_str(), static_cast<int>(echo.size()))) {
+                throw std::runtime_error("Failed to answer disk hint request");
+            }
+        }
+
+        std::cout << "[INFO] Receiving file: " << filename << " ("
+                << (streamed ? std::string("stream") : Utils::formatSize(rSize)) << ")" << std::endl;
+
+        // 输出到 stdout 时数据直接写原始 stdout 缓冲区（日志已由 stdoutGuard 改走 stderr）
+        bool toStdout = (cfg.path == STDIO_PATH);
+        std::ofstream ofs;
+        std::ostream out(toStdout ? stdoutGuard.dataBuf() : ofs.rdbuf());
+
+        fs::path outPath = "stdout";
+        if (!toStdout) {
+            outPath = resolveOutputPath(filename);
+            ofs.open(outPath, std::ios::binary);
+            if (!ofs) {
+                throw std::runtime_error("Cannot open file for writing: " + outPath.string());
+            }
+        }
+
+        // 消息模式：在控制端口 + 1 上接受数据连接，就绪后通知发送端
+        UDTSOCKET dataSock = s;
+        if (msgMode) {
+            UDTSOCKET dserv = openListener(SOCK_DGRAM, 1);
+            Utils::sendAll(s, DATA_READY.c_str(), static_cast<int>(DATA_READY.size()));
+
+            sockaddr_in data_addr;
+            int addrlen = sizeof(data_addr);
+            dataSock = UDT::accept(dserv, (sockaddr *) &data_addr, &addrlen);
+            UDT::close(dserv);
+            if (dataSock == UDT::INVALID_SOCK) {
+                std::string error = UDT::getlasterror().getErrorMessage();
+                throw std::runtime_error("Data plane accept failed: " + error);
+            }
+            tuneSocket(dataSock, rMSS, rWin);
+        }
+
+        // 写块大小：auto 时起点按探测带宽，之后按 UDT::recv 调用开销与 UDT 接收缓冲积压调整
+        int64_t memLimit = static_cast<int64_t>(cfg.mem_limit_mb) * 1024 * 1024;
+        int maxBlock = static_cast<int>(std::min<int64_t>(cfg.block_auto ? MAX_BLOCK_SIZE : cfg.block_size, memLimit));
+        BlockSizer sizer(cfg.block_size, cfg.block_auto);
+        sizer.begin(cfg.block_auto ? BlockSizer::fromProbe(probedBandwidth(), cfg.block_size, maxBlock)
+                                   : std::min(cfg.block_size, maxBlock));
+        int rcvBufBytes = 0;
+        int optLen = sizeof(rcvBufBytes);
+        UDT::getsockopt(s, 0, UDT_RCVBUF, &rcvBufBytes, &optLen);
+
+        std::vector<char> buf;
+        uint64_t received = 0;
+        uint64_t chunkLeft = 0;
+        // UDT 数据面的流控窗口本身限制了超前量，上限多留一条消息的余量
+        ReorderBuffer reorder(static_cast<uint64_t>(rWin) + MSG_CHUNK_SIZE);
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+
+        std::cout << "[INFO] Saving to: " <<
+#ifdef _WIN32
+                Utf8Util::toUtf8(outPath.filename().wstring())
+#else
+                outPath.filename().string()
+#endif
+                << std::endl;
+
+        json udpStats;
+        DiskRateMeter disk;
+        std::unique_ptr<StatsSampler> sampler;
+        if (udpMode) {
+            if (!cfg.stats_out.empty()) {
+                std::cout << "[WARNING] --stats-out samples UDT data planes; ignored for udp transport" << std::endl;
+            }
+        } else {
+            sampler = startSampler(dataSock, "receiver");
+        }
+        stages = std::make_shared<StageStats>();
+        countHardware();
+        ResourceUsage usage;
+        usage.begin();
+        stages->begin();
+        startTrace("receiver", udpMode ? UDT::INVALID_SOCK : dataSock);
+        startProgress("receiver", streamed ? 0 : rSize);
+        if (!udpMode) {
+            publish(filename, "receiver", Utils::peerToString(s), dataSock, streamed ? 0 : rSize);
+        }
+        if (msgMode) {
+            received = receiveMessages(dataSock, out, !toStdout, rSize, reorder, disk,
+                                       diskHints ? s : UDT::INVALID_SOCK);
+        } else if (udpMode) {
+            received = receiveUdpBlast(s, out, !toStdout, rSize, rMSS, rWin, reorder, udpStats);
+        }
+
+        // 接收数据（流模式下逐块读取长度前缀，直到长度为 0 的结束块）
+        bool eos = false;
+        while (!msgMode && !udpMode && (streamed ? !eos : received < rSize)) {
+            if (buf.size() != static_cast<size_t>(sizer.current())) {
+                std::vector<char>(sizer.current()).swap(buf);
+            }
+            int to_read = 0;
+            if (streamed && chunkLeft == 0) {
+                uint32_t chunkLen = 0;
+                if (!Utils::recvAll(s, (char *) &chunkLen, sizeof(chunkLen))) {
+                    std::string error = UDT::getlasterror().getErrorMessage();
+                    throw std::runtime_error("Receive error: " + error);
+                }
+                chunkLen = ntohl(chunkLen);
+                if (chunkLen == 0) {
+                    eos = true;
+                    break;
+                }
+                if (chunkLen > static_cast<uint32_t>(MAX_BLOCK_SIZE)) {
+                    throw std::runtime_error("Invalid stream chunk length: " + std::to_string(chunkLen));
+                }
+                chunkLeft = chunkLen;
+            }
+            // 发送端的分块与本端写块大小无关：大块分几次读写
+            to_read = static_cast<int>(std::min<uint64_t>(buf.size(), streamed ? chunkLeft : rSize - received));
 
-        // 设置新超时
-        UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &timeout_ms, sizeof(int));
+            int block_offset = 0;
+            while (block_offset < to_read) {
+                int r = sizer.call([&] {
+                    return stages->recv.timed([&] { return UDT::recv(s, buf.data() + block_offset, to_read - block_offset, 0); });
+                });
+                if (r <= 0) {
+                    if (r == UDT::ERROR) {
+                        std::string error = UDT::getlasterror().getErrorMessage();
+                        throw std::runtime_error("Receive error: " + error);
+                    }
+                    break; // 连接关闭
+                }
+                block_offset += r;
+            }
 
-        int r = UDT::recv(sock, buf, sizeof(buf) - 1, 0);
+            if (block_offset == 0) break; // 连接关闭
+            if (streamed && block_offset < to_read) {
+                throw std::runtime_error("Stream chunk truncated");
+            }
+            if (streamed) {
+                chunkLeft -= block_offset;
+            }
 
-        // 恢复原始超时
-        UDT::setsockopt(sock, 0, UDT_RCVTIMEO, &original_timeout, sizeof(int));
+            disk.write(block_offset, [&] { stages->write.timed(block_offset, [&] { out.write(buf.data(), block_offset); }); });
+            if (!out) {
+                throw std::runtime_error("Failed to write to file");
+            }
+
+            double hint = 0;
+            if (diskHints && disk.poll(hint)) {
+                sendDiskHint(s, hint, false);
+            }
+
+            stages->hash.timed(block_offset, [&] { blake3_hasher_update(&hasher, buf.data(), block_offset); });
+            received += block_offset;
+            if (live) {
+                live->bytes.store(received, std::memory_order_relaxed);
+            }
 
-        if (r > 0) {
-            buf[r] = '\0';
-            return std::string(buf) == expected;
+            // UDT 接收缓冲积压说明本端（读 + 写盘）跟不上，基本为空说明在等网络
+            if (sizer.due()) {
+                UDT::TRACEINFO rp;
+                double occupancy = 0;
+                if (rcvBufBytes > 0 && UDT::perfmon(s, &rp, false) != UDT::ERROR) {
+                    occupancy = std::max(0.0, std::min(1.0, 1.0 - static_cast<double>(rp.byteAvailRcvBuf) / rcvBufBytes));
+                }
+                sizer.tick(occupancy, 1.0 - occupancy, maxBlock);
+            }
+
+            showProgress(received);
         }
-        return false;
-    }
 
-    static std::string hashToString(const uint8_t *hash, size_t len) {
-        std::stringstream ss;
-        for (size_t i = 0; i < len; ++i) {
-            ss << std::hex << std::setw(2) << std::setfill('0')
-                    << static_cast<int>(hash[i]);
+        stages->stop();
+        stopProgress();
+        if (sampler) {
+            sampler->stop();
         }
-        return ss.str();
+
+        // 数据已收齐：结束写盘提示，发送端随后只会在控制连接上等待确认与报告
+        if (diskHints) {
+            sendDiskHint(s, 0, true);
+        }
+
+        out.flush();
+        if (ofs.is_open()) {
+            ofs.close();
+        }
+
+        // 检查是否接收到完整文件
+        if (streamed ? !eos : received != rSize) {
+            // 删除不完整的文件
+            if (!toStdout) {
+                try { fs::remove(outPath); } catch (...) {
+                }
+            }
+            throw std::runtime_error("File transfer incomplete. Expected: " +
+                                     (streamed ? std::string("end of stream") : Utils::formatSize(rSize)) +
+                                     ", Received: " + Utils::formatSize(received));
+        }
+        if (streamed) {
+            rSize = received;
+        }
+
+        std::cout << "\n[INFO] File received, computing hash..." << std::endl;
+
+        // 接收远程哈希
+        uint8_t rHash[BLAKE3_OUT_LEN];
+        if (!Utils::recvAll(s, (char *) rHash, BLAKE3_OUT_LEN)) {
+            std::string error = UDT::getlasterror().getErrorMessage();
+            throw std::runtime_error("Failed to receive hash: " + error);
+        }
+
+        // 等待传输完成标记
+        std::vector<char> completeMsg(TRANSFER_COMPLETE.size());
+        bool transferComplete = Utils::recvAll(s, completeMsg.data(), static_cast<int>(completeMsg.size())) &&
+                                std::string(completeMsg.begin(), completeMsg.end()) == TRANSFER_COMPLETE;
+
+        if (!transferComplete) {
+            std::cout << "[WARNING] Transfer completion marker not received or incorrect" << std::endl;
+        }
+
+        // 发送确认
+        if (!Utils::sendAll(s, ACK_TRANSFER.c_str(), static_cast<int>(ACK_TRANSFER.size()))) {
+            std::cout << "[WARNING] Failed to send ACK" << std::endl;
+        }
+
+        auto t_end = std::chrono::high_resolution_clock::now();
+        double duration = std::chrono::duration<double>(t_end - t_start).count();
+
+        // 计算本地哈希
+        uint8_t lHash[BLAKE3_OUT_LEN];
+        blake3_hasher_finalize(&hasher, lHash, BLAKE3_OUT_LEN);
+
+        std::string localHash = Utils::hashToString(lHash, BLAKE3_OUT_LEN);
+        std::string remoteHash = Utils::hashToString(rHash, BLAKE3_OUT_LEN);
+
+        bool match = (localHash == remoteHash);
+
+        std::cout << "[INFO] Hash verification: " << (match ? "PASS" : "FAIL") << std::endl;
+
+        if (!match) {
+            std::cout << "[ERROR] Local hash:  " << localHash << std::endl;
+            std::cout << "[ERROR] Remote hash: " << remoteHash << std::endl;
+        }
+
+        // 生成JSON报告（消息模式统计来自数据连接）
+        UDT::TRACEINFO perf;
+        UDT::perfmon(dataSock, &perf);
+        unpublish();
+        // 轨迹的 cc 计数器取自数据连接上的控制器，须在关闭数据连接之前写出
+        finishTrace(udpMode ? UDT::INVALID_SOCK : dataSock);
+        if (msgMode) {
+            UDT::close(dataSock);
+        }
+
+        json jStats = NetworkStats::snapshot(perf, duration, rSize);
+        jStats["buffers"] = json::object({
+            {"receiver", localBuffers},
+            {"probe", probeInfo}
+        });
+        if (!udpMode) {
+            jStats["disk"] = disk.report();
+            jStats["disk"]["hints_enabled"] = diskHints;
+        }
+        if (!msgMode && !udpMode) {
+            jStats["block_size"] = json::object({{"receiver", sizer.report(memLimit)}});
+        }
+        if (sampler) {
+            jStats["timeseries"] = json::object({{"receiver", sampler->summary()}});
+        }
+        json stageReport = stages->report();
+        if (!stageReport.is_null()) {
+            jStats["stages"] = json::object({{"receiver", stageReport}});
+        }
+        jStats["resources"] = json::object({
+            {"receiver", usage.report(received, buf.capacity() + reorder.peakBytes, udtBufferBytes(dataSock))}
+        });
+        json jFinal = NetworkStats::analyze(jStats, rMSS, rWin);
+
+        jFinal["meta"] = json::object({
+            {
+                "filename",
+#ifdef _WIN32
+                Utf8Util::toUtf8(outPath.filename().wstring())
+#else
+                outPath.filename().string()
+#endif
+            },
+            {"filepath", outPath.string()},
+            {"filesize", rSize},
+            {"filesize_human", Utils::formatSize(rSize)},
+            {"status", match ? "success" : "integrity_failure"},
+            {"hash_match", match},
+            {"local_hash", localHash},
+            {"remote_hash", remoteHash},
+            {"duration_sec", duration},
+            {"avg_speed_mbps", duration > 0 ? (rSize * 8.0 / 1000000.0) / duration : 0.0},
+            {"avg_speed_mbs", duration > 0 ? (rSize / (1024.0 * 1024.0)) / duration : 0.0},
+            {"congestion_control_disabled", cfg.cc == "none"},  // 新增：显示拥塞控制状态
+            {"congestion_control", cfg.cc},
+            {"streamed", streamed},
+            {"transport", msgMode ? "msg" : (udpMode ? "udp" : "stream")}
+        });
+        if (msgMode || udpMode) {
+            jFinal["meta"]["reorder"] = json::object({
+                {"out_of_order_msgs", reorder.outOfOrder},
+                {"peak_pending_bytes", reorder.peakBytes},
+                {"limit_bytes", reorder.capacity()}
+            });
+        }
+        if (udpMode) {
+            jFinal["meta"]["udp"] = udpStats;
+        }
+        json history = recordHistory(jFinal, Utils::peerToString(s), cfg.mode == "fetch" ? "fetch" : "recv",
+                                     msgMode ? "msg" : (udpMode ? "udp" : "stream"), rSize, duration, match);
+        NetworkStats::mergeHistory(jFinal, "receiver", history);
+
+        std::string jsonStr = jFinal.dump();
+
+        // 发送报告给发送方
+        if (!Utils::sendAll(s, jsonStr.c_str(), static_cast<int>(jsonStr.size()))) {
+            std::cout << "[WARNING] Failed to send report to sender" << std::endl;
+        }
+
+        // 本地显示
+        std::cout << "\n=== Transfer Summary ===\n" << jFinal.dump(4) << std::endl;
+        return true;
     }
 
-    static std::string formatSize(uint64_t bytes) {
-        const char *units[] = {"B", "KB", "MB", "GB", "TB"};
-        int unit = 0;
-        double size = static_cast<double>(bytes);
+    // 解析 serve 根目录下的文件，并在注册表中取得共享文件对象
+    std::shared_ptr<ServedFile> resolveServedFile(const std::string &name) {
+#ifdef _WIN32
+        fs::path rel = fs::path(Utf8Util::toWide(name)).lexically_normal();
+        fs::path root = fs::path(Utf8Util::toWide(cfg.path));
+#else
+        fs::path rel = fs::path(name).lexically_normal();
+        fs::path root = fs::path(cfg.path);
+#endif
+        // 拒绝绝对路径和越出根目录的请求
+        if (rel.empty() || rel.is_absolute() || rel.has_root_name() || *rel.begin() == "..") {
+            throw std::runtime_error("Rejected path: " + name);
+        }
 
-        while (size >= 1024.0 && unit < 4) {
-            size /= 1024.0;
-            unit++;
+        fs::path full = root / rel;
+        if (!fs::is_regular_file(full)) {
+            throw std::runtime_error("File not found: " + name);
         }
 
-        std::stringstream ss;
-        ss << std::fixed << std::setprecision(2) << size << " " << units[unit];
-        return ss.str();
+        // 根目录内的符号链接可能指向根目录之外：解析后再比较一次
+        std::error_code ec;
+        fs::path realRoot = fs::canonical(root, ec);
+        fs::path realFull = ec ? fs::path() : fs::canonical(full, ec);
+        if (ec) {
+            throw std::runtime_error("File not found: " + name);
+        }
+        auto mismatch = std::mismatch(realRoot.begin(), realRoot.end(), realFull.begin(), realFull.end());
+        if (mismatch.first != realRoot.end()) {
+            throw std::runtime_error("Rejected path: " + name);
+        }
+        full = realFull;
+
+        uint64_t size = fs::file_size(full);
+        auto mtime = fs::last_write_time(full).time_since_epoch().count();
+
+        // 路径 + 大小 + 修改时间 标识一个文件版本，文件被改写后自动换新 id
+        std::string key = full.string() + "|" + std::to_string(size) + "|" + std::to_string(mtime);
+
+        std::lock_guard<std::mutex> lk(filesMutex);
+        auto it = servedFiles.find(key);
+        if (it != servedFiles.end()) {
+            return it->second;
+        }
+
+        auto f = std::make_shared<ServedFile>();
+        f->id = nextFileId++;
+        f->path = full;
+        f->size = size;
+        f->blockCount = (size + APP_BLOCK_SIZE - 1) / APP_BLOCK_SIZE;
+        blake3_hasher_init(&f->hasher);
+        if (f->blockCount == 0) {
+            blake3_hasher_finalize(&f->hasher, f->hash, BLAKE3_OUT_LEN);
+            f->hashDone = true;
+        }
+        servedFiles[key] = f;
+        return f;
     }
-};
 
-// --- 主程序类 ---
-class HruftPro {
-    UDTSOCKET sock;
-    Config cfg;
-    blake3_hasher hasher;
+    // serve 会话：读取拉取请求，从共享块缓存发送文件
+    void serveSession(UDTSOCKET s, uint64_t sessionId) {
+        std::string peer = Utils::peerToString(s);
+        auto log = [&](const std::string &msg) {
+            std::lock_guard<std::mutex> lk(logMutex);
+            std::cout << "[INFO] [session " << sessionId << "] " << msg << std::endl;
+        };
+
+        FetchRequest req;
+        if (!Utils::recvAll(s, (char *) &req, sizeof(req)) || ntohl(req.magic) != FETCH_MAGIC) {
+            throw std::runtime_error("Invalid fetch request from " + peer);
+        }
 
-    // 核心性能设置：配置 Socket 缓冲区
-    void tuneSocket(UDTSOCKET s, int mss, int winSize) {
-        // 1. 设置 MSS (必须在连接前)
-        UDT::setsockopt(s, 0, UDT_MSS, &mss, sizeof(int));
+        int mss = ntohl(req.mss);
+        int window = Config::clampWindow(ntohl(req.window_size));
+        uint16_t nameLen = ntohs(req.name_len);
+
+        std::string name(nameLen, '\0');
+        if (!Utils::recvAll(s, &name[0], nameLen)) {
+            throw std::runtime_error("Failed to receive fetch name");
+        }
+
+        tuneSocket(s, mss, window);
+
+        std::shared_ptr<ServedFile> file = resolveServedFile(name);
+
+#ifdef _WIN32
+        std::string fname = Utf8Util::toUtf8(file->path.filename().wstring());
+#else
+        std::string fname = file->path.filename().string();
+#endif
 
-        // 2. 如果启用no_cc，设置SimpleCC拥塞控制
-        if (cfg.no_cc) {
-            SimpleCCFactory factory;
-            UDT::setsockopt(s, 0, UDT_CC, &factory, sizeof(SimpleCCFactory));
+        log(peer + " fetching " + name + " (" + Utils::formatSize(file->size) + ")");
 
-            // 同时设置一个较大的带宽限制，避免被限制
-            int64_t max_bw = 1000000000; // 1 Gbps
-            UDT::setsockopt(s, 0, UDT_MAXBW, &max_bw, sizeof(int64_t));
+        sendHeader(s, mss, window, file->size, fname);
+
+        std::ifstream ifs(file->path, std::ios::binary);
+        if (!ifs) {
+            throw std::runtime_error("Cannot open file for reading: " + file->path.string());
         }
 
-        // 3. UDT 缓冲区 (应用层可见窗口)
-        // 限制最大值
-        int udtBuf = std::min(winSize, UDT_MAX_BUF);
-        UDT::setsockopt(s, 0, UDT_SNDBUF, &udtBuf, sizeof(int));
-        UDT::setsockopt(s, 0, UDT_RCVBUF, &udtBuf, sizeof(int));
+        auto t_start = std::chrono::high_resolution_clock::now();
 
-        // 4. UDP 缓冲区 (操作系统内核级)
-        int udpBuf = udtBuf;
-        if (udpBuf < 1 * 1024 * 1024) {
-            udpBuf = 1 * 1024 * 1024; // 最小给 1MB
+        // serve 会话共用一个 HruftPro，计数登记在局部对象上
+        std::shared_ptr<SessionMetrics> m = metrics ? metrics->add(name, "serve", peer, s, file->size, nullptr) : nullptr;
+        // 无论正常结束还是抛出异常，离开本函数时都注销计数
+        struct Unpublish {
+            MetricsServer *server;
+            std::shared_ptr<SessionMetrics> m;
+
+            ~Unpublish() {
+                if (server && m) server->remove(m);
+            }
+        } unpublishGuard{metrics, m};
+        double duration = 0;
+        bool acked = false;
+        json report;
+        for (uint64_t idx = 0; idx < file->blockCount; ++idx) {
+            uint64_t off = idx * APP_BLOCK_SIZE;
+            int len = static_cast<int>(std::min<uint64_t>(APP_BLOCK_SIZE, file->size - off));
+
+            BlockCache::BlockRef blk = cache->acquire(file->id, idx, len, [&](char *dst, int n) {
+                ifs.clear();
+                ifs.seekg(static_cast<std::streamoff>(off));
+                ifs.read(dst, n);
+                return static_cast<int>(ifs.gcount());
+            });
+
+            file->feedHash(idx, blk->data.data(), len);
+
+            if (!Utils::sendAll(s, blk->data.data(), len)) {
+                throw std::runtime_error("Send failed: " + std::string(UDT::getlasterror().getErrorMessage()));
+            }
+            if (m) {
+                m->bytes.store(off + len, std::memory_order_relaxed);
+            }
         }
 
-        UDT::setsockopt(s, 0, UDP_SNDBUF, &udpBuf, sizeof(int));
-        UDT::setsockopt(s, 0, UDP_RCVBUF, &udpBuf, sizeof(int));
+        uint8_t hash[BLAKE3_OUT_LEN];
+        {
+            std::lock_guard<std::mutex> lk(file->mtx);
+            if (!file->hashDone) {
+                throw std::runtime_error("Shared hash not finalized for " + name);
+            }
+            memcpy(hash, file->hash, BLAKE3_OUT_LEN);
+        }
 
-        // 5. 阻塞模式
-        bool block = true;
-        UDT::setsockopt(s, 0, UDT_SNDSYN, &block, sizeof(bool));
-        UDT::setsockopt(s, 0, UDT_RCVSYN, &block, sizeof(bool));
+        sendTrailer(s, hash);
+        duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+        report = collectReport(s, acked);
+        UDT::TRACEINFO sperf;
+        UDT::perfmon(s, &sperf, false);
+        NetworkStats::mergeSender(report, NetworkStats::senderView(sperf, duration, file->size, json()), mss, window);
+        NetworkStats::mergeController(report, controllerState(s));
+        if (const CcRecorder *rec = ccRecorder(s)) {
+            NetworkStats::mergeCcEvents(report, rec->summary());
+        }
+        bool delivered = acked && report.is_object() && report.contains("meta") &&
+                         report["meta"].value("status", "") == "success";
+        NetworkStats::mergeHistory(report, "sender",
+                                   recordHistory(report, peer, "serve", "stream", file->size, duration, delivered));
+
+        json jSession = json::object({
+            {"session", sessionId},
+            {"peer", peer},
+            {"file", name},
+            {"filesize", file->size},
+            {"duration_sec", duration},
+            {"acked", acked},
+            {"receiver_report", report},
+            {"cache", cache->stats()}
+        });
 
-        // 6. 启用地址重用
-        bool reuse = true;
-        UDT::setsockopt(s, 0, UDT_REUSEADDR, &reuse, sizeof(bool));
+        std::lock_guard<std::mutex> lk(logMutex);
+        std::cout << "\n=== Session Report ===\n" << jSession.dump(4) << std::endl;
     }
 
 public:
-    HruftPro(Config c) : cfg(c) {
+    HruftPro(Config c)
+        : cfg(c), stdoutGuard((c.mode == "recv" || c.mode == "fetch") && c.path == STDIO_PATH) {
         UDT::startup();
         blake3_hasher_init(&hasher);
         sock = UDT::INVALID_SOCK;
+        if (cfg.metrics_port > 0) {
+            metricsOwner.reset(new MetricsServer(cfg.metrics_port));
+            metricsOwner->begin();
+            metrics = metricsOwner.get();
+        }
     }
 
     ~HruftPro() {
+        unpublish();
+        metricsOwner.reset();
         if (sock != UDT::INVALID_SOCK) {
             UDT::close(sock);
             sock = UDT::INVALID_SOCK;
@@ -470,139 +8048,291 @@ public:
         fs::path filePath = fs::path(cfg.path);
 #endif
 
-        if (!fs::exists(filePath)) {
+        // "-" 表示从 stdin 读取：长度未知，使用分块流模式
+        bool fromStdin = (cfg.path == STDIO_PATH);
+
+        if (!fromStdin && !fs::exists(filePath)) {
             throw std::runtime_error("File not found: " + cfg.path);
         }
 
-        uint64_t fsize = fs::file_size(filePath);
+        uint64_t fsize = fromStdin ? 0 : fs::file_size(filePath);
 
 #ifdef _WIN32
-        std::string fname = Utf8Util::toUtf8(filePath.filename().wstring()); // UTF-8 文件名跨平台
+        std::string fname = fromStdin ? std::string("stdin")
+                                      : Utf8Util::toUtf8(filePath.filename().wstring()); // UTF-8 文件名跨平台
 #else
-        std::string fname = filePath.filename().string();
+        std::string fname = fromStdin ? std::string("stdin") : filePath.filename().string();
 #endif
 
         if (fname.size() > 65535) {
             throw std::runtime_error("Filename too long");
         }
 
-        sock = UDT::socket(AF_INET, SOCK_STREAM, 0);
-        if (sock == UDT::INVALID_SOCK) {
-            throw std::runtime_error("Failed to create socket");
+        // 消息 / UDP 数据面需要预先知道文件长度（UDP 重传还需随机读取）
+        bool msgMode = (cfg.transport == "msg");
+        bool udpMode = (cfg.transport == "udp");
+        if ((msgMode || udpMode) && fromStdin) {
+            std::cout << "[WARNING] " << cfg.transport
+                    << " transport needs a known length; using stream transport for stdin" << std::endl;
+            msgMode = udpMode = false;
         }
 
-        tuneSocket(sock, cfg.mss, cfg.window);
-
-        sockaddr_in serv_addr;
-        memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(cfg.port);
+        // 未显式指定 --mss / --window 时先探测路径 MTU 与带宽时延积
+        choosePathMss();
+        if (cfg.probe && !cfg.window_set) {
+            probePath();
+        }
+        sock = connectPeer(SOCK_STREAM, 0, probeInfo.is_null() ? 1 : PROBE_CONNECT_TRIES);
+        if (localBuffers.value("clamped", false)) {
+            std::cout << "[WARNING] Kernel clamped UDP buffers: " << localBuffers.dump() << std::endl;
+        }
 
-        if (inet_pton(AF_INET, cfg.ip.c_str(), &serv_addr.sin_addr) <= 0) {
-            throw std::runtime_error("Invalid IP address: " + cfg.ip);
+        // Protocol Header
+        uint32_t flags = (fromStdin ? FLAG_STREAM : 0) | (msgMode ? FLAG_MSG : 0) | (udpMode ? FLAG_UDP : 0) |
+                         (cfg.disk_hint && !udpMode ? FLAG_DISK_HINT : 0);
+        sendHeader(sock, cfg.mss, cfg.window, fsize, fname, flags);
+
+        // 写盘速率提示需接收端确认；被拒绝时清除标志，不启动提示读线程
+        if (flags & FLAG_DISK_HINT) {
+            std::string echo(DISK_HINT_ACCEPT.size(), '\0');
+            if (!Utils::recvAll(sock, &echo[0], static_cast<int>(echo.size()))) {
+                throw std::runtime_error("Receiver did not answer the disk hint request");
+            }
+            if (echo == DISK_HINT_DECLINE) {
+                flags &= ~FLAG_DISK_HINT;
+                std::cout << "[INFO] Receiver declined disk rate hints" << std::endl;
+            } else if (echo != DISK_HINT_ACCEPT) {
+                throw std::runtime_error("Unexpected disk hint answer from receiver");
+            }
         }
 
-        std::cout << "[INFO] Connecting to " << cfg.ip << ":" << cfg.port << "..." << std::endl;
+        // 消息 / UDP 模式：接收端在控制端口 + 1 就绪后再开始发送数据
+        UDTSOCKET dataSock = sock;
+        if (msgMode || udpMode) {
+            if (!Utils::waitForAck(sock, DATA_READY, 30000)) {
+                throw std::runtime_error("Receiver did not open the " + cfg.transport + " data plane");
+            }
+        }
+        if (msgMode) {
+            dataSock = connectPeer(SOCK_DGRAM, 1);
+        }
 
-        if (UDT::ERROR == UDT::connect(sock, (sockaddr *) &serv_addr, sizeof(serv_addr))) {
-            std::string error = UDT::getlasterror().getErrorMessage();
-            throw std::runtime_error("Connect failed: " + error);
+        // 传输文件数据
+        std::ifstream ifs;
+        if (fromStdin) {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        } else {
+            ifs.open(filePath, std::ios::binary);
+            if (!ifs) {
+                throw std::runtime_error("Cannot open file for reading: " + cfg.path);
+            }
         }
+        std::istream in(fromStdin ? std::cin.rdbuf() : ifs.rdbuf());
 
-        std::cout << "[INFO] Connected successfully" << std::endl;
+        std::vector<char> msgBuf(msgMode ? sizeof(MsgHeader) + MSG_CHUNK_SIZE : 0);
+        uint64_t sent = 0;
 
-        // Protocol Header
-        ProtocolHeader hdr;
-        hdr.magic = htonl(MAGIC_ID);
-        hdr.mss = htonl(cfg.mss);
-        hdr.window_size = htonl(cfg.window);
-        hdr.file_size = htonll(fsize);
-        hdr.filename_len = htons(static_cast<uint16_t>(fname.size()));
+        auto t_start = std::chrono::high_resolution_clock::now();
 
-        // 发送协议头
-        if (UDT::send(sock, (char *) &hdr, sizeof(hdr), 0) <= 0) {
-            throw std::runtime_error("Failed to send protocol header");
+        std::cout << "[INFO] Sending " << fname << " ("
+                << (fromStdin ? std::string("stream") : Utils::formatSize(fsize)) << ")..." << std::endl;
+
+        json udpStats;
+        json tuning;
+        json schedule;
+        int64_t memLimit = static_cast<int64_t>(cfg.mem_limit_mb) * 1024 * 1024;
+        BlockSizer sizer(cfg.block_size, cfg.block_auto);
+        uint64_t lastConsumerWait = 0, lastProducerWait = 0;
+        std::atomic<uint64_t> progressBytes{0};
+        int64_t appBufferPeak = 0;
+        ResourceUsage usage;
+        if (cfg.deadline > 0 && (udpMode || fromStdin)) {
+            std::cout << "[WARNING] --deadline needs a known length on a UDT data plane; sending at full speed"
+                    << std::endl;
         }
+        // 速率上限来源：在线调优、截止时间调度与接收端写盘提示，生效值取最小
+        std::unique_ptr<RateCaps> caps;
+        std::unique_ptr<DiskHintListener> diskHints;
+        std::unique_ptr<DeadlinePlanner> planner;
+        std::unique_ptr<StatsSampler> sampler;
+        stages = std::make_shared<StageStats>();
+        countHardware();
+        usage.begin();
+        startTrace("sender", udpMode ? UDT::INVALID_SOCK : dataSock);
+        startProgress("sender", fsize);
+        if (udpMode) {
+            if (cfg.tune) {
+                std::cout << "[WARNING] --tune applies to UDT data planes; udp transport keeps its fixed rate"
+                        << std::endl;
+            }
+            if (!cfg.stats_out.empty()) {
+                std::cout << "[WARNING] --stats-out samples UDT data planes; ignored for udp transport" << std::endl;
+            }
+            udpStats = sendUdpBlast(sock, filePath, fsize);
+            sent = fsize;
+        } else {
+            // 读线程按块读取并计算哈希，本线程发送；块大小可在传输中调整（--tune / --block-size auto），
+            // 深度 × 块大小受 --mem-limit 约束
+            int maxBlock = cfg.block_auto ? MAX_BLOCK_SIZE : cfg.block_size;
+            int firstBlock = cfg.block_auto ? BlockSizer::fromProbe(probedBandwidth(), cfg.block_size, maxBlock)
+                                            : (cfg.tune ? std::min(TUNE_INITIAL_BLOCK, cfg.block_size) : cfg.block_size);
+            BlockPipeline pipe(PIPELINE_DEFAULT_DEPTH, firstBlock, maxBlock, memLimit);
+            sizer.begin(pipe.getBlockSize());
+            if (pipe.getBlockSize() < firstBlock) {
+                std::cout << "[WARNING] --mem-limit " << cfg.mem_limit_mb << " MB caps blocks at "
+                        << Utils::formatSize(pipe.getBlockSize()) << std::endl;
+            }
+            stages->begin();
+            std::thread reader([&] {
+                ThreadRoles::Scope role("reader");
+                try {
+                    while (true) {
+                        std::unique_ptr<BlockPipeline::Block> b = pipe.acquire();
+                        if (!b) return;
+                        b->len = stages->read.timed([&] {
+                            in.read(b->data.data(), static_cast<std::streamsize>(b->data.size()));
+                            return static_cast<int>(in.gcount());
+                        });
+                        if (b->len == 0) {
+                            pipe.release(std::move(b));
+                            break;
+                        }
+                        stages->hash.timed(b->len, [&] { blake3_hasher_update(&hasher, b->data.data(), b->len); });
+                        pipe.push(std::move(b));
+                    }
+                    if (in.bad()) {
+                        throw std::runtime_error("Read error on " + cfg.path);
+                    }
+                    pipe.finish();
+                } catch (...) {
+                    pipe.finish(std::current_exception());
+                }
+            });
 
-        // 发送文件名
-        if (UDT::send(sock, fname.c_str(), fname.size(), 0) <= 0) {
-            throw std::runtime_error("Failed to send filename");
-        }
+            caps.reset(new RateCaps(dataSock, reportingController(dataSock)));
+            if (flags & FLAG_DISK_HINT) {
+                diskHints.reset(new DiskHintListener(sock, *caps));
+                diskHints->begin();
+            }
 
-        // 传输文件数据
-        std::ifstream ifs(filePath, std::ios::binary);
-        if (!ifs) {
-            throw std::runtime_error("Cannot open file for reading: " + cfg.path);
-        }
+            std::unique_ptr<LiveTuner> tuner;
+            if (cfg.tune) {
+                tuner.reset(new LiveTuner(dataSock, caps.get(), &pipe, cfg.tune_interval_ms, !cfg.block_auto));
+                tuner->begin();
+            }
+            sampler = startSampler(dataSock, "sender");
+
+            if (cfg.deadline > 0 && !fromStdin) {
+                planner.reset(new DeadlinePlanner(dataSock, caps.get(), progressBytes, fsize, cfg.deadline));
+                double need = planner->begin();
+                std::cout << "[INFO] Deadline " << Utils::formatLocalTime(cfg.deadline) << ": need "
+                        << std::fixed << std::setprecision(1) << need / 1e6 << " Mbps (+"
+                        << DEADLINE_HEADROOM * 100 << "% headroom)" << std::endl;
+                double probed = probedBandwidth();
+                if (need <= 0) {
+                    std::cout << "[WARNING] Deadline already passed; sending at full speed" << std::endl;
+                } else if (probed > 0 && need > probed) {
+                    std::cout << "[WARNING] Required rate exceeds probed bandwidth ("
+                            << probed / 1e6 << " Mbps); deadline is likely to be missed" << std::endl;
+                }
+            }
+
+            if (scheduler) {
+                scheduler->attach(share, caps.get(), dataSock);
+            }
+            publish(share ? share->name : fname, "sender", cfg.ip + ":" + std::to_string(cfg.port), dataSock, fsize);
 
-        std::vector<char> buf(APP_BLOCK_SIZE);
-        uint64_t sent = 0;
+            try {
+                while (std::unique_ptr<BlockPipeline::Block> b = pipe.pop()) {
+                    int len = b->len;
+                    if (share) {
+                        share->take(len);
+                    }
 
-        auto t_start = std::chrono::high_resolution_clock::now();
-        auto last_progress_time = t_start;
+                    // 流模式：每块前加 4 字节长度前缀
+                    uint32_t chunkLen = htonl(static_cast<uint32_t>(len));
+                    if (fromStdin && !Utils::sendAll(sock, (char *) &chunkLen, sizeof(chunkLen))) {
+                        throw std::runtime_error("Send failed: " + std::string(UDT::getlasterror().getErrorMessage()));
+                    }
 
-        std::cout << "[INFO] Sending " << fname << " (" << Utils::formatSize(fsize) << ")..." << std::endl;
+                    if (msgMode) {
+                        sendBlockMessages(dataSock, sent, b->data.data(), len, msgBuf, sizer);
+                    } else {
+                        for (int off = 0; off < len;) {
+                            int n = sizer.call([&] {
+                                return stages->send.timed([&] { return UDT::send(sock, b->data.data() + off, len - off, 0); });
+                            });
+                            if (n == UDT::ERROR) {
+                                throw std::runtime_error("Send failed: " +
+                                                         std::string(UDT::getlasterror().getErrorMessage()));
+                            }
+                            off += n;
+                        }
+                    }
+                    pipe.release(std::move(b));
+                    sent += len;
+                    progressBytes.store(sent, std::memory_order_relaxed);
+                    if (live) {
+                        live->bytes.store(sent, std::memory_order_relaxed);
+                        live->pipelineBlocks.store(pipe.queued(), std::memory_order_relaxed);
+                    }
 
-        while (ifs.read(buf.data(), buf.size()) || ifs.gcount() > 0) {
-            int len = static_cast<int>(ifs.gcount());
-            blake3_hasher_update(&hasher, buf.data(), len);
+                    // 等读盘多说明本端（读盘）是瓶颈，读线程等空闲缓冲多说明块在排队等网络
+                    if (sizer.due()) {
+                        double window = sizer.windowSec();
+                        uint64_t cw = pipe.consumerWait(), pw = pipe.producerWait();
+                        int want = sizer.tick((cw - lastConsumerWait) / 1e6 / window,
+                                              (pw - lastProducerWait) / 1e6 / window, pipe.maxBlockSize());
+                        sizer.settle(pipe.setBlockSize(want));
+                        lastConsumerWait = cw;
+                        lastProducerWait = pw;
+                    }
 
-            int offset = 0;
-            while (offset < len) {
-                int s = UDT::send(sock, buf.data() + offset, len - offset, 0);
-                if (s == UDT::ERROR) {
-                    throw std::runtime_error("Send failed: " + std::string(UDT::getlasterror().getErrorMessage()));
+                    showProgress(sent);
                 }
-                offset += s;
+            } catch (...) {
+                if (scheduler) scheduler->detach(share);
+                unpublish();
+                pipe.abort();
+                reader.join();
+                throw;
+            }
+            reader.join();
+            stages->stop();
+            appBufferPeak = pipe.peakBytes();
+            if (scheduler) {
+                scheduler->detach(share);
             }
-            sent += len;
-
-            // 显示进度（每秒最多更新一次）
-            auto now = std::chrono::high_resolution_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_progress_time).count();
 
-            if (cfg.detailed || elapsed >= 1000) {
-                double progress = (fsize > 0) ? (static_cast<double>(sent) / fsize * 100.0) : 0.0;
-                std::cout << "\r[Progress] " << std::fixed << std::setprecision(1) << progress
-                        << "% | " << Utils::formatSize(sent) << " / " << Utils::formatSize(fsize);
+            if (tuner) {
+                tuner->stop();
+                tuning = tuner->report();
+            }
+        }
 
-                if (cfg.detailed) {
-                    UDT::TRACEINFO tmp;
-                    UDT::perfmon(sock, &tmp);
-                    std::cout << " | Rate: " << std::fixed << std::setprecision(1)
-                            << tmp.mbpsSendRate << " Mbps";
-                }
-                std::cout << std::flush;
-                last_progress_time = now;
+        // 流结束标记：长度为 0 的块
+        if (fromStdin) {
+            uint32_t eos = 0;
+            if (!Utils::sendAll(sock, (char *) &eos, sizeof(eos))) {
+                throw std::runtime_error("Failed to send end-of-stream marker");
             }
         }
 
-        ifs.close();
+        if (ifs.is_open()) {
+            ifs.close();
+        }
+        stopProgress();
 
         std::cout << "\n[INFO] File data sent, computing hash..." << std::endl;
 
-        // 发送哈希
+        // 发送哈希与完成标记
         uint8_t hash[BLAKE3_OUT_LEN];
         blake3_hasher_finalize(&hasher, hash, BLAKE3_OUT_LEN);
-
-        int hash_sent = 0;
-        while (hash_sent < BLAKE3_OUT_LEN) {
-            int s = UDT::send(sock, (char *) hash + hash_sent, BLAKE3_OUT_LEN - hash_sent, 0);
-            if (s == UDT::ERROR) {
-                throw std::runtime_error("Failed to send hash");
-            }
-            hash_sent += s;
-        }
-
-        // 发送完成标记
-        int msg_sent = 0;
-        while (msg_sent < TRANSFER_COMPLETE.size()) {
-            int s = UDT::send(sock, TRANSFER_COMPLETE.c_str() + msg_sent,
-                              TRANSFER_COMPLETE.size() - msg_sent, 0);
-            if (s == UDT::ERROR) {
-                throw std::runtime_error("Failed to send completion marker");
-            }
-            msg_sent += s;
+        sendTrailer(sock, hash);
+        if (diskHints) {
+            diskHints->finish();
         }
 
         auto t_end = std::chrono::high_resolution_clock::now();
@@ -610,326 +8340,381 @@ public:
 
         std::cout << "[INFO] Transfer completed in " << std::fixed << std::setprecision(2)
                 << dur.count() << " seconds" << std::endl;
+        if (udpMode) {
+            std::cout << "[INFO] UDP data plane: " << udpStats.dump() << std::endl;
+        }
         std::cout << "[INFO] Waiting for receiver confirmation..." << std::endl;
 
-        // 等待接收端确认
-        if (Utils::waitForAck(sock, ACK_TRANSFER)) {
+        // 等待接收端确认并接收报告
+        bool acked = false;
+        json report = collectReport(sock, acked);
+        unpublish();
+
+        // 发送端视角：本端 perfmon 快照与分析，并入接收端报告（udp 数据面没有 UDT 计数）
+        json senderStages = stages->report();
+        json senderResources = usage.report(sent, static_cast<uint64_t>(appBufferPeak), udtBufferBytes(dataSock));
+        json sender;
+        if (!udpMode) {
+            UDT::TRACEINFO sperf;
+            UDT::perfmon(dataSock, &sperf, false);
+            sender = NetworkStats::senderView(sperf, dur.count(), sent, senderStages);
+            if (!NetworkStats::mergeSender(report, sender, cfg.mss, cfg.window)) {
+                sender = NetworkStats::analyze(sender, cfg.mss, cfg.window);
+            }
+        }
+        // 截止时间以接收端确认收齐为准，此前发送缓冲中的数据仍按计划速率发出
+        if (planner) {
+            planner->stop();
+            schedule = planner->report();
+        }
+        if (sampler) {
+            sampler->stop();
+        }
+        if (report.is_object() && report.contains("buffers")) {
+            report["buffers"]["sender"] = localBuffers;
+        }
+        if (report.is_object() && report.contains("meta") && !pmtuInfo.is_null()) {
+            report["meta"]["path_mtu"] = pmtuInfo;
+        }
+
+        // 拥塞控制器运行在发送端，其状态并入接收端报告的 congestion 段
+        json ccState = controllerState(dataSock);
+        if (!ccState.is_null() && !NetworkStats::mergeController(report, ccState)) {
+            std::cout << "[INFO] Congestion controller: " << ccState.dump() << std::endl;
+        }
+        // 控制器回调事件：RTT / 抖动分布并入 latency 段；没有接收端报告时并入发送端报告
+        json ccSummary = udpMode ? json() : ccEvents(dataSock);
+        if (!ccSummary.is_null() && !NetworkStats::mergeCcEvents(report, ccSummary) &&
+            !NetworkStats::mergeCcEvents(sender, ccSummary)) {
+            std::cout << "[INFO] Congestion-control events: " << ccSummary.dump() << std::endl;
+        }
+        if (!tuning.is_null() && !NetworkStats::mergeTuning(report, tuning)) {
+            std::cout << "[INFO] Live tuning: " << tuning.dump() << std::endl;
+        }
+        if (!schedule.is_null() && !NetworkStats::mergeDeadline(report, schedule)) {
+            std::cout << "[INFO] Deadline schedule: " << schedule.dump() << std::endl;
+        }
+        if (!senderStages.is_null() && !NetworkStats::mergeStages(report, senderStages)) {
+            std::cout << "[INFO] Stage latencies: " << senderStages.dump() << std::endl;
+        }
+        if (!NetworkStats::mergeResources(report, senderResources)) {
+            std::cout << "[INFO] Resource usage: " << senderResources.dump() << std::endl;
+        }
+        if (sampler) {
+            if (report.is_object() && report.contains("meta")) {
+                report["timeseries"]["sender"] = sampler->summary();
+            } else {
+                std::cout << "[INFO] Stats time series: " << sampler->summary().dump() << std::endl;
+            }
+        }
+        if (!udpMode) {
+            if (report.is_object() && report.contains("meta")) {
+                report["block_size"]["sender"] = sizer.report(memLimit);
+            } else {
+                std::cout << "[INFO] Block size: " << sizer.report(memLimit).dump() << std::endl;
+            }
+        }
+        if (diskHints) {
+            if (report.is_object() && report.contains("disk")) {
+                report["disk"]["sender"] = diskHints->report();
+            } else {
+                std::cout << "[INFO] Disk rate hints: " << diskHints->report().dump() << std::endl;
+            }
+        }
+        bool hasReport = report.is_object() && report.contains("meta");
+        bool delivered = acked && hasReport && report["meta"].value("status", "") == "success";
+        // 与接收端一致，以连接上的对端地址（inet_ntop 规范形式）作为历史键
+        json history = recordHistory(hasReport ? report : sender, Utils::peerToString(sock), "send", cfg.transport,
+                                     sent, dur.count(), delivered);
+        if (!history.is_null() && !NetworkStats::mergeHistory(report, "sender", history) &&
+            !NetworkStats::mergeHistory(sender, "sender", history)) {
+            std::cout << "[INFO] History baseline: " << history.dump() << std::endl;
+        }
+        if (acked) {
             std::cout << "[INFO] Receiver acknowledged transfer" << std::endl;
         } else {
             std::cout << "[WARNING] No ACK received from receiver" << std::endl;
         }
 
-        // 接收报告
-        char respBuf[16384];
-        int r = UDT::recv(sock, respBuf, sizeof(respBuf) - 1, 0);
-        if (r > 0) {
-            respBuf[r] = 0;
-            try {
-                json j = json::parse(respBuf);
-                std::cout << "\n=== Receiver Report ===\n" << j.dump(4) << std::endl;
-            } catch (const json::exception &e) {
-                std::cout << "[INFO] Raw report: " << respBuf << std::endl;
-            }
+        if (report.is_object()) {
+            std::cout << "\n=== Transfer Report ===\n" << report.dump(4) << std::endl;
         } else {
-            std::cout << "[INFO] No report received from receiver" << std::endl;
+            if (report.is_string()) {
+                std::cout << "[INFO] Raw report: " << report.get<std::string>() << std::endl;
+            } else {
+                std::cout << "[INFO] No report received from receiver" << std::endl;
+            }
+            if (!sender.is_null()) {
+                std::cout << "\n=== Sender Report ===\n" << sender.dump(4) << std::endl;
+            }
+        }
+
+        finishTrace(udpMode ? UDT::INVALID_SOCK : dataSock);
+        if (msgMode) {
+            UDT::close(dataSock);
         }
 
         UDT::close(sock);
         sock = UDT::INVALID_SOCK;
+        lastReport = report;
     }
 
-    void runReceiver() {
-        UDTSOCKET serv = UDT::socket(AF_INET, SOCK_STREAM, 0);
-        if (serv == UDT::INVALID_SOCK) {
-            throw std::runtime_error("Failed to create server socket");
-        }
-
-        // Bind socket with conservative settings
-        tuneSocket(serv, cfg.mss, cfg.window);
-
-        sockaddr_in my_addr;
-        memset(&my_addr, 0, sizeof(my_addr));
-        my_addr.sin_family = AF_INET;
-        my_addr.sin_port = htons(cfg.port);
-        my_addr.sin_addr.s_addr = INADDR_ANY;
-
-        if (UDT::ERROR == UDT::bind(serv, (sockaddr *) &my_addr, sizeof(my_addr))) {
-            std::string error = UDT::getlasterror().getErrorMessage();
-            throw std::runtime_error("Bind failed: " + error);
+    // send --jobs：每个作业一个会话线程（各自的 HruftPro 实例与连接），共享中央带宽分配器；
+    // 清单为 JSON，可以是作业数组，或 {"total_rate", "dest_caps", "jobs"} 对象
+    void runJobs() {
+        std::ifstream jf(cfg.jobs_file);
+        if (!jf) {
+            throw std::runtime_error("Cannot open job list: " + cfg.jobs_file);
         }
-
-        UDT::listen(serv, 10);
-        std::cout << "[INFO] Listening on port " << cfg.port << "..." << std::endl;
-
-        sockaddr_in client_addr;
-        int addrlen = sizeof(client_addr);
-        sock = UDT::accept(serv, (sockaddr *) &client_addr, &addrlen);
-        if (sock == UDT::ERROR || sock == UDT::INVALID_SOCK) {
-            std::string error = UDT::getlasterror().getErrorMessage();
-            throw std::runtime_error("Accept failed: " + error);
+        json spec;
+        try {
+            jf >> spec;
+        } catch (const std::exception &e) {
+            throw std::runtime_error("Invalid job list " + cfg.jobs_file + ": " + e.what());
         }
 
-        std::cout << "[INFO] Connection accepted from client" << std::endl;
-
-        // 读取协议头
-        ProtocolHeader hdr;
-        int bytes_received = UDT::recv(sock, (char *) &hdr, sizeof(hdr), 0);
-        if (bytes_received != sizeof(hdr)) {
-            throw std::runtime_error("Invalid protocol header received");
+        auto rateOf = [](const json &v) {
+            return v.is_number() ? v.get<double>() : Config::parseRate(v.get<std::string>());
+        };
+        json jobs = spec.is_array() ? spec : spec.value("jobs", json::array());
+        if (!jobs.is_array() || jobs.empty()) {
+            throw std::runtime_error("Job list has no jobs: " + cfg.jobs_file);
         }
-
-        // 验证魔数
-        if (ntohl(hdr.magic) != MAGIC_ID) {
-            throw std::runtime_error("Invalid protocol magic number");
+        double total = cfg.rate_bps;
+        std::map<std::string, double> destCaps;
+        if (spec.is_object()) {
+            if (spec.contains("total_rate")) total = rateOf(spec["total_rate"]);
+            json caps = spec.value("dest_caps", json::object());
+            for (auto &c : caps.items()) {
+                destCaps[c.key()] = rateOf(c.value());
+            }
         }
-
-        int rMSS = ntohl(hdr.mss);
-        int rWin = ntohl(hdr.window_size);
-        uint64_t rSize = ntohll(hdr.file_size);
-        uint16_t nameLen = ntohs(hdr.filename_len);
-
-        // 应用发送方的窗口设置
-        tuneSocket(sock, rMSS, rWin);
-
-        std::cout << "[INFO] Remote config - MSS: " << rMSS << ", Window: "
-                << Utils::formatSize(rWin) << std::endl;
-
-        // 读取文件名
-        if (nameLen > 65535) {
-            throw std::runtime_error("Invalid filename length");
+        if (total <= 0) {
+            throw std::runtime_error("--jobs needs a shared total rate: --rate or \"total_rate\" in the job list");
         }
 
-        std::vector<char> nameBuf(nameLen + 1);
-        bytes_received = UDT::recv(sock, nameBuf.data(), nameLen, 0);
-        if (bytes_received != nameLen) {
-            throw std::runtime_error("Failed to receive filename");
+        BandwidthScheduler sched(total, destCaps);
+        std::vector<Config> configs;
+        std::vector<std::shared_ptr<SessionShare> > shares;
+        for (const json &j : jobs) {
+            Config jc = cfg;
+            jc.jobs_file.clear();
+            jc.progress = "none";
+            jc.metrics_port = 0;
+            jc.ip = j.at("ip").get<std::string>();
+            jc.port = j.at("port").get<int>();
+            jc.path = j.at("path").get<std::string>();
+            if (jc.path == STDIO_PATH) {
+                throw std::runtime_error("Jobs cannot read stdin");
+            }
+            double weight = j.value("weight", 1.0);
+            if (weight <= 0) {
+                throw std::runtime_error("Job weight must be positive: " + j.dump());
+            }
+            double maxBps = j.contains("max_rate") ? rateOf(j["max_rate"]) : 0.0;
+            std::string name = j.value("name", jc.ip + ":" + std::to_string(jc.port) + "/" +
+                                               fs::path(jc.path).filename().string());
+            // 每个作业一个时间序列 / 事件轨迹文件：stats.jsonl -> stats-<序号>.jsonl
+            auto perJob = [&](const std::string &path) {
+                fs::path sp(path);
+                fs::path stem = sp.parent_path() / sp.stem();
+                return stem.string() + "-" + std::to_string(configs.size()) + sp.extension().string();
+            };
+            if (!cfg.stats_out.empty()) {
+                jc.stats_out = perJob(cfg.stats_out);
+            }
+            if (!cfg.trace.empty()) {
+                jc.trace = perJob(cfg.trace);
+            }
+            if (!cfg.cc_trace.empty()) {
+                jc.cc_trace = perJob(cfg.cc_trace);
+            }
+            configs.push_back(jc);
+            shares.push_back(sched.add(name, jc.ip, weight, j.value("priority", 0), maxBps));
         }
-        nameBuf[nameLen] = 0;
-        std::string filename = nameBuf.data();
-
-        std::cout << "[INFO] Receiving file: " << filename << " ("
-                << Utils::formatSize(rSize) << ")" << std::endl;
 
-#ifdef _WIN32
-        fs::path baseDir = fs::path(Utf8Util::toWide(cfg.path));
-        fs::path outPath = baseDir;
-        if (fs::is_directory(baseDir)) {
-            outPath /= fs::path(Utf8Util::toWide(filename));
+        std::cout << "[INFO] Running " << configs.size() << " jobs sharing " << std::fixed
+                << std::setprecision(1) << total / 1e6 << " Mbps" << std::endl;
+
+        std::vector<json> results(configs.size());
+        std::vector<std::thread> threads;
+        sched.begin();
+        for (size_t i = 0; i < configs.size(); ++i) {
+            threads.emplace_back([&, i] {
+                ThreadRoles::Scope role("job");
+                try {
+                    HruftPro session(configs[i]);
+                    session.scheduler = &sched;
+                    session.share = shares[i];
+                    session.metrics = metrics;
+                    session.runSender();
+                    const json &r = session.lastReport;
+                    bool confirmed = r.is_object() && r.contains("meta");
+                    results[i] = json::object({{"status", confirmed ? r["meta"].value("status", "") : "unconfirmed"}});
+                } catch (const std::exception &e) {
+                    results[i] = json::object({{"status", "failed"}, {"error", e.what()}});
+                }
+                sched.detach(shares[i]);
+            });
         }
-#else
-        fs::path outPath = cfg.path;
-        if (fs::is_directory(outPath)) {
-            outPath /= filename;
+        for (auto &t : threads) {
+            t.join();
         }
-#endif
-
-        // 确保目录存在
-        fs::create_directories(outPath.parent_path());
+        sched.stop();
 
-        // 如果文件已存在，添加时间戳后缀
-        if (fs::exists(outPath)) {
-            auto now = std::chrono::system_clock::now();
-            auto in_time_t = std::chrono::system_clock::to_time_t(now);
-            std::stringstream ss;
-            ss << std::put_time(std::localtime(&in_time_t), "_%Y%m%d_%H%M%S");
-            outPath.replace_filename(outPath.stem().string() + ss.str() + outPath.extension().string());
+        json summary = sched.report();
+        size_t failed = 0;
+        for (size_t i = 0; i < results.size(); ++i) {
+            summary["sessions"][i].update(results[i]);
+            if (results[i].value("status", "") != "success") failed++;
         }
-
-        std::ofstream ofs(outPath, std::ios::binary);
-        if (!ofs) {
-            throw std::runtime_error("Cannot open file for writing: " + outPath.string());
+        std::cout << "\n=== Session Summary ===\n" << summary.dump(4) << std::endl;
+        if (failed > 0) {
+            throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(results.size()) +
+                                     " jobs failed");
         }
+    }
 
-        std::vector<char> buf(APP_BLOCK_SIZE);
-        uint64_t received = 0;
-
-        auto t_start = std::chrono::high_resolution_clock::now();
-        auto last_progress_time = t_start;
+    void runReceiver() {
+        allowPeerMss();
+        UDTSOCKET serv = openListener();
 
-        std::cout << "[INFO] Saving to: " <<
-#ifdef _WIN32
-                Utf8Util::toUtf8(outPath.filename().wstring())
-#else
-                outPath.filename().string()
-#endif
-                << std::endl;
+        sockaddr_in client_addr;
+        int addrlen = sizeof(client_addr);
+        sock = UDT::accept(serv, (sockaddr *) &client_addr, &addrlen);
+        if (sock == UDT::ERROR || sock == UDT::INVALID_SOCK) {
+            std::string error = UDT::getlasterror().getErrorMessage();
+            UDT::close(serv);
+            throw std::runtime_error("Accept failed: " + error);
+        }
 
-        // 接收数据
-        while (received < rSize) {
-            int to_read = static_cast<int>(std::min(
-                static_cast<uint64_t>(APP_BLOCK_SIZE),
-                rSize - received
-            ));
+        std::cout << "[INFO] Connection accepted from client" << std::endl;
 
-            int block_offset = 0;
-            while (block_offset < to_read) {
-                int r = UDT::recv(sock, buf.data() + block_offset, to_read - block_offset, 0);
-                if (r <= 0) {
-                    if (r == UDT::ERROR) {
-                        std::string error = UDT::getlasterror().getErrorMessage();
-                        throw std::runtime_error("Receive error: " + error);
-                    }
-                    break; // 连接关闭
-                }
-                block_offset += r;
+        bool received = false;
+        while (true) {
+            try {
+                received = receiveFile(sock);
+            } catch (...) {
+                UDT::close(serv);
+                throw;
             }
 
-            if (block_offset == 0) break; // 连接关闭
-
-            ofs.write(buf.data(), block_offset);
-            if (!ofs) {
-                throw std::runtime_error("Failed to write to file");
+            UDT::close(sock);
+            sock = UDT::INVALID_SOCK;
+            if (received) {
+                break;
             }
 
-            blake3_hasher_update(&hasher, buf.data(), block_offset);
-            received += block_offset;
-
-            // 显示进度（每秒最多更新一次）
-            auto now = std::chrono::high_resolution_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_progress_time).count();
-
-            if (cfg.detailed || elapsed >= 1000) {
-                double progress = (rSize > 0) ? (static_cast<double>(received) / rSize * 100.0) : 0.0;
-                std::cout << "\r[Progress] " << std::fixed << std::setprecision(1) << progress
-                        << "% | " << Utils::formatSize(received) << " / " << Utils::formatSize(rSize);
-
-                if (cfg.detailed) {
-                    UDT::TRACEINFO tmp;
-                    UDT::perfmon(sock, &tmp);
-                    std::cout << " | Rate: " << std::fixed << std::setprecision(1)
-                            << tmp.mbpsRecvRate << " Mbps";
-                }
-                std::cout << std::flush;
-                last_progress_time = now;
+            // 探测连接：按协商的窗口重建监听（UDT 缓冲只能在绑定前设置）
+            UDT::close(serv);
+            serv = openListener();
+            sock = UDT::accept(serv, (sockaddr *) &client_addr, &addrlen);
+            if (sock == UDT::ERROR || sock == UDT::INVALID_SOCK) {
+                std::string error = UDT::getlasterror().getErrorMessage();
+                UDT::close(serv);
+                throw std::runtime_error("Accept failed: " + error);
             }
         }
 
-        ofs.close();
+        UDT::close(serv);
+    }
 
-        // 检查是否接收到完整文件
-        if (received != rSize) {
-            // 删除不完整的文件
-            try { fs::remove(outPath); } catch (...) {
-            }
-            throw std::runtime_error("File transfer incomplete. Expected: " +
-                                     Utils::formatSize(rSize) + ", Received: " +
-                                     Utils::formatSize(received));
+    // 从 serve 端拉取文件：作为连接发起方，但走接收端流程
+    void runFetch() {
+        if (cfg.remote_name.size() > 65535) {
+            throw std::runtime_error("Remote name too long");
         }
 
-        std::cout << "\n[INFO] File received, computing hash..." << std::endl;
+        choosePathMss();
+        sock = connectPeer();
 
-        // 接收远程哈希
-        uint8_t rHash[BLAKE3_OUT_LEN];
-        int hRead = 0;
-        while (hRead < BLAKE3_OUT_LEN) {
-            int r = UDT::recv(sock, (char *) rHash + hRead, BLAKE3_OUT_LEN - hRead, 0);
-            if (r <= 0) {
-                if (r == UDT::ERROR) {
-                    std::string error = UDT::getlasterror().getErrorMessage();
-                    throw std::runtime_error("Failed to receive hash: " + error);
-                }
-                break;
-            }
-            hRead += r;
-        }
+        FetchRequest req;
+        req.magic = htonl(FETCH_MAGIC);
+        req.mss = htonl(cfg.mss);
+        req.window_size = htonl(cfg.window);
+        req.name_len = htons(static_cast<uint16_t>(cfg.remote_name.size()));
 
-        if (hRead != BLAKE3_OUT_LEN) {
-            throw std::runtime_error("Incomplete hash received");
+        if (!Utils::sendAll(sock, (char *) &req, sizeof(req)) ||
+            !Utils::sendAll(sock, cfg.remote_name.c_str(), static_cast<int>(cfg.remote_name.size()))) {
+            throw std::runtime_error("Failed to send fetch request");
         }
 
-        // 等待传输完成标记
-        char completeMsg[256];
-        int msgSize = UDT::recv(sock, completeMsg, sizeof(completeMsg) - 1, 0);
-        bool transferComplete = false;
-        if (msgSize > 0) {
-            completeMsg[msgSize] = 0;
-            transferComplete = (std::string(completeMsg) == TRANSFER_COMPLETE);
-        }
+        receiveFile(sock);
 
-        if (!transferComplete) {
-            std::cout << "[WARNING] Transfer completion marker not received or incorrect" << std::endl;
-        }
+        UDT::close(sock);
+        sock = UDT::INVALID_SOCK;
+    }
 
-        // 发送确认
-        int ack_sent = 0;
-        while (ack_sent < ACK_TRANSFER.size()) {
-            int s = UDT::send(sock, ACK_TRANSFER.c_str() + ack_sent,
-                              ACK_TRANSFER.size() - ack_sent, 0);
-            if (s == UDT::ERROR) {
-                std::cout << "[WARNING] Failed to send ACK" << std::endl;
-                break;
-            }
-            ack_sent += s;
+    // hruft history [peer]：各对端的吞吐走势，最近一次相对此前基线回退时标出
+    void runHistory() {
+        fs::path file = historyFile();
+        TransferHistory history(file);
+        if (!history.open()) {
+            throw std::runtime_error("No transfer history at " + file.string());
         }
+        history.print(Utils::canonicalIp(cfg.ip), cfg.detailed);
+    }
 
-        auto t_end = std::chrono::high_resolution_clock::now();
-        double duration = std::chrono::duration<double>(t_end - t_start).count();
-
-        // 计算本地哈希
-        uint8_t lHash[BLAKE3_OUT_LEN];
-        blake3_hasher_finalize(&hasher, lHash, BLAKE3_OUT_LEN);
-
-        std::string localHash = Utils::hashToString(lHash, BLAKE3_OUT_LEN);
-        std::string remoteHash = Utils::hashToString(rHash, BLAKE3_OUT_LEN);
-
-        bool match = (localHash == remoteHash);
-
-        std::cout << "[INFO] Hash verification: " << (match ? "PASS" : "FAIL") << std::endl;
-
-        if (!match) {
-            std::cout << "[ERROR] Local hash:  " << localHash << std::endl;
-            std::cout << "[ERROR] Remote hash: " << remoteHash << std::endl;
+    // 单进程服务多个拉取会话，共享块缓存
+    void runServer() {
+        if (!fs::is_directory(cfg.path)) {
+            throw std::runtime_error("Serve root is not a directory: " + cfg.path);
         }
 
-        // 生成JSON报告
-        UDT::TRACEINFO perf;
-        UDT::perfmon(sock, &perf);
-
-        json jStats = NetworkStats::snapshot(perf, duration, rSize);
-        json jFinal = NetworkStats::analyze(jStats, rMSS, rWin);
-
-        jFinal["meta"] = json::object({
-            {
-                "filename",
-#ifdef _WIN32
-                Utf8Util::toUtf8(outPath.filename().wstring())
-#else
-                outPath.filename().string()
-#endif
-            },
-            {"filepath", outPath.string()},
-            {"filesize", rSize},
-            {"filesize_human", Utils::formatSize(rSize)},
-            {"status", match ? "success" : "integrity_failure"},
-            {"hash_match", match},
-            {"local_hash", localHash},
-            {"remote_hash", remoteHash},
-            {"duration_sec", duration},
-            {"avg_speed_mbps", duration > 0 ? (rSize * 8.0 / 1000000.0) / duration : 0.0},
-            {"avg_speed_mbs", duration > 0 ? (rSize / (1024.0 * 1024.0)) / duration : 0.0},
-            {"congestion_control_disabled", cfg.no_cc}  // 新增：显示拥塞控制状态
-        });
-
-        std::string jsonStr = jFinal.dump();
-
-        // 发送报告给发送方
-        int report_sent = 0;
-        while (report_sent < jsonStr.size()) {
-            int s = UDT::send(sock, jsonStr.c_str() + report_sent,
-                              jsonStr.size() - report_sent, 0);
-            if (s == UDT::ERROR) {
-                std::cout << "[WARNING] Failed to send report to sender" << std::endl;
-                break;
+        cache.reset(new BlockCache(static_cast<uint64_t>(cfg.cache_mb) * 1024 * 1024));
+        allowPeerMss();
+
+        UDTSOCKET serv = openListener();
+        std::cout << "[INFO] Serving " << cfg.path << " (cache " << cfg.cache_mb << " MB)" << std::endl;
+
+        // 会话线程保持可 join：会话使用本对象的缓存、锁与指标，退出前必须等它们结束
+        struct Session {
+            std::thread worker;
+            std::shared_ptr<std::atomic<bool> > done;
+        };
+        std::list<Session> sessions;
+        auto prune = [&sessions] {
+            for (auto it = sessions.begin(); it != sessions.end();) {
+                if (it->done->load()) {
+                    it->worker.join();
+                    it = sessions.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        };
+
+        std::atomic<uint64_t> sessionSeq{0};
+        while (true) {
+            sockaddr_in client_addr;
+            int addrlen = sizeof(client_addr);
+            UDTSOCKET s = UDT::accept(serv, (sockaddr *) &client_addr, &addrlen);
+            if (s == UDT::INVALID_SOCK) {
+                std::string error = UDT::getlasterror().getErrorMessage();
+                UDT::close(serv);
+                for (Session &session : sessions) {
+                    session.worker.join();
+                }
+                throw std::runtime_error("Accept failed: " + error);
             }
-            report_sent += s;
-        }
-
-        // 本地显示
-        std::cout << "\n=== Transfer Summary ===\n" << jFinal.dump(4) << std::endl;
 
-        UDT::close(sock);
-        sock = UDT::INVALID_SOCK;
-        UDT::close(serv);
+            prune();
+            uint64_t id = ++sessionSeq;
+            std::shared_ptr<std::atomic<bool> > done = std::make_shared<std::atomic<bool> >(false);
+            sessions.push_back(Session{std::thread([this, s, id, done] {
+                {
+                    ThreadRoles::Scope role("serve");
+                    try {
+                        serveSession(s, id);
+                    } catch (const std::exception &e) {
+                        std::lock_guard<std::mutex> lk(logMutex);
+                        std::cerr << "[ERROR] [session " << id << "] " << e.what() << std::endl;
+                    }
+                    UDT::close(s);
+                }
+                done->store(true);
+            }), done});
+        }
     }
 };
 
@@ -957,12 +8742,17 @@ int main(int argc, char* argv[]) {
     argv = newArgv.data();
 #endif
 
+    ThreadRoles::Scope mainRole("main", false);
     try {
         Config cfg = Config::parse(argc, argv);
         HruftPro app(cfg);
 
-        if (cfg.mode == "send") app.runSender();
+        if (cfg.mode == "send" && !cfg.jobs_file.empty()) app.runJobs();
+        else if (cfg.mode == "send") app.runSender();
         else if (cfg.mode == "recv") app.runReceiver();
+        else if (cfg.mode == "serve") app.runServer();
+        else if (cfg.mode == "fetch") app.runFetch();
+        else if (cfg.mode == "history") app.runHistory();
 
     } catch (const std::exception& e) {
         std::cerr << "[ERROR] " << e.what() << std::endl;